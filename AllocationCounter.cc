@@ -0,0 +1,33 @@
+/** @file AllocationCounter.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Replacement of operator new which counts the allocations of a program, see allocation_count()
+
+Only the programs which measure their allocations link in this file, the benchmarks in particular. The other programs keep the operator new of the standard library, without an atomic increment on every allocation.
+*/
+#include "Instrumentation.h"
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+#ifndef RANDOMCHAINS_NO_INSTRUMENTATION
+
+/** Counts every allocation of the program. The memory is taken from malloc(), as by the operator new of the standard library. */
+void* operator new(size_t size) {
+	count_allocation(size);
+	if(size == 0) size = 1;
+	void* memory = malloc(size);
+	while(!memory) {
+		new_handler handler = get_new_handler();
+		if(!handler) throw bad_alloc();
+		handler();
+		memory = malloc(size);
+	}
+	return memory;
+}
+
+void operator delete(void* memory) noexcept {
+	free(memory);
+}
+
+#endif
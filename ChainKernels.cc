@@ -0,0 +1,426 @@
+/** @file ChainKernels.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Scalar, AVX2 and AVX-512 implementations of the kernels declared in ChainKernels.h
+
+The probability to observe at least one decay in a time span, <em>1 - Poisson_pmf(0, lambda)</em>, is computed as <em>-expm1(-lambda)</em>. For the small expected values of the background, <em>1 - exp(-lambda)</em> loses most of its significant digits in the subtraction, while <em>-expm1(-lambda)</em> is accurate to a few units in the last place for all <em>lambda</em>.
+
+All implementations evaluate the same operations in the same order, with fused multiply-adds, so the scalar fallback and the vectorised kernels give bitwise identical results. The pixel sums use eight partial sums in all implementations for the same reason. Only on a processor without FMA, which has no vectorised kernels either, the scalar kernels round the products of the multiply-adds, and their results may differ from those of other processors in the last bits, see multiply_add().
+*/
+#include "ChainKernels.h"
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <immintrin.h>
+
+using namespace std;
+
+namespace {
+
+//Constants of the evaluation of expm1(y) = 2^k*(expm1(r) + 1) - 1, with y = k*ln(2) + r and |r| <= ln(2)/2
+const double round_shifter = 6755399441055744.0;	//1.5*2^52, adding it rounds to an integer kept in the low bits
+const double inv_ln2 = 1.4426950408889634;
+const double ln2_hi = 6.93147180369123816490e-01;	//The upper bits of ln(2), k*ln2_hi is exact
+const double ln2_lo = 1.90821492927058770002e-10;
+//Beyond this |y| the result is -1 (or overflows), the clamp keeps 2^k a normal number
+const double max_exponent = 708;
+
+//Taylor coefficients 1/n! of expm1(r) = r + r^2*(c2 + c3*r + ... + c13*r^11)
+const double c2 = 1.0/2, c3 = 1.0/6, c4 = 1.0/24, c5 = 1.0/120, c6 = 1.0/720, c7 = 1.0/5040;
+const double c8 = 1.0/40320, c9 = 1.0/362880, c10 = 1.0/3628800, c11 = 1.0/39916800;
+const double c12 = 1.0/479001600, c13 = 1.0/6227020800.0;
+
+/** <em>a*b + c</em>: rounded once with the FMA instruction if <em>fused</em>, otherwise a multiplication and an addition. The scalar kernels which run next to the vectorised ones are fused, so they round as these do, and only processors without FMA use the unfused kernels. A call of <tt>fma()</tt> instead would be a call of the C library for every operation where FMA is not enabled at compile time. */
+template <bool fused>
+__attribute__((always_inline)) inline double multiply_add(double a, double b, double c) {
+	return fused ? __builtin_fma(a, b, c) : a*b + c;
+}
+
+/** <em>-expm1(-x)</em>, one value at a time. The operations are the same as in the vectorised kernels. */
+template <bool fused>
+__attribute__((always_inline)) inline double neg_expm1_neg_scalar(double x) {
+	double y = -x;
+	y = (max_exponent < y) ? max_exponent : y;
+	y = (y < -max_exponent) ? -max_exponent : y;
+
+	double t = multiply_add<fused>(y, inv_ln2, round_shifter);
+	double kd = t - round_shifter;
+	double r = multiply_add<fused>(kd, -ln2_hi, y);
+	r = multiply_add<fused>(kd, -ln2_lo, r);
+
+	double q = c13;
+	q = multiply_add<fused>(q, r, c12);
+	q = multiply_add<fused>(q, r, c11);
+	q = multiply_add<fused>(q, r, c10);
+	q = multiply_add<fused>(q, r, c9);
+	q = multiply_add<fused>(q, r, c8);
+	q = multiply_add<fused>(q, r, c7);
+	q = multiply_add<fused>(q, r, c6);
+	q = multiply_add<fused>(q, r, c5);
+	q = multiply_add<fused>(q, r, c4);
+	q = multiply_add<fused>(q, r, c3);
+	q = multiply_add<fused>(q, r, c2);
+	double p = multiply_add<fused>(r*r, q, r);
+
+	//2^k from the integer in the low bits of t
+	uint64_t bits;
+	memcpy(&bits, &t, sizeof(bits));
+	bits = (bits + 1023) << 52;
+	double scale;
+	memcpy(&scale, &bits, sizeof(scale));
+
+	return multiply_add<fused>(-scale, p, 1 - scale);
+}
+
+void multiply_scalar(double* randoms, const double* rate, double time_span, int n) {
+	for(int i = 0; i < n; i++) randoms[i] *= neg_expm1_neg_scalar<false>(rate[i]*time_span);
+}
+
+__attribute__((target("fma")))
+void multiply_scalar_fma(double* randoms, const double* rate, double time_span, int n) {
+	for(int i = 0; i < n; i++) randoms[i] *= neg_expm1_neg_scalar<true>(rate[i]*time_span);
+}
+
+/** Adds the values to the eight partial sums, value <em>i</em> to the partial sum <em>i</em>%8. */
+void add_to_partial_sums(double* partial, const double* values, int n) {
+	for(int i = 0; i < n; i++) partial[i & 7] += values[i];
+}
+
+/** The sum of the eight partial sums, in a fixed order. */
+double reduce_partial_sums(const double* partial) {
+	return ((partial[0] + partial[4]) + (partial[2] + partial[6])) + ((partial[1] + partial[5]) + (partial[3] + partial[7]));
+}
+
+double sum_scalar(const double* values, int n) {
+	double partial[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	add_to_partial_sums(partial, values, n);
+	return reduce_partial_sums(partial);
+}
+
+__attribute__((target("avx2,fma")))
+inline __m256d neg_expm1_neg_avx2(__m256d x) {
+	const __m256d limit = _mm256_set1_pd(max_exponent);
+	const __m256d shifter = _mm256_set1_pd(round_shifter);
+	__m256d y = _mm256_sub_pd(_mm256_setzero_pd(), x);
+	y = _mm256_min_pd(limit, y);
+	y = _mm256_max_pd(_mm256_sub_pd(_mm256_setzero_pd(), limit), y);
+
+	__m256d t = _mm256_fmadd_pd(y, _mm256_set1_pd(inv_ln2), shifter);
+	__m256d kd = _mm256_sub_pd(t, shifter);
+	__m256d r = _mm256_fmadd_pd(kd, _mm256_set1_pd(-ln2_hi), y);
+	r = _mm256_fmadd_pd(kd, _mm256_set1_pd(-ln2_lo), r);
+
+	__m256d q = _mm256_set1_pd(c13);
+	q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(c12));
+	q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(c11));
+	q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(c10));
+	q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(c9));
+	q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(c8));
+	q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(c7));
+	q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(c6));
+	q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(c5));
+	q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(c4));
+	q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(c3));
+	q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(c2));
+	__m256d p = _mm256_fmadd_pd(_mm256_mul_pd(r, r), q, r);
+
+	__m256i bits = _mm256_slli_epi64(_mm256_add_epi64(_mm256_castpd_si256(t), _mm256_set1_epi64x(1023)), 52);
+	__m256d scale = _mm256_castsi256_pd(bits);
+
+	__m256d one = _mm256_set1_pd(1);
+	return _mm256_fmadd_pd(_mm256_sub_pd(_mm256_setzero_pd(), scale), p, _mm256_sub_pd(one, scale));
+}
+
+__attribute__((target("avx2,fma")))
+void multiply_avx2(double* randoms, const double* rate, double time_span, int n) {
+	const __m256d span = _mm256_set1_pd(time_span);
+	int i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m256d x = _mm256_mul_pd(_mm256_loadu_pd(rate + i), span);
+		_mm256_storeu_pd(randoms + i, _mm256_mul_pd(_mm256_loadu_pd(randoms + i), neg_expm1_neg_avx2(x)));
+	}
+	multiply_scalar_fma(randoms + i, rate + i, time_span, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+double sum_avx2(const double* values, int n) {
+	//Partial sums 0-3 and 4-7
+	__m256d low = _mm256_setzero_pd(), high = _mm256_setzero_pd();
+	int i = 0;
+	for(; i + 8 <= n; i += 8) {
+		low = _mm256_add_pd(low, _mm256_loadu_pd(values + i));
+		high = _mm256_add_pd(high, _mm256_loadu_pd(values + i + 4));
+	}
+	double partial[8];
+	_mm256_storeu_pd(partial, low);
+	_mm256_storeu_pd(partial + 4, high);
+	add_to_partial_sums(partial, values + i, n - i);
+	return reduce_partial_sums(partial);
+}
+
+//The builtins of _mm512_min_pd(), _mm512_max_pd() and _mm512_slli_epi64() start from an undefined vector, which GCC wrongly reports as maybe uninitialised
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+inline __m512d neg_expm1_neg_avx512(__m512d x) {
+	const __m512d limit = _mm512_set1_pd(max_exponent);
+	const __m512d shifter = _mm512_set1_pd(round_shifter);
+	__m512d y = _mm512_sub_pd(_mm512_setzero_pd(), x);
+	y = _mm512_min_pd(limit, y);
+	y = _mm512_max_pd(_mm512_sub_pd(_mm512_setzero_pd(), limit), y);
+
+	__m512d t = _mm512_fmadd_pd(y, _mm512_set1_pd(inv_ln2), shifter);
+	__m512d kd = _mm512_sub_pd(t, shifter);
+	__m512d r = _mm512_fmadd_pd(kd, _mm512_set1_pd(-ln2_hi), y);
+	r = _mm512_fmadd_pd(kd, _mm512_set1_pd(-ln2_lo), r);
+
+	__m512d q = _mm512_set1_pd(c13);
+	q = _mm512_fmadd_pd(q, r, _mm512_set1_pd(c12));
+	q = _mm512_fmadd_pd(q, r, _mm512_set1_pd(c11));
+	q = _mm512_fmadd_pd(q, r, _mm512_set1_pd(c10));
+	q = _mm512_fmadd_pd(q, r, _mm512_set1_pd(c9));
+	q = _mm512_fmadd_pd(q, r, _mm512_set1_pd(c8));
+	q = _mm512_fmadd_pd(q, r, _mm512_set1_pd(c7));
+	q = _mm512_fmadd_pd(q, r, _mm512_set1_pd(c6));
+	q = _mm512_fmadd_pd(q, r, _mm512_set1_pd(c5));
+	q = _mm512_fmadd_pd(q, r, _mm512_set1_pd(c4));
+	q = _mm512_fmadd_pd(q, r, _mm512_set1_pd(c3));
+	q = _mm512_fmadd_pd(q, r, _mm512_set1_pd(c2));
+	__m512d p = _mm512_fmadd_pd(_mm512_mul_pd(r, r), q, r);
+
+	__m512i bits = _mm512_slli_epi64(_mm512_add_epi64(_mm512_castpd_si512(t), _mm512_set1_epi64(1023)), 52);
+	__m512d scale = _mm512_castsi512_pd(bits);
+
+	__m512d one = _mm512_set1_pd(1);
+	return _mm512_fmadd_pd(_mm512_sub_pd(_mm512_setzero_pd(), scale), p, _mm512_sub_pd(one, scale));
+}
+#pragma GCC diagnostic pop
+
+__attribute__((target("avx512f")))
+void multiply_avx512(double* randoms, const double* rate, double time_span, int n) {
+	const __m512d span = _mm512_set1_pd(time_span);
+	int i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m512d x = _mm512_mul_pd(_mm512_loadu_pd(rate + i), span);
+		_mm512_storeu_pd(randoms + i, _mm512_mul_pd(_mm512_loadu_pd(randoms + i), neg_expm1_neg_avx512(x)));
+	}
+	multiply_scalar_fma(randoms + i, rate + i, time_span, n - i);
+}
+
+__attribute__((target("avx512f")))
+double sum_avx512(const double* values, int n) {
+	__m512d acc = _mm512_setzero_pd();
+	int i = 0;
+	for(; i + 8 <= n; i += 8) acc = _mm512_add_pd(acc, _mm512_loadu_pd(values + i));
+	double partial[8];
+	_mm512_storeu_pd(partial, acc);
+	add_to_partial_sums(partial, values + i, n - i);
+	return reduce_partial_sums(partial);
+}
+
+/** Makes the compiler round a product before it is added to the partial sums. Otherwise it may fuse the last multiplication with the addition, which the kernels of the single decays can not do since they store the products in between. */
+inline void round_product(double& value) {
+	__asm__("" : "+x"(value));
+}
+
+__attribute__((target("avx2,fma")))
+inline void round_product(__m256d& value) {
+	__asm__("" : "+x"(value));
+}
+
+__attribute__((target("avx512f")))
+inline void round_product(__m512d& value) {
+	__asm__("" : "+v"(value));
+}
+
+/** The expected random chains of a chain of <em>L</em> decays, summed over <em>n</em> pixels: the implants of every pixel are multiplied by the probability of every decay in order of the decays, and the products are summed as by sum_scalar(). The loop over the decays has a fixed length, so it is unrolled and the product of a pixel stays in a register. */
+template <int L, bool fused>
+__attribute__((always_inline)) inline double chain_sum_scalar_pixels(const long long* implants, const double* const* rates, const double* time_spans, int n) {
+	double partial[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	for(int i = 0; i < n; i++) {
+		double randoms = implants[i];
+		for(int l = 0; l < L; l++) randoms *= neg_expm1_neg_scalar<fused>(rates[l][i]*time_spans[l]);
+		round_product(randoms);
+		partial[i & 7] += randoms;
+	}
+	return reduce_partial_sums(partial);
+}
+
+template <int L>
+double chain_sum_scalar(const long long* implants, const double* const* rates, const double* time_spans, int n) {
+	return chain_sum_scalar_pixels<L, false>(implants, rates, time_spans, n);
+}
+
+/** chain_sum_scalar() with the FMA instruction, see multiply_add(). */
+template <int L>
+__attribute__((target("fma")))
+double chain_sum_scalar_fma(const long long* implants, const double* const* rates, const double* time_spans, int n) {
+	return chain_sum_scalar_pixels<L, true>(implants, rates, time_spans, n);
+}
+
+/** chain_sum_scalar() with AVX2, 8 pixels at a time in two vectors, which are added to the partial sums as by sum_avx2(). */
+template <int L>
+__attribute__((target("avx2,fma")))
+double chain_sum_avx2(const long long* implants, const double* const* rates, const double* time_spans, int n) {
+	__m256d span[L];
+	for(int l = 0; l < L; l++) span[l] = _mm256_set1_pd(time_spans[l]);
+
+	__m256d low = _mm256_setzero_pd(), high = _mm256_setzero_pd();
+	int i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m256d randoms_low = _mm256_set_pd(implants[i+3], implants[i+2], implants[i+1], implants[i]);
+		__m256d randoms_high = _mm256_set_pd(implants[i+7], implants[i+6], implants[i+5], implants[i+4]);
+		for(int l = 0; l < L; l++) {
+			randoms_low = _mm256_mul_pd(randoms_low, neg_expm1_neg_avx2(_mm256_mul_pd(_mm256_loadu_pd(rates[l] + i), span[l])));
+			randoms_high = _mm256_mul_pd(randoms_high, neg_expm1_neg_avx2(_mm256_mul_pd(_mm256_loadu_pd(rates[l] + i + 4), span[l])));
+		}
+		round_product(randoms_low);
+		round_product(randoms_high);
+		low = _mm256_add_pd(low, randoms_low);
+		high = _mm256_add_pd(high, randoms_high);
+	}
+	double partial[8];
+	_mm256_storeu_pd(partial, low);
+	_mm256_storeu_pd(partial + 4, high);
+	for(; i < n; i++) {
+		double randoms = implants[i];
+		for(int l = 0; l < L; l++) randoms *= neg_expm1_neg_scalar<true>(rates[l][i]*time_spans[l]);
+		round_product(randoms);
+		partial[i & 7] += randoms;
+	}
+	return reduce_partial_sums(partial);
+}
+
+/** chain_sum_scalar() with AVX-512, 8 pixels at a time, which are added to the partial sums as by sum_avx512(). */
+template <int L>
+__attribute__((target("avx512f")))
+double chain_sum_avx512(const long long* implants, const double* const* rates, const double* time_spans, int n) {
+	__m512d span[L];
+	for(int l = 0; l < L; l++) span[l] = _mm512_set1_pd(time_spans[l]);
+
+	__m512d acc = _mm512_setzero_pd();
+	int i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m512d randoms = _mm512_set_pd(implants[i+7], implants[i+6], implants[i+5], implants[i+4], implants[i+3], implants[i+2], implants[i+1], implants[i]);
+		for(int l = 0; l < L; l++) {
+			randoms = _mm512_mul_pd(randoms, neg_expm1_neg_avx512(_mm512_mul_pd(_mm512_loadu_pd(rates[l] + i), span[l])));
+		}
+		round_product(randoms);
+		acc = _mm512_add_pd(acc, randoms);
+	}
+	double partial[8];
+	_mm512_storeu_pd(partial, acc);
+	for(; i < n; i++) {
+		double randoms = implants[i];
+		for(int l = 0; l < L; l++) randoms *= neg_expm1_neg_scalar<true>(rates[l][i]*time_spans[l]);
+		round_product(randoms);
+		partial[i & 7] += randoms;
+	}
+	return reduce_partial_sums(partial);
+}
+
+//The chain kernels of every instruction set, for the chains of 1 to max_unrolled_chain_length decays
+const ChainSumKernel chain_sum_kernels[3][max_unrolled_chain_length + 1] = {
+	{NULL, chain_sum_scalar_fma<1>, chain_sum_scalar_fma<2>, chain_sum_scalar_fma<3>, chain_sum_scalar_fma<4>},
+	{NULL, chain_sum_avx2<1>, chain_sum_avx2<2>, chain_sum_avx2<3>, chain_sum_avx2<4>},
+	{NULL, chain_sum_avx512<1>, chain_sum_avx512<2>, chain_sum_avx512<3>, chain_sum_avx512<4>}
+};
+
+/** True if the processor has the FMA instruction of the fused scalar kernels, see multiply_add(). */
+bool fma_supported() {
+	static const bool supported = (__builtin_cpu_init(), __builtin_cpu_supports("fma"));
+	return supported;
+}
+
+//The scalar chain kernels of the processors without FMA
+const ChainSumKernel unfused_chain_sum_kernels[max_unrolled_chain_length + 1] = {NULL, chain_sum_scalar<1>, chain_sum_scalar<2>, chain_sum_scalar<3>, chain_sum_scalar<4>};
+
+//The kernels in use, the scalar ones until the best supported kernels are chosen when the program starts
+SimdLevel current_level = SIMD_SCALAR;
+void (*multiply_kernel)(double*, const double*, double, int) = multiply_scalar;
+double (*sum_kernel)(const double*, int) = sum_scalar;
+bool chain_kernels_unrolled = true;
+const SimdLevel initial_level = set_simd_level(SIMD_AVX512);
+
+}
+
+/** The best instruction set supported by the processor. */
+SimdLevel simd_supported_level() {
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMD_AVX2;
+	return SIMD_SCALAR;
+}
+
+/** The instruction set of the kernels in use. */
+SimdLevel simd_level() {
+	return current_level;
+}
+
+/** Chooses the kernels of <em>level</em>, or of the best supported level below it. Since all kernels give the same results, this is only of interest for the benchmarks.
+	@return the level in use
+*/
+SimdLevel set_simd_level(SimdLevel level) {
+	SimdLevel supported = simd_supported_level();
+	if(level > supported) level = supported;
+	current_level = level;
+	switch(level) {
+		case SIMD_AVX512 :
+			multiply_kernel = multiply_avx512;
+			sum_kernel = sum_avx512;
+			break;
+		case SIMD_AVX2 :
+			multiply_kernel = multiply_avx2;
+			sum_kernel = sum_avx2;
+			break;
+		default :
+			multiply_kernel = fma_supported() ? multiply_scalar_fma : multiply_scalar;
+			sum_kernel = sum_scalar;
+	}
+	return level;
+}
+
+/** Turns the chain kernels of chain_sum_kernel() on or off. Since they give the same results as the kernels of the single decays, this is only of interest for the benchmarks.
+	@return true if the chain kernels were in use before
+*/
+bool set_unrolled_chain_kernels(bool unrolled) {
+	bool before = chain_kernels_unrolled;
+	chain_kernels_unrolled = unrolled;
+	return before;
+}
+
+/** The kernel of the instruction set in use for the chains of <em>length</em> decays, see ChainSumKernel.
+	@return NULL if there is no kernel for this length, the chain is then evaluated decay by decay with multiply_decay_probability() and sum_pixels()
+*/
+ChainSumKernel chain_sum_kernel(int length) {
+	if(!chain_kernels_unrolled || length < 1 || length > max_unrolled_chain_length) return NULL;
+	if(current_level == SIMD_SCALAR && !fma_supported()) return unfused_chain_sum_kernels[length];
+	return chain_sum_kernels[current_level][length];
+}
+
+const char* simd_level_name(SimdLevel level) {
+	switch(level) {
+		case SIMD_AVX512 : return "AVX-512";
+		case SIMD_AVX2 : return "AVX2";
+		case SIMD_SCALAR : return "scalar";
+	}
+	return "";
+}
+
+/** The probability to observe at least one decay, <em>1 - Poisson_pmf(0, expected_value) = -expm1(-expected_value)</em>. */
+double decay_probability(double expected_value) {
+	double probability = 1;
+	multiply_kernel(&probability, &expected_value, 1, 1);
+	return probability;
+}
+
+/** Multiplies <em>randoms[i]</em> by the probability to observe at least one decay with the rate <em>rate[i]</em> in <em>time_span</em>, for <em>n</em> pixels.
+	@see decay_probability()
+*/
+void multiply_decay_probability(double* randoms, const double* rate, double time_span, int n) {
+	multiply_kernel(randoms, rate, time_span, n);
+}
+
+/** The sum of <em>n</em> values, with eight partial sums which are added in a fixed order. The result does not depend on the instruction set. */
+double sum_pixels(const double* values, int n) {
+	return sum_kernel(values, n);
+}
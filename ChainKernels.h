@@ -0,0 +1,33 @@
+/** @file ChainKernels.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Vectorised kernels of the per-pixel random chain product and of the pixel sums
+*/
+#ifndef CHAINKERNELS_H
+#define CHAINKERNELS_H
+
+//The instruction sets for which the kernels are compiled, the best one supported by the processor is chosen at runtime
+enum SimdLevel {
+	SIMD_SCALAR,
+	SIMD_AVX2,	//AVX2 and FMA, 4 values at a time
+	SIMD_AVX512	//AVX-512F, 8 values at a time
+};
+
+SimdLevel simd_supported_level();
+SimdLevel simd_level();
+SimdLevel set_simd_level(SimdLevel level);
+const char* simd_level_name(SimdLevel level);
+
+double decay_probability(double expected_value);
+void multiply_decay_probability(double* randoms, const double* rate, double time_span, int n);
+double sum_pixels(const double* values, int n);
+
+/** A kernel of one chain of a fixed number of decays, see chain_sum_kernel(): the expected random chains summed over <em>n</em> pixels, with the implants of every pixel and the rate vector and time span of every decay. The result is bitwise the same as that of multiply_decay_probability() for every decay followed by sum_pixels(). */
+typedef double (*ChainSumKernel)(const long long* implants, const double* const* rates, const double* time_spans, int n);
+
+//The longest chains with a kernel of their own, longer chains are evaluated decay by decay. From 5 decays on the rate pointers and spans no longer stay in the registers, and the chain kernels are not faster, see bench_chain_kernels().
+const int max_unrolled_chain_length = 4;
+
+ChainSumKernel chain_sum_kernel(int length);
+bool set_unrolled_chain_kernels(bool unrolled);
+
+#endif
@@ -0,0 +1,210 @@
+/** @file ChainSet.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Implementation of the batch evaluation of decay chains declared in ChainSet.h
+*/
+#include "ChainSet.h"
+#include <algorithm>
+#include "ChainKernels.h"
+
+using namespace std;
+
+const int ChainSet::tile_pixels;
+const int ChainSet::tiles_per_task;
+
+/** Removes all chains, the memory is kept for the next set. */
+void ChainSet::clear() {
+	first_decay.resize(1);
+	decay_rate_row.clear();
+	decay_time_span.clear();
+}
+
+/** Reserves memory for <em>nbr_chains</em> chains with <em>nbr_decays</em> decays in total, so that add_chain() does not allocate. */
+void ChainSet::reserve(int nbr_chains, int nbr_decays) {
+	first_decay.reserve(nbr_chains + 1);
+	decay_rate_row.reserve(nbr_decays);
+	decay_time_span.reserve(nbr_decays);
+}
+
+/** Adds a chain at the end of the set.
+	@param rate_rows the row in the rate matrix of every decay of the chain
+	@param time_spans the time span in s of every decay of the chain
+	@param length the number of decays of the chain
+*/
+void ChainSet::add_chain(const int* rate_rows, const double* time_spans, int length) {
+	decay_rate_row.insert(decay_rate_row.end(), rate_rows, rate_rows + length);
+	decay_time_span.insert(decay_time_span.end(), time_spans, time_spans + length);
+	first_decay.push_back(decay_rate_row.size());
+}
+
+/** Replaces the set by the chains of <em>lengths</em>, whose decays follow each other in <em>rate_rows</em> and <em>time_spans</em>.
+	@param lengths the number of decays of every chain
+	@param rate_rows the row in the rate matrix of every decay
+	@param time_spans the time span in s of every decay
+*/
+void ChainSet::assign(const vector<int>& lengths, const vector<int>& rate_rows, const vector<double>& time_spans) {
+	clear();
+	reserve(lengths.size(), rate_rows.size());
+	int offset = 0;
+	for(unsigned int j = 0; j < lengths.size(); j++) {
+		add_chain(rate_rows.data() + offset, time_spans.data() + offset, lengths[j]);
+		offset += lengths[j];
+	}
+}
+
+/** Computes the expected number of random chains of every chain in the set.
+In every pixel the number of implants is multiplied by the probability <em>-expm1(-rate*time_span)</em> to observe at least one decay for every decay of a chain, i.e. <em>1 - Poisson_pmf(0, rate*time_span)</em>. The values of the pixels of a tile are summed with sum_pixels(). Both kernels are vectorised, see ChainKernels.h, and give the same results for all instruction sets.
+
+With a pool the tiles are split over its threads in tasks of tiles_per_task tiles. How the tile sums are added depends on <em>deterministic</em>:
+	- true: the tile sums of every block of tiles_per_task tiles are added in order of the pixels, and the block sums are added in a fixed pairwise tree. The blocks do not depend on the pool, so the totals are bitwise the same for any number of threads.
+	- false: every thread adds the tile sums to its own partial totals, which are added in the same tree at the end. This saves the block sums, but which tiles end up in which partial total depends on the scheduling, so the last digits may change from run to run.
+
+The per-tile buffer is kept on the stack, only the block sums or the partial totals are allocated.
+	@param rate the rate vectors, one row per distinct rate and one column per pixel of <em>implants</em>
+	@param implants the number of implants of every pixel
+	@param totals the expected number of random chains of every chain, <em>chains()</em> values are written
+	@param pool the threads to use, NULL to evaluate in the calling thread
+	@param deterministic true for totals which do not depend on the number of threads
+*/
+void ChainSet::evaluate(const PixelMatrix<double>& rate, const vector<long long>& implants, double* totals, ThreadPool* pool, bool deterministic) const {
+	const int nbr_pixels = implants.size();
+	const int nbr_chains = chains();
+	const int nbr_tiles = (nbr_pixels + tile_pixels - 1)/tile_pixels;
+	const int nbr_blocks = blocks(nbr_pixels);
+	const int nbr_slots = pool ? pool->size() : 1;
+
+	//The sums of every block in the deterministic mode, otherwise the partial totals of every slot of the pool
+	const int nbr_rows = deterministic ? nbr_blocks : nbr_slots;
+	vector<double> partial_totals((size_t)nbr_rows*nbr_chains, 0.);
+
+	auto evaluate_tiles = [this, &rate, &implants, &partial_totals, nbr_pixels, nbr_chains, deterministic](int first_tile, int last_tile, int slot) {
+		for(int t = first_tile; t < last_tile; t++) {
+			double* row_totals = &partial_totals[(size_t)(deterministic ? t/tiles_per_task : slot)*nbr_chains];
+			add_tile(rate, implants.data(), t*tile_pixels, min(tile_pixels, nbr_pixels - t*tile_pixels), row_totals);
+		}
+	};
+
+	//The tasks are aligned to the blocks, so every block is summed by one thread in order of the pixels
+	if(pool) pool->parallel_for(0, nbr_tiles, tiles_per_task, evaluate_tiles);
+	else evaluate_tiles(0, nbr_tiles, 0);
+
+	reduce_rows(partial_totals.data(), nbr_rows, nbr_chains, totals);
+}
+
+/** Adds the expected number of random chains in the <em>tile</em> pixels from <em>first_pixel</em> on to <em>row_totals</em>, for every chain.
+A chain of up to max_unrolled_chain_length decays is evaluated by the kernel of its length, see chain_sum_kernel(), which multiplies the probabilities of all decays of a pixel in registers and sums the pixels in the same pass. Longer chains are multiplied decay by decay in a buffer of the tile. Both give bitwise the same sums.
+*/
+void ChainSet::add_tile(const PixelMatrix<double>& rate, const long long* implants, int first_pixel, int tile, double* row_totals) const {
+	double randoms_in_pixel[tile_pixels];
+	const long long* tile_implants = implants + first_pixel;
+	const double* tile_rates[max_unrolled_chain_length];
+
+	for(int j = 0; j < chains(); j++) {
+		//The kernel is chosen once per chain and tile, not per pixel
+		ChainSumKernel kernel = chain_sum_kernel(length(j));
+		if(kernel) {
+			for(int l = first_decay[j]; l < first_decay[j+1]; l++) tile_rates[l - first_decay[j]] = rate.row(decay_rate_row[l]).data() + first_pixel;
+			row_totals[j] += kernel(tile_implants, tile_rates, &decay_time_span[first_decay[j]], tile);
+			continue;
+		}
+
+		for(int i = 0; i < tile; i++) randoms_in_pixel[i] = tile_implants[i];
+
+		for(int l = first_decay[j]; l < first_decay[j+1]; l++) {
+			const double* tile_rate = rate.row(decay_rate_row[l]).data() + first_pixel;
+			multiply_decay_probability(randoms_in_pixel, tile_rate, decay_time_span[l], tile);
+		}
+
+		row_totals[j] += sum_pixels(randoms_in_pixel, tile);
+	}
+}
+
+/** The number of blocks of tiles_per_task tiles of the deterministic reduction of <em>nbr_pixels</em> pixels. */
+int ChainSet::blocks(int nbr_pixels) {
+	const int nbr_tiles = (nbr_pixels + tile_pixels - 1)/tile_pixels;
+	return (nbr_tiles + tiles_per_task - 1)/tiles_per_task;
+}
+
+/** The sums of block <em>block</em> of every chain, exactly as they are reduced by evaluate() in the deterministic mode.
+Only the pixels of the block are evaluated, so a caller which keeps the block sums can recompute those of the blocks whose pixels have changed and reduce them again with reduce_rows(), e.g. LiveDataset.
+	@param block_totals the <em>chains()</em> sums of the block are written here
+*/
+void ChainSet::evaluate_block(const PixelMatrix<double>& rate, const vector<long long>& implants, int block, double* block_totals) const {
+	const int nbr_pixels = implants.size();
+	for(int j = 0; j < chains(); j++) block_totals[j] = 0;
+	for(int t = block*tiles_per_task; t < (block + 1)*tiles_per_task && t*tile_pixels < nbr_pixels; t++) {
+		add_tile(rate, implants.data(), t*tile_pixels, min(tile_pixels, nbr_pixels - t*tile_pixels), block_totals);
+	}
+}
+
+/** The sums of tile <em>tile</em> of every chain, as they are added to the block sums by evaluate() in the deterministic mode.
+	@param tile_totals the <em>chains()</em> sums of the tile are written here
+*/
+void ChainSet::evaluate_tile(const PixelMatrix<double>& rate, const vector<long long>& implants, int tile, double* tile_totals) const {
+	const int nbr_pixels = implants.size();
+	for(int j = 0; j < chains(); j++) tile_totals[j] = 0;
+	add_tile(rate, implants.data(), tile*tile_pixels, min(tile_pixels, nbr_pixels - tile*tile_pixels), tile_totals);
+}
+
+/** The totals of evaluate() in the deterministic mode from the sums of all tiles, see evaluate_tile(): the tiles are added to their blocks in order of the pixels, and the blocks are reduced with reduce_rows(). The tiles may thus be evaluated anywhere, e.g. by the shards of run_shard(), and still give bitwise the same totals.
+	@param tile_totals the sums of every chain in every tile, <em>nbr_tiles</em> x <em>nbr_chains</em>
+	@param totals the <em>nbr_chains</em> totals
+*/
+void ChainSet::reduce_tiles(const double* tile_totals, int nbr_tiles, int nbr_chains, double* totals) {
+	const int nbr_blocks = (nbr_tiles + tiles_per_task - 1)/tiles_per_task;
+	vector<double> rows((size_t)nbr_blocks*nbr_chains, 0.);
+	for(int t = 0; t < nbr_tiles; t++) {
+		double* row = &rows[(size_t)(t/tiles_per_task)*nbr_chains];
+		const double* tile = tile_totals + (size_t)t*nbr_chains;
+		for(int j = 0; j < nbr_chains; j++) row[j] += tile[j];
+	}
+	reduce_rows(rows.data(), nbr_blocks, nbr_chains, totals);
+}
+
+/** Adds <em>nbr_rows</em> rows of <em>nbr_chains</em> sums in a fixed pairwise tree: row <em>b</em> accumulates rows <em>b</em> to <em>b + 2 width - 1</em>. The rows are overwritten.
+	@param totals the <em>nbr_chains</em> totals, 0 if there are no rows
+*/
+void ChainSet::reduce_rows(double* rows, int nbr_rows, int nbr_chains, double* totals) {
+	for(int width = 1; width < nbr_rows; width *= 2) {
+		for(int b = 0; b + width < nbr_rows; b += 2*width) {
+			double* row = rows + (size_t)b*nbr_chains;
+			const double* other = rows + (size_t)(b + width)*nbr_chains;
+			for(int j = 0; j < nbr_chains; j++) row[j] += other[j];
+		}
+	}
+	for(int j = 0; j < nbr_chains; j++) totals[j] = nbr_rows > 0 ? rows[j] : 0;
+}
+
+namespace {
+
+/** The sum of the pixels of block <em>block</em>: the tile sums in order of the pixels. */
+double block_sum(const double* values, int nbr_pixels, int block) {
+	double total = 0;
+	int first_tile = block*ChainSet::tiles_per_task;
+	for(int t = first_tile; t < first_tile + ChainSet::tiles_per_task; t++) {
+		int first_pixel = t*ChainSet::tile_pixels;
+		if(first_pixel >= nbr_pixels) break;
+		total += sum_pixels(values + first_pixel, min(ChainSet::tile_pixels, nbr_pixels - first_pixel));
+	}
+	return total;
+}
+
+/** The pairwise tree of evaluate() over the blocks <em>first</em> to <em>first + size - 1</em>, of which only the blocks before <em>nbr_blocks</em> exist. <em>size</em> is a power of two. */
+double block_tree(const double* values, int nbr_pixels, int nbr_blocks, int first, int size) {
+	if(size == 1) return block_sum(values, nbr_pixels, first);
+	int half = size/2;
+	if(first + half >= nbr_blocks) return block_tree(values, nbr_pixels, nbr_blocks, first, half);
+	return block_tree(values, nbr_pixels, nbr_blocks, first, half) + block_tree(values, nbr_pixels, nbr_blocks, first + half, half);
+}
+
+}
+
+/** The sum of the values of all pixels, added in the same order as the deterministic totals of evaluate().
+A chain evaluated pixel by pixel elsewhere, e.g. in RandomChains::Sweep(), thus gets bitwise the same total as from evaluate(). Nothing is allocated.
+*/
+double ChainSet::deterministic_sum(const double* values, int nbr_pixels) {
+	const int nbr_blocks = blocks(nbr_pixels);
+	if(nbr_blocks == 0) return 0;
+	int size = 1;
+	while(size < nbr_blocks) size *= 2;
+	return block_tree(values, nbr_pixels, nbr_blocks, 0, size);
+}
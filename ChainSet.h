@@ -0,0 +1,59 @@
+/** @file ChainSet.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Structure-of-arrays set of decay chains which are evaluated together over tiles of pixels
+*/
+#ifndef CHAINSET_H
+#define CHAINSET_H
+
+#include <vector>
+#include "SpectrumMatrix.h"
+#include "ThreadPool.h"
+
+/** A set of decay chains stored as a structure of arrays.
+Every decay is described by the row of its rate vector in a rate matrix (see RandomChains::calculate_rates()) and by its time span. The decays of chain <em>j</em> are the decays <tt>first_decay[j]</tt> to <tt>first_decay[j+1]-1</tt>.
+
+evaluate() computes the expected number of random chains of all chains in one pass over the pixels, optionally split over the threads of a ThreadPool. The pixels are processed in tiles small enough that the rate vectors of a tile stay in the cache while every chain of the set is evaluated on it. Chains with many decays in common thus read the rates from memory once per tile, instead of once per chain.
+
+The totals are by default bitwise reproducible: the pixels are summed in fixed blocks of tiles_per_task tiles, which are reduced in a fixed tree, so the result does not depend on the number of threads or on the instruction set.
+*/
+class ChainSet {
+	private:
+		std::vector<int> first_decay;
+		std::vector<int> decay_rate_row;
+		std::vector<double> decay_time_span;
+
+		void add_tile(const PixelMatrix<double>& rate, const long long* implants, int first_pixel, int tile, double* row_totals) const;
+
+	public:
+		//Number of pixels evaluated at a time, the per-tile buffer is kept on the stack
+		static const int tile_pixels = 256;
+
+		ChainSet() : first_decay(1, 0) {}
+
+		void clear();
+		void reserve(int nbr_chains, int nbr_decays);
+		void add_chain(const int* rate_rows, const double* time_spans, int length);
+		void assign(const std::vector<int>& lengths, const std::vector<int>& rate_rows, const std::vector<double>& time_spans);
+
+		int chains() const { return (int)first_decay.size() - 1; }
+		int decays() const { return (int)decay_rate_row.size(); }
+		int length(int chain) const { return first_decay[chain+1] - first_decay[chain]; }
+		int first(int chain) const { return first_decay[chain]; }
+		int rate_row(int decay) const { return decay_rate_row[decay]; }
+		double time_span(int decay) const { return decay_time_span[decay]; }
+
+		//Number of tiles per task of a ThreadPool
+		static const int tiles_per_task = 16;
+
+		void evaluate(const PixelMatrix<double>& rate, const std::vector<long long>& implants, double* totals, ThreadPool* pool = NULL, bool deterministic = true) const;
+		void evaluate_block(const PixelMatrix<double>& rate, const std::vector<long long>& implants, int block, double* block_totals) const;
+		void evaluate_tile(const PixelMatrix<double>& rate, const std::vector<long long>& implants, int tile, double* tile_totals) const;
+
+		static int blocks(int nbr_pixels);
+		static void reduce_rows(double* rows, int nbr_rows, int nbr_chains, double* totals);
+		static void reduce_tiles(const double* tile_totals, int nbr_tiles, int nbr_chains, double* totals);
+
+		static double deterministic_sum(const double* values, int nbr_pixels);
+};
+
+#endif
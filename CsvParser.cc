@@ -0,0 +1,85 @@
+/** @file CsvParser.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Splitting of the comma separated data files for parallel parsing
+*/
+#include "CsvParser.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+/** Returns a pointer to the character after the next separator at or after <em>p</em>, or <em>end</em> if there is none. */
+static const char* after_next_separator(const char* p, const char* end) {
+	const char* separator = static_cast<const char*>(memchr(p, ',', end - p));
+	return separator ? separator + 1 : end;
+}
+
+/** Splits the comma separated values in <tt>[begin, end)</tt> into byte ranges which can be parsed independently.
+Every range starts at a value whose index is a multiple of <em>values_per_block</em>, e.g. at a pixel boundary of a spectrum file with <em>values_per_block</em> bins per pixel, so that no pixel is split between two ranges. The file is first cut into <em>nbr_chunks</em> pieces of about the same size, the separators in every piece are counted to find the index of its first value, and each cut is then moved forward to the next block boundary. Ranges which become empty are dropped.
+
+The counting assumes a well formed file. A malformed file still gives a valid split, but the value indices of the ranges after the malformed field may be wrong, so the ranges must only be trusted if parsing all of them succeeds.
+	@param begin first character of the file
+	@param end one past the last character of the file
+	@param values_per_block the ranges start at multiples of this number of values
+	@param nbr_chunks the maximum number of ranges
+	@param chunks the ranges, in file order
+	@return the number of values in the file
+*/
+size_t split_csv_chunks(const char* begin, const char* end, size_t values_per_block, int nbr_chunks, vector<CsvChunk>& chunks) {
+	chunks.clear();
+	if(nbr_chunks < 1) nbr_chunks = 1;
+	if(values_per_block < 1) values_per_block = 1;
+	size_t length = end - begin;
+
+	//Cuts of about the same size, each moved to just after a separator
+	vector<const char*> cuts(1, begin);
+	for(int k = 1; k < nbr_chunks; k++) {
+		const char* cut = after_next_separator(begin + length*k/nbr_chunks, end);
+		if(cut > cuts.back() && cut < end) cuts.push_back(cut);
+	}
+	cuts.push_back(end);
+
+	//The index of the first value after every cut
+	vector<size_t> first_value(cuts.size(), 0);
+	for(size_t k = 1; k < cuts.size(); k++) {
+		first_value[k] = first_value[k-1] + count(cuts[k-1], cuts[k], ',');
+	}
+
+	//The last value is not followed by a separator, unless the file ends with one
+	size_t nbr_values = first_value.back();
+	const char* tail = end;
+	while(tail > cuts[cuts.size()-2] && is_csv_space(tail[-1])) tail--;
+	if(tail > begin && tail[-1] != ',') nbr_values++;
+
+	//Every cut but the first is moved forward to the next block boundary
+	for(size_t k = 1; k + 1 < cuts.size(); k++) {
+		size_t boundary = (first_value[k] + values_per_block - 1)/values_per_block*values_per_block;
+		const char* p = cuts[k];
+		for(size_t v = first_value[k]; v < boundary && p < end; v++) p = after_next_separator(p, end);
+		cuts[k] = p;
+		first_value[k] = boundary;
+	}
+
+	for(size_t k = 0; k + 1 < cuts.size(); k++) {
+		if(cuts[k] >= cuts[k+1] || first_value[k] >= nbr_values) continue;
+		CsvChunk chunk;
+		chunk.begin = cuts[k];
+		chunk.end = cuts[k+1];
+		chunk.first_value = first_value[k];
+		chunk.nbr_values = 0;
+		chunks.push_back(chunk);
+	}
+	for(size_t k = 0; k < chunks.size(); k++) {
+		size_t next = (k + 1 < chunks.size()) ? chunks[k+1].first_value : nbr_values;
+		chunks[k].nbr_values = next - chunks[k].first_value;
+	}
+
+	return nbr_values;
+}
+
+/** Returns a pointer to value number <em>nbr_values</em> of the comma separated values in <tt>[begin, end)</tt>, found by counting separators without parsing the values, or <em>end</em> if the file has fewer values. As split_csv_chunks() it assumes a well formed file. */
+const char* skip_csv_values(const char* begin, const char* end, size_t nbr_values) {
+	const char* p = begin;
+	for(size_t v = 0; v < nbr_values && p < end; v++) p = after_next_separator(p, end);
+	return p;
+}
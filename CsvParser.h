@@ -0,0 +1,196 @@
+/** @file CsvParser.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Single-pass, allocation-free parser of the comma separated data files
+*/
+#ifndef CSVPARSER_H
+#define CSVPARSER_H
+
+#include <cstddef>
+#include <vector>
+
+//Outcome of parsing a comma separated file
+enum CsvStatus {
+	CSV_OK,			//All values were parsed
+	CSV_MALFORMED_VALUE,	//A field is not an integer
+	CSV_OUT_OF_RANGE,	//A field does not fit in an int
+	CSV_EMPTY_FIELD,	//Two separators without a value in between
+	CSV_MISSING_SEPARATOR,	//Two values without a separator in between
+	CSV_TOO_MANY_VALUES	//The receiver of the values did not accept more values
+};
+
+/** The result of parse_csv(). If the parsing stopped early, <em>error_offset</em> is the byte offset of the offending field or missing separator. */
+struct CsvParseResult {
+	CsvStatus status;
+	size_t nbr_values;
+	size_t error_offset;
+};
+
+inline bool is_csv_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+inline bool is_csv_digit(char c) {
+	return (unsigned char)(c - '0') < 10;
+}
+
+/** Parses one integer starting at <em>first</em>, in the same way as <tt>std::from_chars</tt>.
+An optional sign is accepted, as by <tt>stoi</tt>.
+	@param first the first character of the value
+	@param last one past the last character of the input
+	@param value the parsed value
+	@param status CSV_MALFORMED_VALUE if there are no digits, CSV_OUT_OF_RANGE if the value does not fit in an int
+	@return pointer to the first character after the value
+*/
+inline const char* parse_csv_int(const char* first, const char* last, int& value, CsvStatus& status) {
+	const char* p = first;
+	bool negative = false;
+	if(p < last && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+
+	const char* digits = p;
+	const unsigned long long limit = negative ? 2147483648ULL : 2147483647ULL;
+	unsigned long long acc = 0;
+	bool overflow = false;
+	for(; p < last && is_csv_digit(*p); p++) {
+		acc = acc*10 + (*p - '0');
+		if(acc > limit) {
+			overflow = true;
+			acc = limit;
+		}
+	}
+
+	if(p == digits) {
+		status = CSV_MALFORMED_VALUE;
+		return first;
+	}
+	if(overflow) {
+		status = CSV_OUT_OF_RANGE;
+		return first;
+	}
+	value = negative ? (int)(-(long long)acc) : (int)acc;
+	status = CSV_OK;
+	return p;
+}
+
+/** Parses the comma separated integers in <tt>[begin, end)</tt> and hands them to <em>sink</em> in order.
+White space around a value is ignored and a trailing separator at the end of the input is accepted. Nothing is allocated, the input is read once from the beginning to the end.
+	@param begin first character of the input, e.g. of a MappedFile
+	@param end one past the last character of the input
+	@param sink callable as <tt>bool sink(int value)</tt>, returning false if it does not accept more values
+	@return the status, the number of values accepted by <em>sink</em> and the location of a malformed field
+*/
+template <typename Sink>
+CsvParseResult parse_csv(const char* begin, const char* end, Sink& sink) {
+	CsvParseResult result = {CSV_OK, 0, 0};
+	const char* p = begin;
+
+	while(true) {
+		const char* field = p;
+		int value = 0;
+
+		//The common case in the spectra: an unsigned value of one to three digits directly followed by a separator.
+		//Away from the end of the input no bounds checks are needed for it.
+		bool fast = false;
+		if(end - p > 4 && is_csv_digit(p[0])) {
+			int d0 = p[0] - '0';
+			if(p[1] == ',') {
+				value = d0;
+				p += 1;
+				fast = true;
+			}
+			else if(is_csv_digit(p[1])) {
+				int d1 = p[1] - '0';
+				if(p[2] == ',') {
+					value = d0*10 + d1;
+					p += 2;
+					fast = true;
+				}
+				else if(is_csv_digit(p[2]) && p[3] == ',') {
+					value = d0*100 + d1*10 + (p[2] - '0');
+					p += 3;
+					fast = true;
+				}
+			}
+		}
+
+		if(!fast) {
+			while(p < end && is_csv_space(*p)) p++;
+			if(p == end) return result;
+			if(*p == ',') {
+				result.status = CSV_EMPTY_FIELD;
+				result.error_offset = field - begin;
+				return result;
+			}
+
+			CsvStatus status;
+			p = parse_csv_int(p, end, value, status);
+			if(status != CSV_OK) {
+				result.status = status;
+				result.error_offset = field - begin;
+				return result;
+			}
+			while(p < end && is_csv_space(*p)) p++;
+		}
+
+		if(!sink(value)) {
+			result.status = CSV_TOO_MANY_VALUES;
+			result.error_offset = field - begin;
+			return result;
+		}
+		result.nbr_values++;
+
+		if(p == end) return result;
+		if(*p != ',') {
+			result.status = CSV_MISSING_SEPARATOR;
+			result.error_offset = p - begin;
+			return result;
+		}
+		p++;
+	}
+}
+
+/** Receiver for parse_csv() which stores the values consecutively, e.g. in a SpectrumMatrix. */
+class CsvArrayWriter {
+	private:
+		int* out;
+		size_t capacity;
+		size_t count;
+
+	public:
+		CsvArrayWriter(int* values, size_t nbr_values) : out(values), capacity(nbr_values), count(0) {}
+
+		bool operator()(int value) {
+			if(count == capacity) return false;
+			out[count++] = value;
+			return true;
+		}
+};
+
+/** A byte range of a comma separated file which can be parsed on its own, see split_csv_chunks(). */
+struct CsvChunk {
+	const char* begin;
+	const char* end;
+	size_t first_value;	//Index in the file of the first value of the chunk
+	size_t nbr_values;
+};
+
+size_t split_csv_chunks(const char* begin, const char* end, size_t values_per_block, int nbr_chunks, std::vector<CsvChunk>& chunks);
+
+const char* skip_csv_values(const char* begin, const char* end, size_t nbr_values);
+
+/** Returns a short description of <em>status</em> for the diagnostics. */
+inline const char* csv_status_message(CsvStatus status) {
+	switch(status) {
+		case CSV_OK : return "no error";
+		case CSV_MALFORMED_VALUE : return "the value is not an integer";
+		case CSV_OUT_OF_RANGE : return "the value is out of range";
+		case CSV_EMPTY_FIELD : return "the field is empty";
+		case CSV_MISSING_SEPARATOR : return "a separator ',' is missing";
+		case CSV_TOO_MANY_VALUES : return "there are more values than expected";
+	}
+	return "";
+}
+
+#endif
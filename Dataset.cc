@@ -0,0 +1,359 @@
+/** @file Dataset.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Implementation of the datasets and queries declared in Dataset.h
+*/
+#include "Dataset.h"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <cctype>
+
+using namespace std;
+
+const int Dataset::pixels_per_task;
+
+namespace {
+
+//Calls body(first, last, slot) for all pixels, split over the threads of the pool if there is one
+template <typename Body>
+void for_pixels(ThreadPool* pool, int nbr_pixels, const Body& body) {
+	if(pool) pool->parallel_for(0, nbr_pixels, Dataset::pixels_per_task, body);
+	else body(0, nbr_pixels, 0);
+}
+
+}
+
+/** An empty query, without chains and with all bin limits and the duration of the experiment 0. */
+ChainQuery::ChainQuery() : experiment_time(0), lower_limit_alphas(0), upper_limit_alphas(0), lower_limit_escapes(0), upper_limit_escapes(0), lower_limit_implants(0), upper_limit_implants(0) {
+}
+
+/** Reads the chains from a chains file.
+The first five lines are the header: the duration of the experiment follows the first space of the second line, and the fourth line holds the bin limits of the alphas, escapes and implants. Every chain then starts with a line <tt>#length</tt>, followed by one line <tt>type beam time_span</tt> per decay. The chains read in are added to the chains of the query, the header replaces the duration and the bin limits. No input is ever asked for.
+	@param file_name the chains file
+	@param log every line read in is written here, and the errors
+	@return false if the file could not be opened or has a malformed line
+*/
+bool ChainQuery::read(const string& file_name, ostream& log) {
+	ifstream file_stream(file_name, ios::in);
+	if(!file_stream) {
+		log << "Could not find file" << endl;
+		return false;
+	}
+	return read(file_stream, log);
+}
+
+namespace {
+
+/** Parses an integer which fills <em>field</em> up to trailing white space, as with <tt>strtol</tt>.
+	@return false if the field is not an integer or does not fit in an int
+*/
+bool parse_int_field(const string& field, int& value) {
+	const char* begin = field.c_str();
+	char* end;
+	errno = 0;
+	long parsed = strtol(begin, &end, 10);
+	if(end == begin || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX) return false;
+	while(*end != '\0' && isspace((unsigned char)*end)) end++;
+	if(*end != '\0') return false;
+	value = parsed;
+	return true;
+}
+
+/** Parses a number which fills <em>field</em> up to trailing white space, as with <tt>strtod</tt>.
+	@return false if the field is not a number
+*/
+bool parse_double_field(const string& field, double& value) {
+	const char* begin = field.c_str();
+	char* end;
+	value = strtod(begin, &end);
+	if(end == begin) return false;
+	while(*end != '\0' && isspace((unsigned char)*end)) end++;
+	return *end == '\0';
+}
+
+}
+
+/** Reads the chains from a stream in the format of a chains file, see read(const string&, ostream&).
+Reading stops at the first malformed line, whose number and problem are written to <em>log</em> as its last line. The chains read in before it are kept, but such a query is not meant to be evaluated.
+	@param input the chains, read to its end
+	@param log every line read in is written here, and the problem of a malformed line
+	@return false if a line is malformed
+*/
+bool ChainQuery::read(istream& input, ostream& log) {
+	string str;
+	int counter = 0;
+	int line = 0;
+	while(getline(input, str)) {
+		line++;
+		log << str << endl;
+		if(counter < 5) {
+			if(counter == 1) {
+				if(str.find_first_of(" ") != string::npos) {
+					if(!parse_double_field(str.substr(str.find_first_of(" ")), experiment_time)) {
+						log << "Line " << line << ": the duration of the experiment is not a number" << endl;
+						return false;
+					}
+				}
+			}
+			if(counter == 3) {
+				istringstream ss(str);
+				ss >> lower_limit_alphas >> upper_limit_alphas >> lower_limit_escapes >> upper_limit_escapes >> lower_limit_implants >> upper_limit_implants;
+				if(!ss) {
+					log << "Line " << line << ": six bin limits are expected" << endl;
+					return false;
+				}
+			}
+			counter++;
+			continue;
+		}
+		if(str.find_first_not_of(" \t\r") == string::npos) continue;
+
+		if(str[0] == '#') {
+			int length;
+			if(!parse_int_field(str.substr(1), length)) {
+				log << "Line " << line << ": the length of the chain is not an integer" << endl;
+				return false;
+			}
+			chain_length.push_back(length);
+		}
+		else {
+			istringstream ss(str);
+			char type;
+			string beam_field, time_field, rest;
+			int beam;
+			double time;
+			if(!(ss >> type >> beam_field >> time_field) || (ss >> rest) || !parse_int_field(beam_field, beam) || !parse_double_field(time_field, time)) {
+				log << "Line " << line << ": a decay is given as 'type beam time_span'" << endl;
+				return false;
+			}
+			decay_type.push_back(type);
+			beam_status.push_back(beam);
+			time_span.push_back(time);
+		}
+	}
+	return true;
+}
+
+/** Checks that the query can be evaluated: the chain lengths add up to the number of decays, every decay type is 'a', 'e' or 'f' and the duration of the experiment is positive.
+	@param log the first problem found is written here
+	@return true if the query is consistent
+*/
+bool ChainQuery::check(ostream& log) const {
+	if(decay_type.size() != beam_status.size() || decay_type.size() != time_span.size()) {
+		log << "The decay types, beam statuses and time spans differ in number" << endl;
+		return false;
+	}
+	size_t nbr_decays = 0;
+	for(unsigned int j = 0; j < chain_length.size(); j++) {
+		if(chain_length[j] < 0) {
+			log << "Chain " << j+1 << " has a negative length" << endl;
+			return false;
+		}
+		nbr_decays += chain_length[j];
+	}
+	if(nbr_decays != decay_type.size()) {
+		log << "The chains have " << nbr_decays << " decays, but " << decay_type.size() << " decays are given" << endl;
+		return false;
+	}
+	for(unsigned int i = 0; i < decay_type.size(); i++) {
+		if(decay_type[i] != 'a' && decay_type[i] != 'e' && decay_type[i] != 'f') {
+			log << "Please input correct decay types, i.e. 'a', 'e' or 'f' " << endl;
+			return false;
+		}
+	}
+	if(!(experiment_time > 0)) {
+		log << "The duration of the experiment must be positive" << endl;
+		return false;
+	}
+	return true;
+}
+
+/** The key of the rate vector of a decay.
+Based on the decay type the bin limits are set. The rate of fissions is taken from the fission data and does not depend on the beam status or on a bin window, so all fissions have the same key.
+		@param type decay type, i.e. 'a', 'e' or 'f'.
+		@param beam beam status, i.e. 1 or 0.
+		@return the key of the rate vector
+*/
+RateKey ChainQuery::rate_key(char type, int beam) const {
+	RateKey key = {type, beam, 0, 0};
+	if(type == 'a') {
+		key.lower_limit = lower_limit_alphas;
+		key.upper_limit = upper_limit_alphas;
+	}
+	else if(type == 'e') {
+		key.lower_limit = lower_limit_escapes;
+		key.upper_limit = upper_limit_escapes;
+	}
+	else if(type == 'f') {
+		key.beam = 0;
+	}
+	return key;
+}
+
+/** The distinct rate vectors of the decays.
+Decays with the same decay type, beam status and bin window (see RateKey) share one rate vector, the key of which is stored the first time it is met.
+	@param keys the distinct keys, in the order they are first met
+	@param rows the index in <em>keys</em> of every decay
+	@return the hits and misses, the memory is left 0
+*/
+RateCacheStatistics ChainQuery::rate_rows(vector<RateKey>& keys, vector<int>& rows) const {
+	RateCacheStatistics statistics = {0, 0, 0};
+	keys.clear();
+	rows.resize(decay_type.size());
+
+	for(unsigned int i = 0; i < decay_type.size(); i++) {
+		RateKey key = rate_key(decay_type.at(i), beam_status.at(i));
+		unsigned int k = 0;
+		while(k < keys.size() && !(keys[k] == key)) k++;
+		if(k == keys.size()) {
+			keys.push_back(key);
+			statistics.misses++;
+		}
+		else statistics.hits++;
+		rows[i] = k;
+	}
+	return statistics;
+}
+
+/** Makes a dataset from the indices of the spectra and the fissions.
+	@param pixels number of pixels in the spectrum data
+	@param bins total number of bins in every spectrum
+	@param implants the index of the spectrum of the implants, the pure beam ON spectrum or else the reconstructed one
+	@param beam_on the index of the reconstructed beam ON spectrum
+	@param beam_off the index of the reconstructed beam OFF spectrum
+	@param fissions the number of fissions of every pixel, copied
+*/
+Dataset::Dataset(int pixels, int bins, shared_ptr<const SpectrumIndex> implants, shared_ptr<const SpectrumIndex> beam_on, shared_ptr<const SpectrumIndex> beam_off, const vector<double>& fissions) : nbr_pixels(pixels), nbr_bins(bins), index_implants(implants), index_beam_on(beam_on), index_beam_off(beam_off), fissions_pixels(fissions) {
+}
+
+/** The number of implants in every pixel, taken from the index of the implant spectrum, i.e. one subtraction per pixel.
+	@param lower_limit the lower bin limit of the implants
+	@param upper_limit the upper bin limit of the implants
+	@param nbr_implants the number of implants of every pixel is written here
+	@param pool the threads to use, NULL to calculate in the calling thread
+*/
+void Dataset::implants(int lower_limit, int upper_limit, long long* nbr_implants, ThreadPool* pool) const {
+
+	//The spectrum is only read, it is never copied
+	const SpectrumIndex& data = *index_implants;
+
+	for_pixels(pool, nbr_pixels, [&data, lower_limit, upper_limit, nbr_implants](int first, int last, int) {
+		for(int i = first; i < last; i++) {
+			nbr_implants[i] = data.window_sum(i, lower_limit, upper_limit);
+		}
+	});
+}
+
+/** The rates in every pixel for a decay type, beam status and bin window.
+The counts in the bin window are taken from the index of the spectrum, so the cost does not depend on the width of the window and no memory is allocated.
+		@param key decay type, beam status and bin window, see ChainQuery::rate_key().
+		@param experiment_time the duration of the experiment in s
+		@param rate the rate of every pixel is stored here
+		@param pool the threads to use, NULL to calculate in the calling thread
+*/
+void Dataset::rates(const RateKey& key, double experiment_time, PixelRow<double> rate, ThreadPool* pool) const {
+
+	if(key.type == 'f') {
+		for(int i = 0; i < nbr_pixels; i++) {
+			rate[i] = (double)fissions_pixels[i]/experiment_time;
+		}
+		return;
+	}
+	else if(key.type != 'a' && key.type != 'e') {
+		cout << "Please input correct decay types, i.e. 'a', 'e' or 'f' " << endl;
+		return;
+	}
+
+	//Based on the beam status the spectrum is determined
+	const SpectrumIndex& data = key.beam ? *index_beam_on : *index_beam_off;
+
+	//The rate for every pixel is calculated
+	for_pixels(pool, nbr_pixels, [&data, &key, experiment_time, rate](int first, int last, int) {
+		for(int i = first; i < last; i++) {
+			long long acc_counts = data.window_sum(i, key.lower_limit, key.upper_limit);
+			rate[i] = (double) acc_counts/experiment_time;
+		}
+	});
+}
+
+/** The counts in every pixel in the bin window of a decay type and beam status, from which rates() divides the rates. Fissions have no window, their counts are left as they are.
+		@param key decay type, beam status and bin window, see ChainQuery::rate_key().
+		@param nbr_counts the counts of every pixel are written here
+		@param pool the threads to use, NULL to calculate in the calling thread
+*/
+void Dataset::counts(const RateKey& key, long long* nbr_counts, ThreadPool* pool) const {
+	if(key.type != 'a' && key.type != 'e') return;
+
+	const SpectrumIndex& data = key.beam ? *index_beam_on : *index_beam_off;
+	for_pixels(pool, nbr_pixels, [&data, &key, nbr_counts](int first, int last, int) {
+		for(int i = first; i < last; i++) {
+			nbr_counts[i] = data.window_sum(i, key.lower_limit, key.upper_limit);
+		}
+	});
+}
+
+/** The expected number of random chains of every chain of a query.
+The same calculation as RandomChains::Run(): the implants, the distinct rate vectors and then all chains together in one pass over the pixels, see ChainSet::evaluate(). All intermediate results are local to the call, so queries can be evaluated concurrently, see Dataset. With the deterministic reduction the result is bitwise the same as that of Run() with the same chains.
+	@param query the chains, bin limits and duration of the experiment
+	@param pool the threads to use, NULL to evaluate in the calling thread
+	@param deterministic true for results which do not depend on the number of threads
+	@return the expected number of random chains of every chain, empty if the query fails ChainQuery::check()
+*/
+vector<double> Dataset::Evaluate(const ChainQuery& query, ThreadPool* pool, bool deterministic) const {
+	ostringstream problems;
+	if(!query.check(problems)) return vector<double>();
+
+	vector<long long> nbr_implants(nbr_pixels);
+	implants(query.lower_limit_implants, query.upper_limit_implants, nbr_implants.data(), pool);
+
+	vector<RateKey> keys;
+	vector<int> rows;
+	query.rate_rows(keys, rows);
+	PixelMatrix<double> rate(keys.size(), nbr_pixels);
+	for(unsigned int k = 0; k < keys.size(); k++) {
+		rates(keys[k], query.experiment_time, rate.row(k), pool);
+	}
+
+	ChainSet chain_set;
+	chain_set.assign(query.chain_length, rows, query.time_span);
+
+	vector<double> expected(chain_set.chains());
+	chain_set.evaluate(rate, nbr_implants, expected.data(), pool, deterministic);
+	return expected;
+}
+
+/** The sums of every chain of a query in every tile of pixels, see ChainSet::evaluate_tile(). ChainSet::reduce_tiles() reduces them to bitwise the result of Evaluate() in the deterministic mode, also when the tiles of different datasets are joined, e.g. those of the shards of one detector, see run_shard().
+	@param query the chains, bin limits and duration of the experiment
+	@param pool the threads to use, NULL to evaluate in the calling thread
+	@return the sums, tiles x chains, empty if the query fails ChainQuery::check()
+*/
+vector<double> Dataset::EvaluateTiles(const ChainQuery& query, ThreadPool* pool) const {
+	ostringstream problems;
+	if(!query.check(problems)) return vector<double>();
+
+	vector<long long> nbr_implants(nbr_pixels);
+	implants(query.lower_limit_implants, query.upper_limit_implants, nbr_implants.data(), pool);
+
+	vector<RateKey> keys;
+	vector<int> rows;
+	query.rate_rows(keys, rows);
+	PixelMatrix<double> rate(keys.size(), nbr_pixels);
+	for(unsigned int k = 0; k < keys.size(); k++) {
+		rates(keys[k], query.experiment_time, rate.row(k), pool);
+	}
+
+	ChainSet chain_set;
+	chain_set.assign(query.chain_length, rows, query.time_span);
+
+	const int nbr_chains = chain_set.chains();
+	const int nbr_tiles = (nbr_pixels + ChainSet::tile_pixels - 1)/ChainSet::tile_pixels;
+	vector<double> tile_totals((size_t)nbr_tiles*nbr_chains);
+	auto evaluate = [&](int first, int last, int) {
+		for(int t = first; t < last; t++) chain_set.evaluate_tile(rate, nbr_implants, t, &tile_totals[(size_t)t*nbr_chains]);
+	};
+	if(pool) pool->parallel_for(0, nbr_tiles, ChainSet::tiles_per_task, evaluate);
+	else evaluate(0, nbr_tiles, 0);
+	return tile_totals;
+}
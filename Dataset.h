@@ -0,0 +1,101 @@
+/** @file Dataset.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Immutable experimental data and the queries of decay chains evaluated on it
+*/
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include "SpectrumMatrix.h"
+#include "SpectrumIndex.h"
+#include "ChainSet.h"
+#include "ThreadPool.h"
+
+/** The key of a per-pixel rate vector: the decay type, the beam status and the bin window of the spectrum.
+Decays with equal keys have equal rates in every pixel, so their rates are only calculated once, see ChainQuery::rate_rows().
+*/
+struct RateKey {
+	char type;
+	int beam;
+	int lower_limit;
+	int upper_limit;
+
+	bool operator==(const RateKey& other) const {
+		return type == other.type && beam == other.beam && lower_limit == other.lower_limit && upper_limit == other.upper_limit;
+	}
+};
+
+/** Statistics of the rate cache of the last run. Every decay is either a miss, which calculates a new rate vector, or a hit, which shares the rate vector of an earlier decay. */
+struct RateCacheStatistics {
+	int hits;
+	int misses;
+	size_t memory_bytes;
+};
+
+/** The decay chains, bin limits and duration of the experiment of one calculation.
+A query is a plain value: it holds no experimental data, is cheap to copy and can be changed freely between calculations. It is read from a chains file with read(), in the format written by RandomChains::dump_input_to_file(), or filled in directly. The decays of chain <em>j</em> follow the decays of the chains before it in decay_type, beam_status and time_span.
+*/
+struct ChainQuery {
+	//The duration of the experiment in s
+	double experiment_time;
+
+	//bin limits for the different decay types
+	int lower_limit_alphas, upper_limit_alphas;
+	int lower_limit_escapes, upper_limit_escapes;
+	int lower_limit_implants, upper_limit_implants;
+
+	//Chain/chains characteristics
+	std::vector<int> chain_length;
+	std::vector<int> beam_status;
+	std::vector<char> decay_type;
+	std::vector<double> time_span;
+
+	ChainQuery();
+
+	bool read(const std::string& file_name, std::ostream& log);
+	bool read(std::istream& input, std::ostream& log);
+	bool check(std::ostream& log) const;
+
+	RateKey rate_key(char type, int beam) const;
+	RateCacheStatistics rate_rows(std::vector<RateKey>& keys, std::vector<int>& rows) const;
+};
+
+/** The experimental data needed to evaluate queries: the spectrum indices and the fissions of every pixel.
+A Dataset is immutable once it is made. All its methods are const and only write to their arguments, so any number of queries, also concurrent ones, can be evaluated on one dataset without reading in the data again. The indices are shared and not copied, so a dataset is cheap to make from the data of a RandomChains object, see RandomChains::GetDataset().
+
+Queries evaluated concurrently must each use their own ThreadPool, or none, since a pool can only be used by one thread outside of it at a time. A dataset made in the streaming mode only holds the windows of the chains it was read in for, so only queries with these bin limits can be evaluated on it.
+*/
+class Dataset {
+	private:
+		const int nbr_pixels;
+		const int nbr_bins;
+
+		//The spectrum of the implants and the spectra of the decays with beam ON and OFF
+		std::shared_ptr<const SpectrumIndex> index_implants;
+		std::shared_ptr<const SpectrumIndex> index_beam_on;
+		std::shared_ptr<const SpectrumIndex> index_beam_off;
+
+		//Number of fissions of every pixel
+		std::vector<double> fissions_pixels;
+
+	public:
+		//Number of pixels per task of a ThreadPool in the loops over the pixels
+		static const int pixels_per_task = 4096;
+
+		Dataset(int pixels, int bins, std::shared_ptr<const SpectrumIndex> implants, std::shared_ptr<const SpectrumIndex> beam_on, std::shared_ptr<const SpectrumIndex> beam_off, const std::vector<double>& fissions);
+
+		int pixels() const { return nbr_pixels; }
+		int bins() const { return nbr_bins; }
+
+		void implants(int lower_limit, int upper_limit, long long* nbr_implants, ThreadPool* pool = NULL) const;
+		void rates(const RateKey& key, double experiment_time, PixelRow<double> rate, ThreadPool* pool = NULL) const;
+		void counts(const RateKey& key, long long* nbr_counts, ThreadPool* pool = NULL) const;
+
+		std::vector<double> Evaluate(const ChainQuery& query, ThreadPool* pool = NULL, bool deterministic = true) const;
+		std::vector<double> EvaluateTiles(const ChainQuery& query, ThreadPool* pool = NULL) const;
+};
+
+#endif
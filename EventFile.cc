@@ -0,0 +1,206 @@
+/** @file EventFile.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Writing and histogramming of the list-mode event files declared in EventFile.h
+*/
+#include "EventFile.h"
+#include "MappedFile.h"
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+const char* const event_file_name = "events.rcev";
+
+namespace {
+
+const char event_magic[8] = {'R','C','E','V','E','N','T','\0'};
+
+//About 16 MB of events per task
+const size_t events_per_chunk = 1 << 20;
+
+//The spectrum of the flags EVENT_BEAM_ON and EVENT_RECONSTRUCTED, in the order of EventHistograms, or -1 if none
+const int spectrum_of_flags[4] = {-1, 0, 2, 1};
+
+/** The histograms of the events read by one slot of the pool. */
+struct SlotHistograms {
+	bool used;
+	SpectrumMatrix spectra[3];
+	vector<long long> fissions;
+	uint64_t nbr_histogrammed;
+	uint64_t nbr_outside;
+	uint64_t first_timestamp;
+	uint64_t last_timestamp;
+
+	SlotHistograms() : used(false), nbr_histogrammed(0), nbr_outside(0), first_timestamp(UINT64_MAX), last_timestamp(0) {}
+
+	void start(int pixels, int bins) {
+		for(int s = 0; s < 3; s++) spectra[s].resize(pixels, bins);
+		fissions.assign(pixels, 0);
+		used = true;
+	}
+};
+
+}
+
+EventFileWriter::~EventFileWriter() {
+	if(out) {
+		fclose(out);
+		remove(temporary_path.c_str());
+	}
+}
+
+/** Starts the event file <em>event_path</em>, whose events are then given with write().
+	@return false if the file could not be created
+*/
+bool EventFileWriter::open(const string& event_path) {
+	path = event_path;
+	temporary_path = path + ".tmp";
+	nbr_events = 0;
+	out = fopen(temporary_path.c_str(), "wb");
+	if(!out) return false;
+
+	//The header is written by close(), when the number of events is known
+	char padding[EventFileHeader::data_offset];
+	memset(padding, 0, sizeof(padding));
+	ok = fwrite(padding, 1, sizeof(padding), out) == sizeof(padding);
+	return ok;
+}
+
+/** Writes the next <em>count</em> events. */
+bool EventFileWriter::write(const ListModeEvent* events, size_t count) {
+	ok = ok && fwrite(events, sizeof(ListModeEvent), count, out) == count;
+	nbr_events += count;
+	return ok;
+}
+
+/** Writes the header and moves the file to its name.
+	@return false if a write failed, the file is then removed
+*/
+bool EventFileWriter::close() {
+	if(!out) return false;
+
+	EventFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, event_magic, sizeof(event_magic));
+	header.version = EventFileHeader::current_version;
+	header.byte_order = 0x01020304;
+	header.event_size = sizeof(ListModeEvent);
+	header.nbr_events = nbr_events;
+
+	ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+	ok = (fclose(out) == 0) && ok;
+	out = NULL;
+
+	if(!ok || rename(temporary_path.c_str(), path.c_str()) != 0) {
+		remove(temporary_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** Histograms the events of the list-mode file <em>event_path</em> into the three spectra and the fissions per pixel, see EventHistograms.
+The file is memory mapped and split into chunks of events, which are histogrammed by the threads of <em>pool</em>. Every slot of the pool fills its own private spectra, so no counts are shared between threads, and the spectra of the slots are added pixel by pixel at the end. The events themselves are never copied: the pages of the file are read in by the kernel as the chunks are reached and can be dropped again afterwards, so files of 10^9 events and more need only the memory of the spectra, once per slot which took part.
+	@param event_path the event file
+	@param pixels number of pixels of the detector
+	@param bins number of bins per spectrum
+	@param pool the threads which histogram the events
+	@param histograms the spectra and fissions, only modified if the file could be read
+	@param log the messages about the file are written here
+	@return false if the file could not be opened or is not an event file of this version
+*/
+bool histogram_event_file(const string& event_path, int pixels, int bins, ThreadPool& pool, EventHistograms& histograms, ostream& log) {
+	MappedFile file;
+	if(!file.open(event_path, MAPPED_SEQUENTIAL)) {
+		log << "The event file " << event_path << " could not be opened" << endl;
+		return false;
+	}
+
+	EventFileHeader header;
+	if(file.size() < EventFileHeader::data_offset) {
+		log << "The event file " << event_path << " has no header" << endl;
+		return false;
+	}
+	memcpy(&header, file.begin(), sizeof(header));
+	if(memcmp(header.magic, event_magic, sizeof(event_magic)) != 0 || header.version != EventFileHeader::current_version) {
+		log << "The file " << event_path << " is not an event file of this version" << endl;
+		return false;
+	}
+	if(header.byte_order != 0x01020304 || header.event_size != sizeof(ListModeEvent)) {
+		log << "The event file " << event_path << " was written on a machine with another byte order or event layout" << endl;
+		return false;
+	}
+
+	uint64_t nbr_events = (file.size() - EventFileHeader::data_offset)/sizeof(ListModeEvent);
+	if(header.nbr_events < nbr_events) nbr_events = header.nbr_events;
+	else if(header.nbr_events > nbr_events) {
+		log << "The event file " << event_path << " is truncated, only " << nbr_events << " of " << header.nbr_events << " events are read" << endl;
+	}
+	const ListModeEvent* events = reinterpret_cast<const ListModeEvent*>(file.begin() + EventFileHeader::data_offset);
+
+	vector<SlotHistograms> slots(pool.size());
+	int nbr_chunks = (nbr_events + events_per_chunk - 1)/events_per_chunk;
+	pool.parallel_for(0, nbr_chunks, 1, [&](int first, int last, int slot) {
+		SlotHistograms& own = slots[slot];
+		if(!own.used) own.start(pixels, bins);
+		uint64_t end = min((uint64_t)last*events_per_chunk, nbr_events);
+		for(uint64_t e = (uint64_t)first*events_per_chunk; e < end; e++) {
+			const ListModeEvent& event = events[e];
+			if(event.pixel >= (uint32_t)pixels || event.channel >= bins) {
+				own.nbr_outside++;
+				continue;
+			}
+			own.first_timestamp = min(own.first_timestamp, event.timestamp);
+			own.last_timestamp = max(own.last_timestamp, event.timestamp);
+			if(event.flags & EVENT_FISSION) {
+				own.fissions[event.pixel]++;
+				continue;
+			}
+			int spectrum = spectrum_of_flags[event.flags & (EVENT_BEAM_ON | EVENT_RECONSTRUCTED)];
+			if(spectrum < 0) continue;
+			own.spectra[spectrum].data()[(size_t)event.pixel*bins + event.channel]++;
+			own.nbr_histogrammed++;
+		}
+	});
+
+	//The spectra of the first slot which took part are kept, and those of the others are added to them
+	vector<SlotHistograms*> used;
+	for(unsigned int s = 0; s < slots.size(); s++) {
+		if(slots[s].used) used.push_back(&slots[s]);
+	}
+	if(used.empty()) {
+		slots[0].start(pixels, bins);
+		used.push_back(&slots[0]);
+	}
+	SlotHistograms& total = *used[0];
+	pool.parallel_for(0, pixels, 64, [&](int first, int last, int) {
+		for(unsigned int u = 1; u < used.size(); u++) {
+			for(int s = 0; s < 3; s++) {
+				size_t begin = (size_t)first*bins, end = (size_t)last*bins;
+				int* sum = total.spectra[s].data();
+				const int* add = used[u]->spectra[s].data();
+				for(size_t k = begin; k < end; k++) sum[k] += add[k];
+			}
+		}
+	});
+	for(unsigned int u = 1; u < used.size(); u++) {
+		for(int i = 0; i < pixels; i++) total.fissions[i] += used[u]->fissions[i];
+		total.nbr_histogrammed += used[u]->nbr_histogrammed;
+		total.nbr_outside += used[u]->nbr_outside;
+		total.first_timestamp = min(total.first_timestamp, used[u]->first_timestamp);
+		total.last_timestamp = max(total.last_timestamp, used[u]->last_timestamp);
+	}
+
+	histograms.beam_on = move(total.spectra[0]);
+	histograms.reconstructed_beam_on = move(total.spectra[1]);
+	histograms.reconstructed_beam_off = move(total.spectra[2]);
+	histograms.fissions = move(total.fissions);
+	histograms.nbr_events = nbr_events;
+	histograms.nbr_histogrammed = total.nbr_histogrammed;
+	histograms.nbr_outside = total.nbr_outside;
+	histograms.first_timestamp = total.first_timestamp <= total.last_timestamp ? total.first_timestamp : 0;
+	histograms.last_timestamp = total.last_timestamp;
+
+	log << "Histogrammed " << histograms.nbr_histogrammed << " of " << nbr_events << " events with " << used.size() << " threads" << endl;
+	if(histograms.nbr_outside > 0) log << "OBS: " << histograms.nbr_outside << " events were outside the detector and were skipped" << endl;
+	return true;
+}
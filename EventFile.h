@@ -0,0 +1,98 @@
+/** @file EventFile.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief List-mode event files of the data acquisition, histogrammed into the spectra in one pass
+*/
+#ifndef EVENTFILE_H
+#define EVENTFILE_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdio>
+#include <stdint.h>
+#include "SpectrumMatrix.h"
+#include "ThreadPool.h"
+
+//The flags of a list-mode event
+enum EventFlags {
+	EVENT_BEAM_ON = 1,		//The event was recorded while the beam was on
+	EVENT_RECONSTRUCTED = 2,	//The energy of the event was reconstructed
+	EVENT_FISSION = 4		//The event is a fission, it only counts for pixels_with_fissions
+};
+
+/** One event of a list-mode file, 16 bytes. */
+struct ListModeEvent {
+	uint64_t timestamp;
+	uint32_t pixel;
+	uint16_t channel;		//The energy channel, i.e. the bin of the spectra
+	uint8_t flags;			//EventFlags
+	uint8_t reserved;
+};
+
+/** Header of a list-mode event file.
+The header is followed by padding up to EventFileHeader::data_offset and then by the events, in the order they were recorded.
+*/
+struct EventFileHeader {
+	char magic[8];			//"RCEVENT" followed by a zero byte
+	uint32_t version;		//EventFileHeader::current_version
+	uint32_t byte_order;		//0x01020304 written in the byte order of the machine
+	uint32_t event_size;		//sizeof(ListModeEvent)
+	uint32_t reserved;
+	uint64_t nbr_events;
+
+	static const uint32_t current_version = 1;
+	//The events start on a page boundary
+	static const size_t data_offset = 4096;
+};
+
+//The name of the list-mode file in a data folder, which is read in instead of the ".csv" files if it exists
+extern const char* const event_file_name;
+
+/** Writes a list-mode event file piece by piece.
+The events are written under a temporary name, and close() writes the header and renames the file. A file which is not closed is removed by the destructor.
+*/
+class EventFileWriter {
+	private:
+		FILE* out;
+		std::string path;
+		std::string temporary_path;
+		uint64_t nbr_events;
+		bool ok;
+
+		EventFileWriter(const EventFileWriter&);
+		EventFileWriter& operator=(const EventFileWriter&);
+
+	public:
+		EventFileWriter() : out(NULL), nbr_events(0), ok(false) {}
+		~EventFileWriter();
+
+		bool open(const std::string& event_path);
+		bool write(const ListModeEvent* events, size_t count);
+		bool close();
+};
+
+/** The spectra and fissions histogrammed from a list-mode file.
+The events are sorted into the spectra by their flags:
+	- beam ON, not reconstructed: RandomChains::data_beam_on
+	- beam ON, reconstructed: RandomChains::data_reconstructed_beam_on
+	- beam OFF, reconstructed: RandomChains::data_reconstructed_beam_off
+	- fission: the fissions of the pixel, whatever the other flags
+
+Events of beam OFF which were not reconstructed have no spectrum and are skipped, as are events outside the detector.
+*/
+struct EventHistograms {
+	SpectrumMatrix beam_on;
+	SpectrumMatrix reconstructed_beam_on;
+	SpectrumMatrix reconstructed_beam_off;
+	std::vector<long long> fissions;
+
+	uint64_t nbr_events;
+	uint64_t nbr_histogrammed;
+	uint64_t nbr_outside;		//Pixel or channel outside the detector
+	uint64_t first_timestamp;
+	uint64_t last_timestamp;
+};
+
+bool histogram_event_file(const std::string& event_path, int pixels, int bins, ThreadPool& pool, EventHistograms& histograms, std::ostream& log);
+
+#endif
@@ -0,0 +1,151 @@
+/** @file Instrumentation.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Implementation of the phase measurements declared in Instrumentation.h
+*/
+#include "Instrumentation.h"
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <sys/resource.h>
+
+using namespace std;
+
+#ifndef RANDOMCHAINS_NO_INSTRUMENTATION
+
+//Counters of operator new, see AllocationCounter.cc. They are constant-initialised, so they can be used before any constructor has run.
+static atomic<uint64_t> nbr_allocations(0);
+static atomic<uint64_t> nbr_allocated_bytes(0);
+
+/** Counts an allocation of <em>size</em> bytes, called by the operator new of AllocationCounter.cc. */
+void count_allocation(size_t size) {
+	nbr_allocations.fetch_add(1, memory_order_relaxed);
+	nbr_allocated_bytes.fetch_add(size, memory_order_relaxed);
+}
+
+uint64_t allocation_count() {
+	return nbr_allocations.load(memory_order_relaxed);
+}
+
+uint64_t allocated_bytes() {
+	return nbr_allocated_bytes.load(memory_order_relaxed);
+}
+
+#else
+
+void count_allocation(size_t) {
+}
+
+uint64_t allocation_count() {
+	return 0;
+}
+
+uint64_t allocated_bytes() {
+	return 0;
+}
+
+#endif
+
+/** True if the allocations of the program are counted: it links in AllocationCounter.cc and is compiled with instrumentation. The C++ runtime and the constructors of the program allocate before main() runs, so the counters are not 0 by then. */
+bool allocations_counted() {
+	return allocation_count() > 0;
+}
+
+long peak_rss_kb() {
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	//ru_maxrss is given in kB on Linux
+	return usage.ru_maxrss;
+}
+
+/** The time in s since the log was made, the start of every phase is given in this time. */
+double PhaseLog::seconds() const {
+	return chrono::duration<double>(chrono::steady_clock::now() - origin).count();
+}
+
+void PhaseLog::add(const PhaseRecord& record) {
+	lock_guard<mutex> lock(records_mutex);
+	if(recording) records.push_back(record);
+}
+
+/** Turns the recording of the phases on or off. A calculation which repeats its phases many times, as RandomChains::Sweep() does, is recorded as one phase instead, so that the log does not grow with every repetition.
+	@return true if the phases were recorded before
+*/
+bool PhaseLog::set_recording(bool record) {
+	lock_guard<mutex> lock(records_mutex);
+	bool before = recording;
+	recording = record;
+	return before;
+}
+
+/** Removes all records, e.g. before the phases of a new calculation are measured. */
+void PhaseLog::clear() {
+	lock_guard<mutex> lock(records_mutex);
+	records.clear();
+}
+
+/** A copy of the records, which is safe while other phases still end. */
+vector<PhaseRecord> PhaseLog::phases() const {
+	lock_guard<mutex> lock(records_mutex);
+	return records;
+}
+
+/** Writes the records as a report, in CSV if <em>file_name</em> ends with ".csv" and otherwise in JSON. Besides the measurements every phase has the values and the evaluations per second.
+	@param file_name the report file, which is overwritten
+	@param log the errors are written here
+	@return false if the file could not be written
+*/
+bool PhaseLog::write(const string& file_name, ostream& log) const {
+	vector<PhaseRecord> report = phases();
+	ofstream out(file_name);
+	if(!out) {
+		log << "Could not write the report " << file_name << endl;
+		return false;
+	}
+	out.precision(6);
+
+	bool csv = file_name.size() >= 4 && file_name.compare(file_name.size() - 4, 4, ".csv") == 0;
+	if(csv) out << "name,start_s,seconds,bytes,values,values_per_s,evaluations,evaluations_per_s,allocations,allocated_bytes,peak_rss_kb" << endl;
+	else out << "{" << endl << "	\"phases\": [" << endl;
+
+	for(unsigned int k = 0; k < report.size(); k++) {
+		const PhaseRecord& r = report[k];
+		double values_per_second = r.seconds > 0 ? r.values/r.seconds : 0;
+		double evaluations_per_second = r.seconds > 0 ? r.evaluations/r.seconds : 0;
+		if(csv) {
+			out << r.name << "," << r.start << "," << r.seconds << "," << r.bytes << "," << r.values << "," << values_per_second << "," << r.evaluations << "," << evaluations_per_second << "," << r.allocations << "," << r.allocated_bytes << "," << r.peak_rss_kb << endl;
+		}
+		else {
+			out << "		{\"name\": \"" << r.name << "\", \"start\": " << r.start << ", \"seconds\": " << r.seconds << ", \"bytes\": " << r.bytes << ", \"values\": " << r.values << ", \"values_per_second\": " << values_per_second << ", \"evaluations\": " << r.evaluations << ", \"evaluations_per_second\": " << evaluations_per_second << ", \"allocations\": " << r.allocations << ", \"allocated_bytes\": " << r.allocated_bytes << ", \"peak_rss_kb\": " << r.peak_rss_kb << "}" << (k + 1 < report.size() ? "," : "") << endl;
+		}
+	}
+	if(!csv) out << "	]" << endl << "}" << endl;
+
+	out.close();
+	if(!out) {
+		log << "Could not write the report " << file_name << " completely" << endl;
+		return false;
+	}
+	return true;
+}
+
+/** Starts the phase <em>name</em>: the time and the allocation counters are read. */
+PhaseTimer::PhaseTimer(PhaseLog& log, const string& name) : phase_log(log), first_allocation(allocation_count()), first_allocated_byte(allocated_bytes()) {
+	record.name = name;
+	record.start = phase_log.seconds();
+	record.seconds = 0;
+	record.bytes = 0;
+	record.values = 0;
+	record.evaluations = 0;
+	record.allocations = 0;
+	record.allocated_bytes = 0;
+	record.peak_rss_kb = 0;
+}
+
+/** Ends the phase and adds its record to the log. */
+PhaseTimer::~PhaseTimer() {
+	record.seconds = phase_log.seconds() - record.start;
+	record.allocations = allocation_count() - first_allocation;
+	record.allocated_bytes = allocated_bytes() - first_allocated_byte;
+	record.peak_rss_kb = peak_rss_kb();
+	phase_log.add(record);
+}
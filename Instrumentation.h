@@ -0,0 +1,92 @@
+/** @file Instrumentation.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Timing and counters of the phases of a calculation, written as a JSON or CSV report
+
+The phases are measured with the macros INSTRUMENT_PHASE() and INSTRUMENT_COUNT(). If the program is compiled with <tt>-DRANDOMCHAINS_NO_INSTRUMENTATION</tt> the macros expand to nothing, so neither the clock nor the counters are read and the arguments of INSTRUMENT_COUNT() are not evaluated. The allocations are then not counted either.
+*/
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include <cstddef>
+#include <stdint.h>
+
+/** The measurements of one phase.
+The allocations are counted for the whole process while the phase runs, if the program counts them at all, see allocations_counted(), so phases which run concurrently, e.g. the files read in by different threads, also count the allocations of each other. The peak resident memory is the largest of the process so far, at the end of the phase.
+*/
+struct PhaseRecord {
+	std::string name;
+	double start;			//s since the PhaseLog was made
+	double seconds;
+	uint64_t bytes;			//Bytes of files parsed or mapped
+	uint64_t values;		//Values read in
+	uint64_t evaluations;		//Pixels x decays evaluated
+	uint64_t allocations;
+	uint64_t allocated_bytes;
+	long peak_rss_kb;
+};
+
+/** The records of all phases measured so far, in the order in which the phases ended. Phases may end concurrently in different threads. */
+class PhaseLog {
+	private:
+		std::chrono::steady_clock::time_point origin;
+		std::vector<PhaseRecord> records;
+		//False while the phases are not recorded, see set_recording()
+		bool recording;
+		mutable std::mutex records_mutex;
+
+		PhaseLog(const PhaseLog&);
+		PhaseLog& operator=(const PhaseLog&);
+
+	public:
+		PhaseLog() : origin(std::chrono::steady_clock::now()), recording(true) {}
+
+		double seconds() const;
+		void add(const PhaseRecord& record);
+		bool set_recording(bool record);
+		void clear();
+		std::vector<PhaseRecord> phases() const;
+		bool write(const std::string& file_name, std::ostream& log) const;
+};
+
+/** The number of allocations with operator new, and their bytes, since the program started. They are only counted in the programs which link in AllocationCounter.cc, as the benchmarks do, so that the other programs do not pay for the counting on every allocation. Both are 0 otherwise and without instrumentation, see allocations_counted(). */
+uint64_t allocation_count();
+uint64_t allocated_bytes();
+bool allocations_counted();
+void count_allocation(size_t size);
+
+/** The largest resident memory of the process so far, in kB. */
+long peak_rss_kb();
+
+/** Measures the phase in which it exists and adds its record to a PhaseLog when it is destroyed. Use it through INSTRUMENT_PHASE(). */
+class PhaseTimer {
+	private:
+		PhaseLog& phase_log;
+		uint64_t first_allocation;
+		uint64_t first_allocated_byte;
+
+		PhaseTimer(const PhaseTimer&);
+		PhaseTimer& operator=(const PhaseTimer&);
+
+	public:
+		PhaseRecord record;
+
+		PhaseTimer(PhaseLog& log, const std::string& name);
+		~PhaseTimer();
+};
+
+#ifdef RANDOMCHAINS_NO_INSTRUMENTATION
+#define INSTRUMENT_PHASE(timer, log, name)
+#define INSTRUMENT_COUNT(timer, field, amount)
+#else
+//Measures the rest of the enclosing scope as the phase <em>name</em>, with the PhaseTimer <em>timer</em>
+#define INSTRUMENT_PHASE(timer, log, name) PhaseTimer timer((log), (name))
+//Adds <em>amount</em> to the field bytes, values or evaluations of the PhaseRecord of <em>timer</em>
+#define INSTRUMENT_COUNT(timer, field, amount) (timer).record.field += (amount)
+#endif
+
+#endif
@@ -0,0 +1,176 @@
+/** @file LiveDataset.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Implementation of the live datasets declared in LiveDataset.h
+*/
+#include "LiveDataset.h"
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+namespace {
+
+//The spectra of a CampaignDelta
+const int spectrum_beam_on = 0;
+const int spectrum_reconstructed_beam_on = 1;
+const int spectrum_reconstructed_beam_off = 2;
+
+}
+
+/** Makes the live dataset of <em>chain_query</em> from the data read in so far: the window sums are taken from the indices of <em>dataset</em>, and all rates and expected random chains are calculated once.
+	@param dataset the data read in so far
+	@param fissions the number of fissions of every pixel as counted, i.e. 0 for the pixels without fissions, see RandomChains::fission_counts
+	@param pure_beam true if the implants are taken from the pure beam ON spectrum, false if from the reconstructed beam ON spectrum
+	@param chain_query the chains, bin limits and duration of the experiment, the program is aborted if it fails ChainQuery::check(), so a query which is not known to pass should be checked first, as RandomChains::GetLiveDataset() does
+	@param pool the threads to use, NULL to calculate in the calling thread
+*/
+LiveDataset::LiveDataset(const Dataset& dataset, const vector<long long>& fissions, bool pure_beam, const ChainQuery& chain_query, ThreadPool* pool) : nbr_pixels(dataset.pixels()), nbr_bins(dataset.bins()), query(chain_query), implant_spectrum(pure_beam ? spectrum_beam_on : spectrum_reconstructed_beam_on) {
+	if(!query.check(cout)) abort();
+
+	query.rate_rows(keys, rows);
+	chain_set.assign(query.chain_length, rows, query.time_span);
+	has_fissions = false;
+	for(unsigned int k = 0; k < keys.size(); k++) has_fissions = has_fissions || keys[k].type == 'f';
+
+	window_counts.resize(keys.size(), nbr_pixels);
+	for(unsigned int k = 0; k < keys.size(); k++) dataset.counts(keys[k], window_counts.row(k).data(), pool);
+	nbr_implants.resize(nbr_pixels);
+	dataset.implants(query.lower_limit_implants, query.upper_limit_implants, nbr_implants.data(), pool);
+
+	fission_counts = fissions;
+	fission_counts.resize(nbr_pixels);
+	nbr_fissions = 0;
+	nbr_empty_pixels = 0;
+	for(int i = 0; i < nbr_pixels; i++) {
+		nbr_fissions += fission_counts[i];
+		nbr_empty_pixels += (fission_counts[i] == 0);
+	}
+
+	rate.resize(keys.size(), nbr_pixels);
+	for(int i = 0; i < nbr_pixels; i++) calculate_rates(i);
+
+	const int nbr_blocks = ChainSet::blocks(nbr_pixels);
+	block_totals.resize((size_t)nbr_blocks*chain_set.chains());
+	vector<int> all_blocks(nbr_blocks);
+	for(int b = 0; b < nbr_blocks; b++) all_blocks[b] = b;
+	evaluate_blocks(all_blocks, pool);
+
+	changed.assign(nbr_pixels, 0);
+}
+
+/** Marks <em>pixel</em> as changed by the current update. */
+void LiveDataset::change(int pixel) {
+	if(changed[pixel]) return;
+	changed[pixel] = 1;
+	changed_pixels.push_back(pixel);
+}
+
+/** Adds counts of one spectrum to the implants and to the window sums of the rates whose window they are in. */
+void LiveDataset::add_counts(const vector<SpectrumCount>& counts, int spectrum, LiveUpdateStatistics& statistics) {
+	for(unsigned int c = 0; c < counts.size(); c++) {
+		const SpectrumCount& added = counts[c];
+		if(added.pixel < 0 || added.pixel >= nbr_pixels || added.bin < 0 || added.bin >= nbr_bins) {
+			statistics.skipped++;
+			continue;
+		}
+		if(spectrum == implant_spectrum && added.bin >= query.lower_limit_implants && added.bin < query.upper_limit_implants) {
+			nbr_implants[added.pixel] += added.count;
+			change(added.pixel);
+		}
+		if(spectrum == spectrum_beam_on) continue;
+
+		int beam = (spectrum == spectrum_reconstructed_beam_on) ? 1 : 0;
+		for(unsigned int k = 0; k < keys.size(); k++) {
+			if(keys[k].type == 'f' || keys[k].beam != beam) continue;
+			if(added.bin < keys[k].lower_limit || added.bin >= keys[k].upper_limit) continue;
+			window_counts.row(k)[added.pixel] += added.count;
+			change(added.pixel);
+		}
+	}
+}
+
+/** The rates of <em>pixel</em> from its window sums and fissions, with the same operations as Dataset::rates(). */
+void LiveDataset::calculate_rates(int pixel) {
+	for(unsigned int k = 0; k < keys.size(); k++) {
+		if(keys[k].type == 'f') {
+			//A pixel without fissions gets the average over the complete implantation detector, see RandomChains::fill_empty_fission_pixels()
+			double fissions = fission_counts[pixel] != 0 ? (double)fission_counts[pixel] : (double)nbr_fissions/nbr_pixels;
+			rate.row(k)[pixel] = fissions/query.experiment_time;
+		}
+		else rate.row(k)[pixel] = (double)window_counts.row(k)[pixel]/query.experiment_time;
+	}
+}
+
+/** Evaluates the chains on the <em>blocks</em> of pixels and reduces all block sums to the expected random chains. */
+void LiveDataset::evaluate_blocks(const vector<int>& blocks, ThreadPool* pool) {
+	const int nbr_chains = chain_set.chains();
+	auto evaluate = [this, &blocks, nbr_chains](int first, int last, int) {
+		for(int b = first; b < last; b++) {
+			chain_set.evaluate_block(rate, nbr_implants, blocks[b], &block_totals[(size_t)blocks[b]*nbr_chains]);
+		}
+	};
+	if(pool) pool->parallel_for(0, blocks.size(), 1, evaluate);
+	else evaluate(0, blocks.size(), 0);
+
+	//The tree overwrites the rows it adds, the block sums are kept for the next update
+	vector<double> rows(block_totals);
+	expected.resize(nbr_chains);
+	ChainSet::reduce_rows(rows.data(), ChainSet::blocks(nbr_pixels), nbr_chains, expected.data());
+}
+
+/** Adds the data recorded since the last update and updates the expected random chains.
+Only the pixels which have counts in the windows of the query, or new fissions, are calculated again, unless the duration of the experiment changes or the average number of fissions of the pixels without fissions does, see LiveDataset. Counts and fissions outside the detector are skipped.
+	@param delta the counts, fissions and duration of the experiment since the last update
+	@param pool the threads to use, NULL to calculate in the calling thread
+	@return the pixels and blocks calculated again
+*/
+LiveUpdateStatistics LiveDataset::Append(const CampaignDelta& delta, ThreadPool* pool) {
+	LiveUpdateStatistics statistics = {0, 0, 0};
+
+	add_counts(delta.beam_on, spectrum_beam_on, statistics);
+	add_counts(delta.reconstructed_beam_on, spectrum_reconstructed_beam_on, statistics);
+	add_counts(delta.reconstructed_beam_off, spectrum_reconstructed_beam_off, statistics);
+
+	bool new_fissions = false;
+	for(unsigned int f = 0; f < delta.fission_pixels.size(); f++) {
+		int pixel = delta.fission_pixels[f];
+		if(pixel < 0 || pixel >= nbr_pixels) {
+			statistics.skipped++;
+			continue;
+		}
+		if(fission_counts[pixel] == 0) nbr_empty_pixels--;
+		fission_counts[pixel]++;
+		nbr_fissions++;
+		new_fissions = true;
+		change(pixel);
+	}
+
+	bool new_time = delta.experiment_time > 0 && delta.experiment_time != query.experiment_time;
+	if(new_time) query.experiment_time = delta.experiment_time;
+
+	if(new_time) {
+		for(int i = 0; i < nbr_pixels; i++) change(i);
+	}
+	else if(new_fissions && has_fissions && nbr_empty_pixels > 0) {
+		for(int i = 0; i < nbr_pixels; i++) {
+			if(fission_counts[i] == 0) change(i);
+		}
+	}
+
+	vector<int> blocks;
+	const int block_pixels = ChainSet::tiles_per_task*ChainSet::tile_pixels;
+	sort(changed_pixels.begin(), changed_pixels.end());
+	for(unsigned int p = 0; p < changed_pixels.size(); p++) {
+		calculate_rates(changed_pixels[p]);
+		changed[changed_pixels[p]] = 0;
+		int block = changed_pixels[p]/block_pixels;
+		if(blocks.empty() || blocks.back() != block) blocks.push_back(block);
+	}
+	statistics.pixels = changed_pixels.size();
+	statistics.blocks = blocks.size();
+	changed_pixels.clear();
+
+	if(!blocks.empty()) evaluate_blocks(blocks, pool);
+	return statistics;
+}
@@ -0,0 +1,96 @@
+/** @file LiveDataset.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Experimental data which grow while a campaign is running, with the expected random chains kept up to date
+*/
+#ifndef LIVEDATASET_H
+#define LIVEDATASET_H
+
+#include <vector>
+#include "SpectrumMatrix.h"
+#include "ChainSet.h"
+#include "Dataset.h"
+#include "ThreadPool.h"
+
+/** Counts added to one bin of one pixel of a spectrum. */
+struct SpectrumCount {
+	int pixel;
+	int bin;
+	int count;
+};
+
+/** What has been recorded since the last update of a LiveDataset: the counts added to the three spectra, the new fissions and the time elapsed since the start of the experiment. */
+struct CampaignDelta {
+	std::vector<SpectrumCount> beam_on;
+	std::vector<SpectrumCount> reconstructed_beam_on;
+	std::vector<SpectrumCount> reconstructed_beam_off;
+
+	//The pixel of every new fission, as in "pixels_with_fissions.csv"
+	std::vector<int> fission_pixels;
+
+	//The duration of the experiment so far in s, 0 keeps the duration of the last update
+	double experiment_time;
+
+	CampaignDelta() : experiment_time(0) {}
+};
+
+/** The work done by one LiveDataset::Append(). */
+struct LiveUpdateStatistics {
+	int pixels;		//Pixels whose rates were recalculated
+	int blocks;		//Blocks of pixels whose expected random chains were recalculated, see ChainSet::evaluate_block()
+	size_t skipped;		//Counts and fissions outside the detector
+};
+
+/** The window sums, rates and expected random chains of one query, kept up to date while the data grow.
+A live dataset is made once from a Dataset, after which the data are only given as deltas to Append(). For every pixel it keeps the counts in the windows of the query, the implants and the fissions, and for every block of pixels of the deterministic reduction the sums of every chain (see ChainSet). A delta only changes the window sums of the pixels it has counts in, and only the rates and the block sums of these pixels are calculated again. The cost of an update is thus proportional to the delta, not to the detector, and the result is bitwise the same as that of Dataset::Evaluate() on the complete data.
+
+Two changes affect every pixel: a new duration of the experiment changes all rates, and a new fission changes the average number of fissions of the pixels without any. Such updates recalculate all pixels concerned.
+
+The Dataset and the RandomChains object it was made from are not changed.
+*/
+class LiveDataset {
+	private:
+		int nbr_pixels;
+		int nbr_bins;
+		ChainQuery query;
+		//The spectrum of the implants, 0 for pure beam ON and 1 for the reconstructed beam ON
+		int implant_spectrum;
+
+		//One row per distinct rate, as in RandomChains::calculate_rates()
+		std::vector<RateKey> keys;
+		std::vector<int> rows;
+		ChainSet chain_set;
+		//True if a rate is of the fissions, whose average changes the pixels without fissions
+		bool has_fissions;
+
+		//The counts in the window of every rate, the implants and the fissions of every pixel
+		PixelMatrix<long long> window_counts;
+		std::vector<long long> nbr_implants;
+		std::vector<long long> fission_counts;
+		long long nbr_fissions;
+		int nbr_empty_pixels;
+
+		PixelMatrix<double> rate;
+		//The sums of every chain in every block of pixels, blocks x chains
+		std::vector<double> block_totals;
+		std::vector<double> expected;
+
+		//The pixels changed by the current update
+		std::vector<char> changed;
+		std::vector<int> changed_pixels;
+
+		void change(int pixel);
+		void add_counts(const std::vector<SpectrumCount>& counts, int spectrum, LiveUpdateStatistics& statistics);
+		void calculate_rates(int pixel);
+		void evaluate_blocks(const std::vector<int>& blocks, ThreadPool* pool);
+
+	public:
+		LiveDataset(const Dataset& dataset, const std::vector<long long>& fissions, bool pure_beam, const ChainQuery& chain_query, ThreadPool* pool = NULL);
+
+		LiveUpdateStatistics Append(const CampaignDelta& delta, ThreadPool* pool = NULL);
+
+		const std::vector<double>& GetExpectedRandomChains() const { return expected; }
+		const std::vector<long long>& GetImplants() const { return nbr_implants; }
+		double GetExperimentTime() const { return query.experiment_time; }
+};
+
+#endif
@@ -0,0 +1,50 @@
+/** @file MappedFile.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Implementation of MappedFile
+*/
+#include "MappedFile.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/** Maps the file <em>path</em> into memory.
+	@param path the path of the file
+	@param access how the file is read, see MappedFileAccess
+	@param populate if true all pages are read in at once, which is faster for a file that is read from the beginning to the end. Otherwise the pages are read in when they are first touched.
+	@return false if the file could not be opened or mapped. An empty file is opened with size 0.
+*/
+bool MappedFile::open(const std::string& path, MappedFileAccess access, bool populate) {
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+
+	struct stat file_stat;
+	if(fstat(fd, &file_stat) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	if(file_stat.st_size > 0) {
+		void* mem = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+		if(mem == MAP_FAILED) {
+			::close(fd);
+			return false;
+		}
+		if(access == MAPPED_SEQUENTIAL) madvise(mem, file_stat.st_size, MADV_SEQUENTIAL);
+		first = static_cast<const char*>(mem);
+		length = file_stat.st_size;
+	}
+
+	//The mapping stays valid after the file descriptor is closed
+	::close(fd);
+	return true;
+}
+
+/** Removes the mapping, if any. */
+void MappedFile::close() {
+	if(first) munmap(const_cast<char*>(first), length);
+	first = NULL;
+	length = 0;
+}
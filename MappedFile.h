@@ -0,0 +1,40 @@
+/** @file MappedFile.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Read-only memory mapping of a whole file
+*/
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+
+/** How a mapped file is read, given to the kernel as advice for the read ahead of its pages. */
+enum MappedFileAccess {
+	MAPPED_DEFAULT_ACCESS,	//No advice, e.g. for the pixel ranges of a spectrum cache
+	MAPPED_SEQUENTIAL	//Read from the beginning to the end, e.g. a ".csv" or event file which is parsed
+};
+
+/** A file mapped read-only into memory.
+The pages are loaded by the kernel when they are first touched. The mapping is removed when the object is destroyed or another file is opened.
+*/
+class MappedFile {
+	private:
+		const char* first;
+		size_t length;
+
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+	public:
+		MappedFile() : first(NULL), length(0) {}
+		~MappedFile() { close(); }
+
+		bool open(const std::string& path, MappedFileAccess access = MAPPED_DEFAULT_ACCESS, bool populate = false);
+		void close();
+
+		const char* begin() const { return first; }
+		const char* end() const { return first + length; }
+		size_t size() const { return length; }
+};
+
+#endif
@@ -0,0 +1,183 @@
+/** @file MonteCarlo.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Implementation of the Monte Carlo simulation declared in MonteCarlo.h
+*/
+#include "MonteCarlo.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+/** The background events of one rate row in one pixel and replica of simulate_random_chains(), a Poisson process with the rate of the pixel.
+The time is divided into blocks, and the events of a block are generated from exponential waiting times between its beginning and its end, with the random numbers of the counter <em>(n, pixel, block, stream)</em>. The events of a block thus only depend on the block, so only the blocks which the time windows of the decays reach are ever generated, in any order, and the last one is kept.
+*/
+class BackgroundEvents {
+	private:
+		const Philox4x32* generator;
+		double rate;
+		double block_length;
+		uint32_t pixel;
+		uint32_t stream;
+		long long block;
+		vector<double> events;
+
+		void generate(long long new_block) {
+			block = new_block;
+			events.clear();
+			double time = block*block_length, end = time + block_length;
+			uint32_t words[4];
+			for(uint32_t n = 0; ; n++) {
+				//Two uniform numbers per call of the generator
+				if(n%2 == 0) {
+					uint32_t counter[4] = {n/2, pixel, (uint32_t)block, stream};
+					(*generator)(counter, words);
+				}
+				time -= log(Philox4x32::uniform(words[2*(n%2)], words[2*(n%2) + 1]))/rate;
+				if(time >= end) break;
+				events.push_back(time);
+			}
+		}
+
+	public:
+		BackgroundEvents() : generator(NULL), rate(0), block_length(1), pixel(0), stream(0), block(-1) {}
+
+		void reset(const Philox4x32* new_generator, double new_rate, double new_block_length, uint32_t new_pixel, uint32_t new_stream) {
+			generator = new_generator;
+			rate = new_rate;
+			block_length = new_block_length;
+			pixel = new_pixel;
+			stream = new_stream;
+			block = -1;
+		}
+
+		/** The first event after <em>start</em>, written to <em>event</em>.
+			@return false if there is no event up to <em>end</em>
+		*/
+		bool first_after(double start, double end, double& event) {
+			if(rate <= 0) return false;
+			for(long long b = (long long)(start/block_length); b*block_length <= end; b++) {
+				if(b != block) generate(b);
+				vector<double>::const_iterator next = upper_bound(events.begin(), events.end(), start);
+				if(next != events.end()) {
+					event = *next;
+					return event <= end;
+				}
+			}
+			return false;
+		}
+};
+
+}
+
+/** Simulates the accidental chains of a number of experiments.
+In every replica of the experiment, every pixel gets its number of implants from <em>implants</em>, at times drawn uniformly over <em>experiment_time</em>. The background of every rate row is a Poisson process with the rate of the pixel, whose event times are generated as exponential waiting times, see BackgroundEvents. The background goes on after the end of the experiment, as the analytic result counts the whole time span of every decay after an implant. An accidental chain is counted if, after an implant, the first background event of the first decay follows within its time span, the first event of the second decay follows the first event within its time span, and so on. The matches are thus found on simulated event times, not drawn from the probabilities of the analytic result, which makes the simulation an independent check of the analytic expression as well as of its numerical evaluation. Implants which are close in time share the events of their background, as in a real experiment, which changes the spread but not the mean of the matches.
+
+The random numbers only depend on <em>seed</em>, the pixel, the replica and the rate row, and not on the threads: the implant times of pixel <em>i</em> in replica <em>r</em> are drawn from the counters <em>(k, i, 0, r*(R+1))</em> and the background of rate row <em>l</em> from the counters <em>(n, i, block, r*(R+1) + l + 1)</em> of a Philox4x32 generator, with <em>R</em> rate rows. The number of matches is summed over the replicas, and the statistical error of the mean is estimated from the spread of the replicas (from the Poisson error of the number of matches if there is one replica).
+	@param chains the chains, with the rows of their decays in <em>rate</em>
+	@param rate the rate vectors, one row per distinct rate and one column per pixel of <em>implants</em>
+	@param implants the number of implants of every pixel
+	@param experiment_time the duration of the experiment, over which the implants are spread, in the unit of the time spans
+	@param nbr_replicas the number of simulated experiments
+	@param seed the key of the random number generator
+	@param pool the threads to use, NULL to simulate in the calling thread
+	@return the mean number of accidental chains per experiment of every chain, with its error
+*/
+MonteCarloResult simulate_random_chains(const ChainSet& chains, const PixelMatrix<double>& rate, const vector<long long>& implants, double experiment_time, int nbr_replicas, uint64_t seed, ThreadPool* pool) {
+	const int nbr_pixels = implants.size();
+	const int nbr_chains = chains.chains();
+	const int nbr_rows = rate.pixels();
+	const int nbr_slots = pool ? pool->size() : 1;
+	const Philox4x32 generator(seed);
+
+	//The blocks are short enough that their index fits into a word of the counter
+	const double min_block_length = experiment_time/(1 << 30);
+
+	//The number of matches of every slot, replica and chain
+	vector<long long> counts((size_t)nbr_slots*nbr_replicas*nbr_chains, 0);
+
+	auto simulate_pixels = [&](int first_pixel, int last_pixel, int slot) {
+		vector<double> implant_times;
+		vector<BackgroundEvents> background(nbr_rows);
+		vector<char> possible(nbr_chains);
+		long long* slot_counts = &counts[(size_t)slot*nbr_replicas*nbr_chains];
+
+		for(int i = first_pixel; i < last_pixel; i++) {
+			//A decay without background can not be found
+			bool any_possible = false;
+			for(int j = 0; j < nbr_chains; j++) {
+				possible[j] = chains.length(j) > 0;
+				for(int d = chains.first(j); d < chains.first(j) + chains.length(j); d++) {
+					if(!(rate[chains.rate_row(d)][i]*chains.time_span(d) > 0)) possible[j] = false;
+				}
+				any_possible = any_possible || possible[j];
+			}
+			if(!any_possible) continue;
+
+			for(int r = 0; r < nbr_replicas; r++) {
+				const uint32_t replica_stream = (uint32_t)r*(nbr_rows + 1);
+
+				//The implants in the order of their times, so that the blocks of the background are mostly reused
+				implant_times.resize(implants[i]);
+				uint32_t words[4];
+				for(long long k = 0; k < implants[i]; k++) {
+					if(k%2 == 0) {
+						uint32_t counter[4] = {(uint32_t)(k/2), (uint32_t)i, 0, replica_stream};
+						generator(counter, words);
+					}
+					implant_times[k] = experiment_time*Philox4x32::uniform(words[2*(k%2)], words[2*(k%2) + 1]);
+				}
+				sort(implant_times.begin(), implant_times.end());
+				//About 4 events per block, so that few events are generated which no time window reaches
+				for(int row = 0; row < nbr_rows; row++) background[row].reset(&generator, rate[row][i], max(4/rate[row][i], min_block_length), i, replica_stream + row + 1);
+
+				long long* replica_counts = slot_counts + (size_t)r*nbr_chains;
+				for(size_t k = 0; k < implant_times.size(); k++) {
+					for(int j = 0; j < nbr_chains; j++) {
+						if(!possible[j]) continue;
+						//Every decay is the first background event within its time span after the previous one
+						double time = implant_times[k];
+						int l = 0;
+						for(; l < chains.length(j); l++) {
+							int decay = chains.first(j) + l;
+							if(!background[chains.rate_row(decay)].first_after(time, time + chains.time_span(decay), time)) break;
+						}
+						if(l == chains.length(j)) replica_counts[j]++;
+					}
+				}
+			}
+		}
+	};
+
+	if(pool) pool->parallel_for(0, nbr_pixels, 16, simulate_pixels);
+	else simulate_pixels(0, nbr_pixels, 0);
+
+	MonteCarloResult result;
+	result.mean.assign(nbr_chains, 0);
+	result.error.assign(nbr_chains, 0);
+	result.nbr_matches.assign(nbr_chains, 0);
+	result.nbr_implants = 0;
+	for(int i = 0; i < nbr_pixels; i++) result.nbr_implants += implants[i];
+	result.nbr_implants *= nbr_replicas;
+	if(nbr_replicas == 0) return result;
+
+	for(int j = 0; j < nbr_chains; j++) {
+		vector<long long> replica_matches(nbr_replicas, 0);
+		for(int s = 0; s < nbr_slots; s++) {
+			for(int r = 0; r < nbr_replicas; r++) replica_matches[r] += counts[((size_t)s*nbr_replicas + r)*nbr_chains + j];
+		}
+		for(int r = 0; r < nbr_replicas; r++) result.nbr_matches[j] += replica_matches[r];
+
+		double mean = (double)result.nbr_matches[j]/nbr_replicas;
+		double variance = 0;
+		if(nbr_replicas > 1) {
+			for(int r = 0; r < nbr_replicas; r++) variance += (replica_matches[r] - mean)*(replica_matches[r] - mean);
+			variance /= nbr_replicas - 1;
+		}
+		else variance = mean;
+		result.mean[j] = mean;
+		result.error[j] = sqrt(variance/nbr_replicas);
+	}
+	return result;
+}
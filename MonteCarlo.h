@@ -0,0 +1,66 @@
+/** @file MonteCarlo.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Monte Carlo simulation of accidental chains, as a cross-check of the analytic expected number of random chains
+*/
+#ifndef MONTECARLO_H
+#define MONTECARLO_H
+
+#include <vector>
+#include <stdint.h>
+#include "SpectrumMatrix.h"
+#include "ThreadPool.h"
+#include "ChainSet.h"
+
+/** The counter-based random number generator Philox4x32-10 (Salmon et al., SC'11).
+Every call maps a 128-bit counter and a 64-bit key to 128 random bits, without any state. A random number is thus determined by its counter alone, so every thread can draw from its own part of the counter space and the simulation gives the same numbers for any number of threads and any scheduling.
+*/
+class Philox4x32 {
+	private:
+		uint32_t key[2];
+
+	public:
+		explicit Philox4x32(uint64_t seed) {
+			key[0] = (uint32_t)seed;
+			key[1] = (uint32_t)(seed >> 32);
+		}
+
+		/** The four random words of <em>counter</em>, written to <em>out</em>. */
+		void operator()(const uint32_t counter[4], uint32_t out[4]) const {
+			uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+			uint32_t k0 = key[0], k1 = key[1];
+			for(int round = 0; round < 10; round++) {
+				uint64_t product0 = (uint64_t)0xD2511F53u*c0;
+				uint64_t product1 = (uint64_t)0xCD9E8D57u*c2;
+				uint32_t hi0 = (uint32_t)(product0 >> 32), lo0 = (uint32_t)product0;
+				uint32_t hi1 = (uint32_t)(product1 >> 32), lo1 = (uint32_t)product1;
+				c0 = hi1 ^ c1 ^ k0;
+				c1 = lo1;
+				c2 = hi0 ^ c3 ^ k1;
+				c3 = lo0;
+				k0 += 0x9E3779B9u;
+				k1 += 0xBB67AE85u;
+			}
+			out[0] = c0;
+			out[1] = c1;
+			out[2] = c2;
+			out[3] = c3;
+		}
+
+		/** A uniform number in (0, 1] with 53 random bits, from two random words. */
+		static double uniform(uint32_t high, uint32_t low) {
+			uint64_t bits = (((uint64_t)high << 32) | low) >> 11;
+			return (bits + 1)*(1.0/9007199254740992.0);
+		}
+};
+
+/** The result of simulate_random_chains() for every chain: the mean number of accidental chains per simulated experiment and its statistical error. */
+struct MonteCarloResult {
+	std::vector<double> mean;
+	std::vector<double> error;
+	std::vector<long long> nbr_matches;
+	long long nbr_implants;	//Implants simulated, in all replicas
+};
+
+MonteCarloResult simulate_random_chains(const ChainSet& chains, const PixelMatrix<double>& rate, const std::vector<long long>& implants, double experiment_time, int nbr_replicas, uint64_t seed, ThreadPool* pool = NULL);
+
+#endif
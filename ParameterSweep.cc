@@ -0,0 +1,110 @@
+/** @file ParameterSweep.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Implementation of the sweep grids declared in ParameterSweep.h
+*/
+#include "ParameterSweep.h"
+#include <fstream>
+#include <sstream>
+#include <cmath>
+
+using namespace std;
+
+/** The values of the axis. A small tolerance makes sure that <em>last</em> is included despite rounding of the steps. */
+vector<double> SweepAxis::values() const {
+	vector<double> axis_values;
+	if(step <= 0 || last < first) {
+		axis_values.push_back(first);
+		return axis_values;
+	}
+	int nbr_steps = (int)floor((last - first)/step + 1e-9);
+	for(int k = 0; k <= nbr_steps; k++) axis_values.push_back(first + k*step);
+	return axis_values;
+}
+
+ParameterSweep::ParameterSweep() {
+	for(int k = 0; k < NBR_SWEEP_LIMITS; k++) limit_swept[k] = false;
+}
+
+const char* ParameterSweep::limit_name(int limit) {
+	const char* names[NBR_SWEEP_LIMITS] = {"alpha_low", "alpha_up", "escape_low", "escape_up", "implants_low", "implants_up"};
+	return names[limit];
+}
+
+/** Reads the grid from a sweep file, see ParameterSweep.
+	@param file_name the sweep file
+	@param chain_length the number of decays of every chain, the time spans of other chains and decays can not be swept
+	@param log the lines read in and the errors are written here
+	@return false if the file could not be opened or a line could not be understood
+*/
+bool ParameterSweep::read(const string& file_name, const vector<int>& chain_length, ostream& log) {
+	ifstream file_stream(file_name, ios::in);
+	if(!file_stream) {
+		log << "Could not find the sweep file " << file_name << endl;
+		return false;
+	}
+
+	string str;
+	int counter = 0;
+	while(getline(file_stream, str)) {
+		counter++;
+		if(counter == 1 || str.find_first_not_of(" \t\r") == string::npos) continue;
+		log << str << endl;
+
+		stringstream ss(str);
+		string name;
+		ss >> name;
+		SweepAxis axis;
+		if(name == "time") {
+			int chain, decay;
+			if(!(ss >> chain >> decay >> axis.first >> axis.last >> axis.step) || chain < 1 || decay < 1) {
+				log << "Could not read the time span sweep on line " << counter << ", the format is: time chain decay first last step" << endl;
+				return false;
+			}
+			if(chain > (int)chain_length.size() || decay > chain_length[chain - 1]) {
+				log << "There is no decay " << decay << " of chain " << chain << " for the time span sweep on line " << counter << ": " << str << endl;
+				return false;
+			}
+			time_chain.push_back(chain - 1);
+			time_decay.push_back(decay - 1);
+			time_axis.push_back(axis);
+			continue;
+		}
+
+		int limit = 0;
+		while(limit < NBR_SWEEP_LIMITS && name != limit_name(limit)) limit++;
+		if(limit == NBR_SWEEP_LIMITS || !(ss >> axis.first >> axis.last >> axis.step)) {
+			log << "Could not read the sweep on line " << counter << ", the format is: name first last step" << endl;
+			return false;
+		}
+		limit_swept[limit] = true;
+		limit_axis[limit] = axis;
+	}
+	return true;
+}
+
+/** The values of a bin limit in the grid.
+	@param limit the bin limit, see SweepLimit
+	@param current the value of the limit if it is not swept
+*/
+vector<int> ParameterSweep::limit_values(int limit, int current) const {
+	vector<int> values;
+	if(!limit_swept[limit]) {
+		values.push_back(current);
+		return values;
+	}
+	vector<double> axis_values = limit_axis[limit].values();
+	for(unsigned int k = 0; k < axis_values.size(); k++) values.push_back((int)lround(axis_values[k]));
+	return values;
+}
+
+/** The values of the time span of a decay in the grid.
+	@param chain the chain, from 0
+	@param decay the decay in the chain, from 0
+	@param current the time span if it is not swept
+*/
+vector<double> ParameterSweep::time_values(int chain, int decay, double current) const {
+	for(unsigned int k = 0; k < time_axis.size(); k++) {
+		if(time_chain[k] == chain && time_decay[k] == decay) return time_axis[k].values();
+	}
+	return vector<double>(1, current);
+}
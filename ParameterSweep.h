@@ -0,0 +1,62 @@
+/** @file ParameterSweep.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Grids of bin limits and time spans for RandomChains::Sweep()
+*/
+#ifndef PARAMETERSWEEP_H
+#define PARAMETERSWEEP_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+//The bin limits which can be swept, in the order of the bin limits of an input chains file
+enum SweepLimit {
+	SWEEP_ALPHA_LOW,
+	SWEEP_ALPHA_UP,
+	SWEEP_ESCAPE_LOW,
+	SWEEP_ESCAPE_UP,
+	SWEEP_IMPLANTS_LOW,
+	SWEEP_IMPLANTS_UP,
+	NBR_SWEEP_LIMITS
+};
+
+/** The values of one swept parameter: <em>first</em>, <em>first + step</em>, ... up to and including <em>last</em>. */
+struct SweepAxis {
+	double first;
+	double last;
+	double step;
+
+	std::vector<double> values() const;
+};
+
+/** The grid of a parameter sweep, read from a sweep file.
+Every line of a sweep file after the first (a comment) gives the values of one parameter:
+
+	<tt>alpha_low|alpha_up|escape_low|escape_up|implants_low|implants_up first last step</tt>
+
+	<tt>time chain decay first last step</tt>
+
+where <em>chain</em> and <em>decay</em> count from 1, in the order of the chains set with RandomChains::SetDecayChains(). Parameters which are not given keep their value. The grid is the cartesian product of all parameters, the time spans of every chain are swept separately.
+*/
+class ParameterSweep {
+	private:
+		bool limit_swept[NBR_SWEEP_LIMITS];
+		SweepAxis limit_axis[NBR_SWEEP_LIMITS];
+
+		//The swept time spans: chain and decay (from 0) and the values
+		std::vector<int> time_chain;
+		std::vector<int> time_decay;
+		std::vector<SweepAxis> time_axis;
+
+	public:
+		ParameterSweep();
+
+		bool read(const std::string& file_name, const std::vector<int>& chain_length, std::ostream& log);
+
+		static const char* limit_name(int limit);
+
+		std::vector<int> limit_values(int limit, int current) const;
+		std::vector<double> time_values(int chain, int decay, double current) const;
+};
+
+#endif
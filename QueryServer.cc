@@ -0,0 +1,173 @@
+/** @file QueryServer.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Implementation of the query protocol declared in QueryServer.h
+*/
+#include "QueryServer.h"
+#include <sstream>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+namespace {
+
+//The line which ends a request and the line which closes the connection
+const char end_line[] = "END";
+const char quit_line[] = "QUIT";
+
+//The line without a carriage return at its end
+string strip_line(const string& line) {
+	if(!line.empty() && line[line.size()-1] == '\r') return line.substr(0, line.size()-1);
+	return line;
+}
+
+//Writes all of data to fd, false if the connection is closed
+bool write_all(int fd, const char* data, size_t size) {
+	while(size > 0) {
+		ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+		if(written < 0 && errno == EINTR) continue;
+		if(written <= 0) return false;
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+}
+
+/** The answer to one request.
+	@param request the chains file of the request, without the line END
+	@return the answer line, with its newline
+*/
+string QueryServer::answer(const string& request) const {
+	ChainQuery query;
+	istringstream input(request);
+	ostringstream log;
+	if(!query.read(input, log)) {
+		//The problem is the last line of the log, after the lines read in
+		string message = log.str();
+		if(!message.empty() && message[message.size()-1] == '\n') message.erase(message.size()-1);
+		return "ERROR " + message.substr(message.find_last_of('\n') + 1) + "\n";
+	}
+
+	ostringstream problems;
+	if(!query.check(problems)) {
+		string message = problems.str();
+		if(!message.empty() && message[message.size()-1] == '\n') message.erase(message.size()-1);
+		return "ERROR " + message + "\n";
+	}
+
+	vector<double> expected = dataset->Evaluate(query);
+	ostringstream out;
+	out.precision(17);
+	out << "OK " << expected.size();
+	for(unsigned int j = 0; j < expected.size(); j++) out << ' ' << expected[j];
+	out << '\n';
+	return out.str();
+}
+
+/** Answers the requests read from <em>input</em> until its end or a line QUIT, e.g. from stdin to stdout.
+Every answer is flushed as soon as it is written.
+*/
+void QueryServer::serve_stream(istream& input, ostream& output) const {
+	string request, line;
+	bool empty = true;
+	while(getline(input, line)) {
+		line = strip_line(line);
+		if(empty && line == quit_line) return;
+		if(line == end_line) {
+			output << answer(request) << flush;
+			request.clear();
+			empty = true;
+			continue;
+		}
+		request += line;
+		request += '\n';
+		empty = false;
+	}
+}
+
+/** Answers the requests of a connected socket until the peer closes it or sends QUIT, then closes it.
+The bytes received are split into lines as they come. All the requests which are complete in what has been received are answered before the answers are sent, so requests sent back to back are answered with few system calls.
+	@param fd the connected socket
+*/
+void QueryServer::serve_connection(int fd) const {
+	char buffer[65536];
+	string pending, request, answers;
+	bool empty = true, open = true;
+
+	while(open) {
+		ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+		if(received < 0 && errno == EINTR) continue;
+		if(received <= 0) break;
+		pending.append(buffer, received);
+
+		size_t start = 0, newline;
+		while((newline = pending.find('\n', start)) != string::npos) {
+			string line = strip_line(pending.substr(start, newline - start));
+			start = newline + 1;
+			if(empty && line == quit_line) {
+				open = false;
+				break;
+			}
+			if(line == end_line) {
+				answers += answer(request);
+				request.clear();
+				empty = true;
+				continue;
+			}
+			request += line;
+			request += '\n';
+			empty = false;
+		}
+		pending.erase(0, start);
+
+		if(!answers.empty() && !write_all(fd, answers.data(), answers.size())) break;
+		answers.clear();
+	}
+	close(fd);
+}
+
+/** Listens on a Unix domain socket and answers every connection in a thread of its own, see serve_connection().
+An old socket file at <em>socket_path</em> is removed first. The method only returns if the socket can not be set up, or if accepting connections fails.
+	@param socket_path the path of the socket
+	@param log the errors are written here
+	@return false if the socket could not be set up
+*/
+bool QueryServer::serve_socket(const string& socket_path, ostream& log) const {
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(socket_path.size() >= sizeof(address.sun_path)) {
+		log << "The socket path " << socket_path << " is too long" << endl;
+		return false;
+	}
+	strcpy(address.sun_path, socket_path.c_str());
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listener < 0) {
+		log << "Could not create a socket: " << strerror(errno) << endl;
+		return false;
+	}
+	unlink(socket_path.c_str());
+	if(bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+		log << "Could not listen on " << socket_path << ": " << strerror(errno) << endl;
+		close(listener);
+		return false;
+	}
+
+	while(true) {
+		int fd = accept(listener, NULL, NULL);
+		if(fd < 0) {
+			if(errno == EINTR || errno == ECONNABORTED) continue;
+			log << "Could not accept a connection: " << strerror(errno) << endl;
+			close(listener);
+			return false;
+		}
+		thread(&QueryServer::serve_connection, this, fd).detach();
+	}
+}
@@ -0,0 +1,40 @@
+/** @file QueryServer.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Line protocol which answers queries of decay chains on a resident Dataset
+*/
+#ifndef QUERYSERVER_H
+#define QUERYSERVER_H
+
+#include <string>
+#include <memory>
+#include <iostream>
+#include "Dataset.h"
+
+/** Answers queries of decay chains on one Dataset which is kept in memory, over a stream or a Unix domain socket.
+The protocol is line based. A request is a chains file in the format of <tt>dump_input.txt</tt> (see ChainQuery::read()) followed by a line <tt>END</tt>. The answer is one line,
+
+	<tt>OK n value_1 ... value_n</tt>
+
+with the expected number of random chains of the <em>n</em> chains, in 17 significant digits so that they are read back exactly, or
+
+	<tt>ERROR message</tt>
+
+if the request is not a valid query. A line <tt>QUIT</tt> instead of a request closes the connection. Any number of requests can be sent on one connection without waiting for the answers in between, they are answered in order.
+
+Every query is evaluated in the thread of its connection, without a ThreadPool: the chains of a typical query take much less than a millisecond on the resident indices, which is less than the cost of waking threads. The connections of serve_socket() have a thread each and are answered concurrently.
+*/
+class QueryServer {
+	private:
+		std::shared_ptr<const Dataset> dataset;
+
+	public:
+		explicit QueryServer(std::shared_ptr<const Dataset> data) : dataset(data) {}
+
+		std::string answer(const std::string& request) const;
+
+		void serve_stream(std::istream& input, std::ostream& output) const;
+		void serve_connection(int fd) const;
+		bool serve_socket(const std::string& socket_path, std::ostream& log) const;
+};
+
+#endif
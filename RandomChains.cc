@@ -157,6 +157,96 @@
 
 	OBS: The duration of the experiment is also given in the same file.
 
+@subsection streaming_tag Streaming mode for large detectors
+	For detectors with many pixels and bins the spectra may not fit
+	in memory. If the decay chains are given to the constructor,
+	RandomChains::RandomChains(int pixels, int bins, string folder, string input_chains, int threads),
+	the chains are read in before the experimental data and only
+	the counts in the energy windows of the implants and of the
+	decays are kept for every pixel. The results are the same as
+	with the complete spectra, but the chains can not be changed
+	afterwards and the test run is not available.
+
+@subsection sweep_tag Sweeps of the bin limits and time spans
+	To choose the bin limits and the time spans, a grid of them can
+	be evaluated with the method RandomChains::Sweep(string
+	sweep_file, string output_file) after the chains have been set.
+	The data is read in only once and the results are written as a
+	table to <tt>output_file</tt>. The file
+	<tt>sweep_article.txt</tt> is an example of a sweep file for the
+	article chains, see ParameterSweep for the format.
+
+@subsection dataset_tag Many queries on one dataset
+	Once the data has been read in, RandomChains::GetDataset()
+	returns it as an immutable Dataset. Any number of ChainQuery
+	objects, each with its own chains, bin limits and duration of the
+	experiment, can then be evaluated on it with
+	Dataset::Evaluate(), without reading in the data again and
+	without changing the dataset. A query is read from a chains file
+	with ChainQuery::read(), which never asks for input. Queries can
+	be evaluated concurrently from several threads, each with its own
+	ThreadPool or without one.
+
+@subsection daemon_tag Query daemon
+	To answer many queries without reading in the data for every
+	one, the daemon <tt>rc_daemon</tt> (built by <tt>make</tt>) reads
+	in a data folder once and keeps the dataset in memory:
+
+	<tt>./rc_daemon Lund_data 1024 4096 [socket_path]</tt>
+
+	A request is a chains file in the format of
+	<tt>dump_input.txt</tt> followed by a line <tt>END</tt>, and the
+	answer is a line <tt>OK n</tt> with the expected number of random
+	chains of the <em>n</em> chains. The requests are read from stdin,
+	or from the connections of a Unix domain socket if a path is
+	given, and many requests can be sent on one connection. See
+	QueryServer for the protocol.
+
+@subsection synthetic_tag Synthetic data for load tests
+	The tool <tt>rc_generate</tt> (built by <tt>make</tt>) writes a
+	data folder of a synthetic detector of any size, e.g.
+
+	<tt>./rc_generate big_data 100000 16384 --format binary</tt>
+
+	The counts are Poisson distributed in the escape, alpha and
+	implant regions, with hot pixels and a matching
+	<tt>pixels_with_fissions.csv</tt>, see SyntheticDetector. The
+	data only depends on the seed, not on the number of threads.
+	With <tt>--format binary</tt> only the binary cache files are
+	written, which are read in without ".csv" files.
+
+@subsection shard_tag Shards of a large detector
+	A detector too large for one machine can be split into shards
+	of pixels, which are evaluated by separate processes with the
+	tool <tt>rc_shard</tt> (built by <tt>make</tt>), each reading in
+	only its own pixels of the spectra:
+
+	<tt>./rc_shard run big_data 100000 16384 0 50176 chains.txt shard_0</tt>
+
+	<tt>./rc_shard merge shard_0 shard_1</tt>
+
+	A shard starts at a multiple of 256 pixels. The merge prints the
+	expected random chains of the complete detector, bitwise the
+	same as RandomChains::Run(), see run_shard() and merge_shards().
+
+@subsection monte_carlo_tag Monte Carlo cross-check
+	The analytic result can be checked with the method
+	RandomChains::RunMonteCarlo(int nbr_replicas, unsigned long long
+	seed, double rate_scale), which simulates the background after
+	every implant of a number of experiments and counts the
+	accidental chains. As the expected numbers of the real data are
+	very small, the rates can be multiplied by <tt>rate_scale</tt>
+	for the comparison. The simulation gives the same result for
+	any number of threads.
+
+@subsection instrumentation_tag Measurements of the phases
+	The wall time, the bytes and values read in, the pixels x
+	decays evaluated, the allocations and the peak memory of the
+	read in and of every step of Run() are measured, and written
+	as JSON or CSV with RandomChains::WritePhaseReport(string
+	report_file). The measurements are left out at compile time
+	with <tt>make DEFINES=-DRANDOMCHAINS_NO_INSTRUMENTATION</tt>.
+
 @section random_tag Calculate the expected number of random chains
 	The expected number of random chains is calculated with the
 	method described in <a
@@ -170,6 +260,44 @@
 
         RandomChains.h: Header file for RandomChains.cc.
 
+	SpectrumMatrix.h: Contiguous pixel-major matrix in which the spectra are stored.
+
+	MappedFile.h, MappedFile.cc, CsvParser.h, CsvParser.cc: The data files are memory mapped and parsed in a single pass without allocations, large files split over several threads.
+
+	SpectrumCache.h, SpectrumCache.cc: Binary cache files of the spectra. The first time a spectrum file <tt>X.csv</tt> is read in, the file <tt>X.csv.rcbin</tt> is written next to it, and later runs memory map it instead of parsing the ".csv" file. The cache is ignored and rewritten if the ".csv" file changes.
+
+	SpectrumIndex.h, SpectrumIndex.cc: Indices over the spectra which give the counts in an energy window with one subtraction. The cumulative index covers every window, the window sums of the streaming mode only the windows of the given chains.
+
+	ChainSet.h, ChainSet.cc: Batch evaluation of many decay chains in one pass over tiles of pixels.
+
+	ParameterSweep.h, ParameterSweep.cc: Grids of bin limits and time spans, which RandomChains::Sweep() evaluates over one loaded dataset.
+
+	Dataset.h, Dataset.cc: The experimental data as an immutable dataset, and the queries of chains which are evaluated on it. See RandomChains::GetDataset().
+
+	QueryServer.h, QueryServer.cc: The line protocol of the query daemon.
+
+	rc_daemon.cc: The query daemon, see QueryServer.
+
+	SyntheticData.h, SyntheticData.cc: Synthetic data folders for load and scaling tests.
+
+	rc_generate.cc: Writes a synthetic data folder, see write_synthetic_data_folder().
+
+	Shard.h, Shard.cc: Evaluation of a range of pixels on its own, and the merge of the shards into the totals of the detector.
+
+	rc_shard.cc: Evaluates or merges shards, see run_shard() and merge_shards().
+
+	Instrumentation.h, Instrumentation.cc: Timing and counters of the phases of a calculation, see RandomChains::WritePhaseReport().
+
+	AllocationCounter.cc: Counts the allocations of the benchmarks, which are then reported with the phases. The other programs are built without it.
+
+	MonteCarlo.h, MonteCarlo.cc: Monte Carlo simulation of the accidental chains, with a counter-based random number generator, as a cross-check of the analytic result. See RandomChains::RunMonteCarlo().
+
+	ThreadPool.h, ThreadPool.cc: Persistent work-stealing pool of threads. The data files are read in and the loops over the pixels in Run() are made by its threads. The number of threads is given to the constructor of RandomChains or by the environment variable RANDOMCHAINS_THREADS.
+
+	ChainKernels.h, ChainKernels.cc: Vectorised (AVX2 and AVX-512) kernels of the per-pixel product of the decay probabilities and of the pixel sums, with a scalar fallback. Chains of up to four decays have kernels of their own, which multiply all decays of a pixel in registers. The instruction set is chosen when the program starts.
+
+	bench.cc: Benchmarks of the hot paths on synthetic data. Built and run with <tt>make bench</tt>. <tt>make bench-phases</tt> only times the phases of a calculation on a synthetic detector, whose size and counts per bin are set with <tt>BENCH_PIXELS</tt>, <tt>BENCH_BINS</tt> and <tt>BENCH_DENSITY</tt>, and writes the times as JSON to <tt>bench_phases.json</tt>.
+
 	run_file.cc: From this file the user should control and
 	execute the program. Examples of how this can be done already
 	exists here.
@@ -188,6 +316,8 @@
 	dump_article.txt: Input chains to reproduce the numbers in the
 	Lund article are dumped to this file.
 
+	sweep_article.txt: Example of a sweep file, see RandomChains::Sweep().
+
 	dump_test.txt: Input chains for the trivial test which can be
 	run to verify the workings of the program are dumped to this
 	file.
@@ -213,9 +343,23 @@
 #include <fstream>
 #include <sstream>
 #include "RandomChains.h"
+#include "MappedFile.h"
+#include "CsvParser.h"
+#include "SpectrumCache.h"
+#include "EventFile.h"
 #include <assert.h>
 #include "math.h"
 #include <typeinfo>
+#include "ThreadPool.h"
+#include "ParameterSweep.h"
+#include "ChainKernels.h"
+#include "MonteCarlo.h"
+#include "Dataset.h"
+#include "LiveDataset.h"
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
 
 using namespace std;
 
@@ -225,22 +369,54 @@ using namespace std;
 	@param pixels number of pixels in the spectrum data
 	@param bins total number of bins in every spectrum
 	@param folder name of the folder which contains the experimental data
+	@param threads number of threads used to read in the data and in Run(), 0 means the value of the environment variable RANDOMCHAINS_THREADS or else one per hardware thread
 	@returns returns object of the class RandomChains
 
 	@see ReadExperimentalData()
 
 The following is initialised:
 	- RandomChains::folder_data
+	- RandomChains::nbr_threads
+	- RandomChains::pool
 	- RandomChains::data_beam_on
 	- RandomChains::data_reconstructed_beam_on
 	- RandomChains::data_reconstructed_beam_off
 
 
 */
-RandomChains::RandomChains(int pixels, int bins, string folder) : nbr_pixels(pixels), nbr_bins(bins) {
+RandomChains::RandomChains(int pixels, int bins, string folder, int threads) : nbr_pixels(pixels), nbr_bins(bins) {
+
+	folder_data = folder + "/";
+
+	nbr_threads = threads > 0 ? threads : ThreadPool::default_threads();
+	pool = make_shared<ThreadPool>(nbr_threads);
+
+	streaming = false;
+	ReadExperimentalData();
+
+}
+
+/** The constructor of class RandomChains for the streaming mode.
+<p> In the streaming mode the decay chains are read in first, from the file <em>input_chains</em>, and then the experimental data. Since the bin windows of the implants and of every decay are known before the spectra are read in, only the counts in these windows are kept for every pixel while the files are parsed, see WindowSumSpectrum. The spectra themselves are never stored, so the memory needed is proportional to the number of pixels times the number of distinct window limits instead of the number of pixels times the number of bins. Run() is used as for the other constructor, but the test run can not be made in this mode.</p>
+	@param pixels number of pixels in the spectrum data
+	@param bins total number of bins in every spectrum
+	@param folder name of the folder which contains the experimental data
+	@param input_chains the name of the file with the decay chains, see SetDecayChains()
+	@param threads number of threads used to read in the data and in Run(), 0 means the value of the environment variable RANDOMCHAINS_THREADS or else one per hardware thread
+	@returns returns object of the class RandomChains
+
+	@see SetDecayChains()
+	@see ReadExperimentalData()
+*/
+RandomChains::RandomChains(int pixels, int bins, string folder, string input_chains, int threads) : nbr_pixels(pixels), nbr_bins(bins) {
 
 	folder_data = folder + "/";
 
+	nbr_threads = threads > 0 ? threads : ThreadPool::default_threads();
+	pool = make_shared<ThreadPool>(nbr_threads);
+
+	streaming = true;
+	SetDecayChains(input_chains);
 	ReadExperimentalData();
 
 }
@@ -314,7 +490,7 @@ void RandomChains::SetDecayChains(string input_chains) {
 /** This method computes the expected number of random chains.
 With this method the expected number of random chains due to random fluctuations in the background for the decay chain/chains and experimental data provided. First the number of implants per pixel is calculated. Then the background rates in every pixel for the different decay types are calculated. This is followed by the calculation of the expected number of random chains. Finally, the results are printed in the terminal window.
 		@see RandomChains::calculate_implants()
-		@see RandomChains::rate_calc()
+		@see RandomChains::calculate_rates()
 		@see RandomChains::calculate_expected_nbr_random_chains()
 		@see RandomChains::print_result()
 
@@ -325,10 +501,7 @@ void RandomChains::Run() {
 	calculate_implants();
 
 	// The background rates for alphas, escapes for beam ON and OFF and fission are calculated for every decay and pixel for that decay.
-	cout << "Calculating rates " << endl;
-	for(unsigned int i = 0; i < decay_type.size(); i++) {
-		rate_calc(decay_type.at(i), beam_status.at(i));
-	}
+	calculate_rates();
 
 	// The TOTAL number of expected random chains due to random fluctuations in the background are calculated for the specific chain/chains given as input to the program.
 	calculate_expected_nbr_random_chains();
@@ -339,8 +512,13 @@ void RandomChains::Run() {
 }
 
 /** The experimental data is read in.
-The experimental data is read in from the folder provided in the constructor. All vectors are initialised. The spectrum data and fission data are read in with the method <em> read_exp_file(string file_name) </em>.
-		@see RandomChains::read_exp_file(string file_name)
+The experimental data is read in from the folder provided in the constructor. All vectors are initialised. The spectrum data and fission data are read in with the method <em> read_exp_file(string file_name, ostream& log) </em>. The spectra are memory mapped from their binary cache files if these are up to date.
+
+If more than one thread is used (see RandomChains::nbr_threads) the four files are read in concurrently, as tasks of RandomChains::pool. The messages of every file are printed after all files have been read in, in the same order as when the files are read in one after another. If an essential file is missing the program is aborted after the messages of the files before it.
+
+If the folder holds a list-mode event file, "events.rcev", the spectra and fissions are histogrammed from its events instead and the ".csv" files are not read, see read_event_file().
+		@see RandomChains::read_exp_file(string file_name, ostream& log)
+		@see RandomChains::read_event_file(string event_path)
 
 	The following data is initialised:
 		- RandomChains::data_beam_on
@@ -351,123 +529,391 @@ The experimental data is read in from the folder provided in the constructor. Al
 
 */
 void RandomChains::ReadExperimentalData() {
+	INSTRUMENT_PHASE(timer, phase_log, "ReadExperimentalData");
 	cout << "Reading experimental data from the relative path: " << folder_data << endl;
 
-	data_beam_on.resize(nbr_pixels);
-	data_reconstructed_beam_on.resize(nbr_pixels);
-	data_reconstructed_beam_off.resize(nbr_pixels);
 	fissions_pixels.resize(nbr_pixels);
 	nbr_implants.resize(nbr_pixels);
-	for(int j = 0; j < nbr_pixels; j++) {
-		data_beam_on[j].resize(nbr_bins);
-		data_reconstructed_beam_on[j].resize(nbr_bins);
-		data_reconstructed_beam_off[j].resize(nbr_bins);
+
+	string event_path = folder_data + event_file_name;
+	if(access(event_path.c_str(), F_OK) == 0) {
+		if(!read_event_file(event_path)) abort();
+		build_spectrum_indices();
+		return;
+	}
+
+	//The files are independent and are read in concurrently. Their messages are collected and printed in this order afterwards.
+	const int nbr_files = 4;
+	const string read_files[nbr_files] = {"beam_on.csv", "rec_beam_on.csv", "rec_beam_off.csv", "pixels_with_fissions.csv"};
+	ostringstream logs[nbr_files];
+	bool found[nbr_files];
+
+	if(nbr_threads > 1) {
+		ThreadPool::TaskGroup loaders;
+		for(int f = 0; f < nbr_files; f++) {
+			pool->run(loaders, [this, &read_files, &logs, &found, f]() {
+				found[f] = read_exp_file(read_files[f], logs[f]);
+			});
+		}
+		pool->wait(loaders);
+	}
+	else {
+		for(int f = 0; f < nbr_files; f++) found[f] = read_exp_file(read_files[f], logs[f]);
+	}
+
+	for(int f = 0; f < nbr_files; f++) {
+		cout << logs[f].str() << flush;
+		if(!found[f]) abort();
 	}
 
-	string read_file;
+	build_spectrum_indices();
+}
+
+/** The cumulative (prefix-sum) indices of the spectra are built, and the dataset is made from them.
+The indices are built once after the spectra have been read in, and again if the spectra are replaced by the test data. Afterwards the counts in any bin window of a pixel are given by one subtraction. In the streaming mode the indices are already made while the files are read in. A dataset taken earlier with GetDataset() keeps the indices it was made from.
 
-	read_file = "beam_on.csv";
-	read_exp_file(read_file);
+A spectrum in which few bins have counts gets a sparse index instead, see make_spectrum_index() and sparse_density_threshold(), and with compressed_spectrum_indices() the other spectra get a compressed index. Their dense counts are then released, since only the indices are used afterwards. An index whose spectrum has been released is kept as it is.
+	@see CumulativeSpectrum
+	@see SparseSpectrum
+	@see CompressedSpectrum
+	@see Dataset
 
-	read_file = "rec_beam_on.csv";
-	read_exp_file(read_file);
+	The following is initialised:
+		- RandomChains::index_beam_on
+		- RandomChains::index_reconstructed_beam_on
+		- RandomChains::index_reconstructed_beam_off
+		- RandomChains::dataset
+*/
+void RandomChains::build_spectrum_indices() {
+	INSTRUMENT_PHASE(timer, phase_log, "build_spectrum_indices");
+	if(!streaming) {
+		const double sparse_threshold = sparse_density_threshold();
+		const bool compressed = compressed_spectrum_indices();
+		SpectrumMatrix* spectra[3] = {&data_beam_on, &data_reconstructed_beam_on, &data_reconstructed_beam_off};
+		shared_ptr<const SpectrumIndex>* indices[3] = {&index_beam_on, &index_reconstructed_beam_on, &index_reconstructed_beam_off};
+		for(int s = pure_beam ? 0 : 1; s < 3; s++) {
+			if(spectra[s]->size() == 0) continue;
+			*indices[s] = make_spectrum_index(*spectra[s], sparse_threshold, compressed);
+			if(!dynamic_cast<const CumulativeSpectrum*>(indices[s]->get())) *spectra[s] = SpectrumMatrix();
+		}
+	}
+	if(index_beam_on) INSTRUMENT_COUNT(timer, bytes, index_beam_on->memory_bytes());
+	INSTRUMENT_COUNT(timer, bytes, index_reconstructed_beam_on->memory_bytes() + index_reconstructed_beam_off->memory_bytes());
+	dataset = make_shared<const Dataset>(nbr_pixels, nbr_bins, pure_beam ? index_beam_on : index_reconstructed_beam_on, index_reconstructed_beam_on, index_reconstructed_beam_off, fissions_pixels);
+}
+
+/** The bin limits of the windows needed from a spectrum in the streaming mode.
+The implants are taken from "beam_on.csv", or from "rec_beam_on.csv" if there is no pure beam ON data. The alpha and escape windows of the decays with beam ON are taken from "rec_beam_on.csv" and those with beam OFF from "rec_beam_off.csv".
+	@param read_file the name of the spectrum file
+	@return the lower and upper limits of the windows
+*/
+vector<int> RandomChains::stream_window_limits(string read_file) {
+	vector<int> limits;
+	if(read_file == "beam_on.csv" || read_file == "rec_beam_on.csv") {
+		limits.push_back(lower_limit_implants);
+		limits.push_back(upper_limit_implants);
+	}
+	if(read_file == "beam_on.csv") return limits;
+
+	int beam = (read_file == "rec_beam_on.csv") ? 1 : 0;
+	for(unsigned int i = 0; i < decay_type.size(); i++) {
+		if(beam_status.at(i) != beam) continue;
+		if(decay_type.at(i) == 'a') {
+			limits.push_back(lower_limit_alphas);
+			limits.push_back(upper_limit_alphas);
+		}
+		else if(decay_type.at(i) == 'e') {
+			limits.push_back(lower_limit_escapes);
+			limits.push_back(upper_limit_escapes);
+		}
+	}
+	return limits;
+}
+
+/** Receiver of the values of "pixels_with_fissions.csv" for parse_csv(). Every value is the pixel number of one fission. */
+class FissionCounter {
+	private:
+		vector<double>& fissions_pixels;
+
+	public:
+		int nbr_of_fissions;
+		int bad_pixel;
+
+		FissionCounter(vector<double>& fissions) : fissions_pixels(fissions), nbr_of_fissions(0), bad_pixel(0) {}
+
+		bool operator()(int pixel) {
+			if(pixel < 0 || pixel >= (int)fissions_pixels.size()) {
+				bad_pixel = pixel;
+				return false;
+			}
+			fissions_pixels[pixel] += 1;
+			nbr_of_fissions++;
+			return true;
+		}
+};
+
+/** A spectrum file is parsed, split over the threads of a pool.
+The file is split into byte ranges at pixel boundaries with split_csv_chunks(), one per thread of the pool, and every range is parsed as a task of the pool. If the file does not hold exactly the expected number of values, or if any range can not be parsed, the file is parsed again in one piece so that the values read in and the diagnostics are exactly the same as with one thread.
+	@param file the mapped spectrum file
+	@param nbr_values the number of values expected, pixels x bins
+	@param bins the number of bins per pixel
+	@param pool the threads which parse the ranges
+	@param make_sink called as <tt>make_sink(first_value, nbr_values)</tt>, returns the receiver for parse_csv() of that range of values
+	@param clear called before the file is parsed again in one piece
+	@return the result of the parsing, as from parse_csv() on the complete file
+*/
+template <typename MakeSink, typename Clear>
+static CsvParseResult parse_spectrum(const MappedFile& file, size_t nbr_values, int bins, ThreadPool& pool, MakeSink make_sink, Clear clear) {
+	if(pool.size() > 1) {
+		vector<CsvChunk> chunks;
+		size_t nbr_values_in_file = split_csv_chunks(file.begin(), file.end(), bins, pool.size(), chunks);
+
+		if(nbr_values_in_file == nbr_values) {
+			vector<CsvParseResult> results(chunks.size());
+			pool.parallel_for(0, chunks.size(), 1, [&make_sink, &chunks, &results](int first, int last, int) {
+				for(int k = first; k < last; k++) {
+					auto sink = make_sink(chunks[k].first_value, chunks[k].nbr_values);
+					results[k] = parse_csv(chunks[k].begin, chunks[k].end, sink);
+				}
+			});
 
-	read_file = "rec_beam_off.csv";
-	read_exp_file(read_file);
+			bool all_parsed = true;
+			for(unsigned int k = 0; k < chunks.size(); k++) {
+				if(results[k].status != CSV_OK || results[k].nbr_values != chunks[k].nbr_values) all_parsed = false;
+			}
+			if(all_parsed) {
+				CsvParseResult result = {CSV_OK, nbr_values, 0};
+				return result;
+			}
+			clear();
+		}
+	}
 
-	read_file = "pixels_with_fissions.csv";
-	read_exp_file(read_file);
+	auto sink = make_sink(0, nbr_values);
+	return parse_csv(file.begin(), file.end(), sink);
 }
 
 /** The experimental data files are read in.
-The experimental data in the comma separated files are read in from the folder provided in the constructor. The files read in are: "beam_on.csv", "recon_beam_on.csv", "recon_beam_off.csv" and "pixels_with_fissions.csv"
+The experimental data in the comma separated files are read in from the folder provided in the constructor. The files read in are: "beam_on.csv", "recon_beam_on.csv", "recon_beam_off.csv" and "pixels_with_fissions.csv". The file is memory mapped and parsed in a single pass with parse_csv(), directly into the spectrum it belongs to. If a field can not be parsed, its location is printed and the values before it are kept.
+
+After a spectrum file has been read in successfully, a binary cache file with the extension ".rcbin" is written next to it. On later runs the cache is memory mapped instead of parsing the ".csv" file, as long as the ".csv" file has the same size and modification time.
+
+In the streaming mode (see RandomChains::streaming) the spectrum is never stored. Every count is added to the window sums of a WindowSumSpectrum while the file is parsed, or while the cache is read if there is one, and no cache is written.
 		@param read_file the name of the file to be read in.
+		@param log the messages about the file are written here
+		@return false if the file is essential for the analysis and could not be found
+
+	@see parse_csv()
+	@see parse_spectrum()
+	@see load_spectrum_cache()
 
 	The following is initialised:
 		- RandomChains::data_beam_on
 		- RandomChains::data_reconstructed_beam_on
 		- RandomChains::data_reconstructed_beam_off
+		- RandomChains::index_beam_on (streaming mode only)
+		- RandomChains::index_reconstructed_beam_on (streaming mode only)
+		- RandomChains::index_reconstructed_beam_off (streaming mode only)
 		- RandomChains::fissions_pixels
 
 */
-void RandomChains::read_exp_file(string read_file) {
+bool RandomChains::read_exp_file(string read_file, ostream& log) {
+	INSTRUMENT_PHASE(timer, phase_log, "read_exp_file " + read_file);
+
+	//The spectrum is chosen once, not for every value
+	SpectrumMatrix* data = NULL;
+	shared_ptr<const SpectrumIndex>* index = NULL;
+	if(read_file == "beam_on.csv") {
+		data = &data_beam_on;
+		index = &index_beam_on;
+	}
+	else if(read_file == "rec_beam_on.csv") {
+		data = &data_reconstructed_beam_on;
+		index = &index_reconstructed_beam_on;
+	}
+	else if(read_file == "rec_beam_off.csv") {
+		data = &data_reconstructed_beam_off;
+		index = &index_reconstructed_beam_off;
+	}
 
-	int bin = 0; int pixel = 0;
-	string val;
+	shared_ptr<WindowSumSpectrum> window_sums;
+	if(data && streaming) window_sums = make_shared<WindowSumSpectrum>(nbr_pixels, nbr_bins, stream_window_limits(read_file));
+
+	string csv_path = folder_data + read_file;
+	if(data && load_spectrum_cache(csv_path, nbr_pixels, nbr_bins, *data)) {
+		log << "Reading file " << csv_path << " from the cache " << spectrum_cache_path(csv_path) << endl;
+		INSTRUMENT_COUNT(timer, bytes, SpectrumCacheHeader::data_offset + data->size()*sizeof(int));
+		INSTRUMENT_COUNT(timer, values, data->size());
+		if(streaming) {
+			window_sums->accumulate(*data);
+			window_sums->finish();
+			*index = window_sums;
+			//The mapping of the cache is not needed any more
+			*data = SpectrumMatrix();
+		}
+		log << "The file was successfully read " << endl;
+		return true;
+	}
 
-	ifstream ifile_stream(folder_data + read_file, ios::in);
+	MappedFile file;
 
-	if(!ifile_stream) {
-		cout << "File \"" << folder_data+read_file << "\" was not found " << endl;
+	if(!file.open(csv_path, MAPPED_SEQUENTIAL, true)) {
+		log << "File \"" << folder_data+read_file << "\" was not found " << endl;
 		if(read_file != "beam_on.csv") {
-			cout << "File \"" << read_file << "\" is essential for the analysis. Please add this file! " << endl;
-			abort();
+			log << "File \"" << read_file << "\" is essential for the analysis. Please add this file! " << endl;
+			return false;
 		}
 		else if (read_file == "beam_on.csv") {
-			cout << "OBS: The reconstructed data will be used instead of pure beam ON data!" << endl;
+			log << "OBS: The reconstructed data will be used instead of pure beam ON data!" << endl;
 			pure_beam = false;
-			return;
+			return true;
 		}
 	}
 
-	cout << "Reading file " << folder_data+read_file << endl;
+	log << "Reading file " << folder_data+read_file << endl;
+	INSTRUMENT_COUNT(timer, bytes, file.size());
 
 	//The fission data are read in here and treated differently.
 	if(read_file == "pixels_with_fissions.csv") {
 		for(int i = 0; i < nbr_pixels; i++) {
 			fissions_pixels[i] = 0;
 		}
-		int nbr_of_fissions = 0;
-		while(getline(ifile_stream, val, ',')) {
-			//cout << "number = " << nbr_of_fissions << " fission val = " << val << " Val_empty = " << val.empty() << " ";
-			if(val.empty()) {
-				cout << "Breaking..." << endl;
-			       	break;
-			}
-			fissions_pixels[stoi(val)] += 1;
-			nbr_of_fissions++;
+		FissionCounter counter(fissions_pixels);
+		CsvParseResult result = parse_csv(file.begin(), file.end(), counter);
+		if(result.status == CSV_EMPTY_FIELD) {
+			log << "Breaking..." << endl;
 		}
-		cout << "Total number of fissions are: " << nbr_of_fissions << endl;
-
-		//If the number of fissions in a pixel is 0 then it is set to the average over the complete implantation detector.
-		for(int i = 0; i < nbr_pixels; i++){
-			if(fissions_pixels[i] == 0){
-				fissions_pixels[i] = (double)nbr_of_fissions/nbr_pixels;
-			}
+		else if(result.status == CSV_TOO_MANY_VALUES) {
+			log << "Pixel number " << counter.bad_pixel << " at byte " << result.error_offset << " is out of range, the rest of the file is skipped" << endl;
 		}
+		else if(result.status != CSV_OK) {
+			log << "Malformed value at byte " << result.error_offset << ": " << csv_status_message(result.status) << ". The rest of the file is skipped" << endl;
+		}
+		int nbr_of_fissions = counter.nbr_of_fissions;
+		INSTRUMENT_COUNT(timer, values, nbr_of_fissions);
+		log << "Total number of fissions are: " << nbr_of_fissions << endl;
+		fill_empty_fission_pixels(nbr_of_fissions);
 
-		return;
+		return true;
+	}
+
+	CsvParseResult result;
+	if(streaming) {
+		result = parse_spectrum(file, window_sums->size(), nbr_bins, *pool,
+			[&window_sums](size_t first_value, size_t nbr_values) { return window_sums->accumulator(first_value, nbr_values); },
+			[&window_sums]() { window_sums->clear(); });
+		window_sums->finish();
+		*index = window_sums;
+	}
+	else {
+		data->resize(nbr_pixels, nbr_bins);
+		result = parse_spectrum(file, data->size(), nbr_bins, *pool,
+			[data](size_t first_value, size_t nbr_values) { return CsvArrayWriter(data->data() + first_value, min(nbr_values, data->size() - first_value)); },
+			[data]() { data->fill(0); });
 	}
 
+	INSTRUMENT_COUNT(timer, values, result.nbr_values);
 
-	while(getline(ifile_stream, val, ',')) {
-		//cout << "bin = " << bin << " val = " << val << endl;
-		if(bin%nbr_bins==0 && bin > 0) {
-			bin = 0;
-			pixel++;
-			//cout << "pixel = " << pixel << endl;
-		}
-		if(read_file == "beam_on.csv") data_beam_on[pixel][bin] = stoi(val);
-		else if(read_file == "rec_beam_on.csv") data_reconstructed_beam_on[pixel][bin] = stoi(val);
-		else if(read_file == "rec_beam_off.csv") data_reconstructed_beam_off[pixel][bin] = stoi(val);
+	if(result.status != CSV_OK) {
+		int bad_pixel = result.nbr_values/nbr_bins;
+		int bad_bin = result.nbr_values%nbr_bins;
+		log << "Malformed field at byte " << result.error_offset << " (pixel " << bad_pixel << ", bin " << bad_bin << "): " << csv_status_message(result.status) << endl;
+	}
 
-		bin++;
+	//The pixel of the last value read in and the number of bins read in for that pixel
+	int pixel = 0, bin = 0;
+	if(result.nbr_values > 0) {
+		pixel = (result.nbr_values - 1)/nbr_bins;
+		bin = result.nbr_values - (size_t)pixel*nbr_bins;
 	}
 
-	if(bin%nbr_bins == 0 && (pixel+1)%nbr_pixels == 0) {
-		cout << "The file was successfully read " << endl;
+	if(result.status == CSV_OK && bin%nbr_bins == 0 && (pixel+1)%nbr_pixels == 0) {
+		log << "The file was successfully read " << endl;
+		if(!streaming && !write_spectrum_cache(csv_path, *data)) {
+			log << "OBS: The cache file " << spectrum_cache_path(csv_path) << " could not be written" << endl;
+		}
 	}
 	else {
-		cout << "Something wrong with the read in ... . The following might hint on what is wrong: " << endl;
-			cout << "Number of pixels read in was " << pixel+1 << endl;
-			cout << " and number of bins for the last pixel was " << bin << endl;
+		log << "Something wrong with the read in ... . The following might hint on what is wrong: " << endl;
+			log << "Number of pixels read in was " << pixel+1 << endl;
+			log << " and number of bins for the last pixel was " << bin << endl;
 	}
 
+	return true;
 }
 
-/**The destructor of RandomChains. Object is deleted.*/
+/** The spectra and fissions are histogrammed from a list-mode event file.
+The events are sorted into the spectra by their flags and histogrammed by the threads of RandomChains::pool in one pass over the file, see histogram_event_file(). If no event belongs to the pure beam ON spectrum, the reconstructed data are used instead, as when "beam_on.csv" is missing. In the streaming mode only the window sums of the spectra are kept, see RandomChains::streaming. No binary cache is written, since the event file is already read in one pass.
+		@param event_path the event file
+		@return false if the file could not be read
+
+	@see EventHistograms
+
+	The following is initialised:
+		- RandomChains::data_beam_on
+		- RandomChains::data_reconstructed_beam_on
+		- RandomChains::data_reconstructed_beam_off
+		- RandomChains::index_beam_on (streaming mode only)
+		- RandomChains::index_reconstructed_beam_on (streaming mode only)
+		- RandomChains::index_reconstructed_beam_off (streaming mode only)
+		- RandomChains::fissions_pixels
+*/
+bool RandomChains::read_event_file(string event_path) {
+	INSTRUMENT_PHASE(timer, phase_log, "read_event_file");
+	cout << "Reading list-mode events from " << event_path << endl;
+
+	EventHistograms histograms;
+	if(!histogram_event_file(event_path, nbr_pixels, nbr_bins, *pool, histograms, cout)) return false;
+	INSTRUMENT_COUNT(timer, bytes, EventFileHeader::data_offset + histograms.nbr_events*sizeof(ListModeEvent));
+	INSTRUMENT_COUNT(timer, values, histograms.nbr_events);
+
+	data_beam_on = move(histograms.beam_on);
+	data_reconstructed_beam_on = move(histograms.reconstructed_beam_on);
+	data_reconstructed_beam_off = move(histograms.reconstructed_beam_off);
+	if(spectrum_density(data_beam_on) == 0) {
+		cout << "OBS: No events of pure beam ON, the reconstructed data will be used instead!" << endl;
+		pure_beam = false;
+		data_beam_on = SpectrumMatrix();
+	}
+
+	if(streaming) {
+		const string spectrum_files[3] = {"beam_on.csv", "rec_beam_on.csv", "rec_beam_off.csv"};
+		SpectrumMatrix* spectra[3] = {&data_beam_on, &data_reconstructed_beam_on, &data_reconstructed_beam_off};
+		shared_ptr<const SpectrumIndex>* indices[3] = {&index_beam_on, &index_reconstructed_beam_on, &index_reconstructed_beam_off};
+		for(int s = pure_beam ? 0 : 1; s < 3; s++) {
+			shared_ptr<WindowSumSpectrum> window_sums = make_shared<WindowSumSpectrum>(nbr_pixels, nbr_bins, stream_window_limits(spectrum_files[s]));
+			window_sums->accumulate(*spectra[s]);
+			window_sums->finish();
+			*indices[s] = window_sums;
+			*spectra[s] = SpectrumMatrix();
+		}
+	}
+
+	long long nbr_of_fissions = 0;
+	for(int i = 0; i < nbr_pixels; i++) {
+		fissions_pixels[i] = histograms.fissions[i];
+		nbr_of_fissions += histograms.fissions[i];
+	}
+	cout << "Total number of fissions are: " << nbr_of_fissions << endl;
+	fill_empty_fission_pixels(nbr_of_fissions);
+
+	return true;
+}
+
+/** If the number of fissions in a pixel is 0 then it is set to the average over the complete implantation detector. The fissions as counted are kept in RandomChains::fission_counts.
+		@param nbr_of_fissions the total number of fissions of the detector
+*/
+void RandomChains::fill_empty_fission_pixels(long long nbr_of_fissions) {
+	fission_counts.assign(fissions_pixels.begin(), fissions_pixels.end());
+	for(int i = 0; i < nbr_pixels; i++){
+		if(fissions_pixels[i] == 0){
+			fissions_pixels[i] = (double)nbr_of_fissions/nbr_pixels;
+		}
+	}
+}
+
+/**The destructor of RandomChains. The spectra and rates free their own memory.*/
 RandomChains::~RandomChains() {
-	delete this;
 }
 
 /** The test data is generated.
@@ -489,14 +935,15 @@ The following is initialised:
 
 */
 void RandomChains::generate_test_data() {
-	//Clearing the data
-	for(int k = 0; k < nbr_pixels; k++) {
-		for(int i = 0; i < nbr_bins; i++) {
-			data_reconstructed_beam_on[k][i] = 0;
-			data_reconstructed_beam_off[k][i] = 0;
-		}
+	if(streaming) {
+		cout << "The test run needs the complete spectra, it can not be made in the streaming mode" << endl;
+		abort();
 	}
 
+	//Clearing the data, the spectra may have been mapped read-only from their cache files
+	data_reconstructed_beam_on.resize(nbr_pixels, nbr_bins);
+	data_reconstructed_beam_off.resize(nbr_pixels, nbr_bins);
+
 	//Setting the values to insert in the test spectra:
 	eon = 4;
 	eoff = 3;
@@ -528,6 +975,9 @@ void RandomChains::generate_test_data() {
 
 		fissions_pixels[k] = fissions;
 	}
+	fission_counts.assign(nbr_pixels, fissions);
+
+	build_spectrum_indices();
 
 }
 
@@ -601,12 +1051,13 @@ void RandomChains::dump_input_to_file() {
 	}
 	else if(run_type == 0) sprintf(output, "dump_article.txt");
 	else sprintf(output, "dump_input.txt");
-	char out[64];
+	//Room for the message around the longest file name
+	char out[sizeof(output) + 32];
 	if(run_type == 0) {
 		sprintf(out, "The following input was given ... ");
 		cout << out << endl;
 	}
-	sprintf(out, "File %s was written ... ", output);
+	snprintf(out, sizeof(out), "File %s was written ... ", output);
 	ofstream dump;
 	dump.open(output);
 	dump << "Lines starting with a '#' indicates the start of a new chain. The 2nd and 4th lines are read in, here the experimental time and the bin limits for the different signal types are given. The format is very important! " << endl;
@@ -660,210 +1111,287 @@ void RandomChains::set_chains_from_input_file(string input_chains) {
 		cin >> filename;
 	}
 	else filename = input_chains;
-	ifstream file_stream(filename,ios::in);
-	if(!file_stream) cout << "Could not find file" << endl;
-	int beam;
-	double time;
-	char type;
-	string str;
-	stringstream ss;
-	int counter = 0;
-	cout << "The following was read in: " << endl;
-	while(getline(file_stream, str)) {
-		cout << str << endl;
-		//if(chain_length.size() > 0) cout << "chain length = " << chain_length.at(0) << endl;
-		if(counter < 5) {
-			if(counter == 1) {
-				if(str.find_first_of(" ") != string::npos) {
-					experiment_time = stod(string(str.begin()+str.find_first_of(" "), str.end()));
-				}
-			}
-			if(counter == 3) {
-				ss.str(string());
-				ss.clear();
-				ss.str(str);
-				ss >> lower_limit_alphas >> upper_limit_alphas >> lower_limit_escapes >> upper_limit_escapes >>lower_limit_implants >> upper_limit_implants;
-			}
-			counter++;
-			continue;
-		}
-
-		if(str[0] == '#') {
-			string number = string(str.begin()+1, str.end());
-			chain_length.push_back(stoi(number));
-		}
-		else {
-			ss.str(string());
-			ss.clear();
-			ss.str(str);
-			ss >> type >> beam >> time;
-			decay_type.push_back(type);
-			beam_status.push_back(beam);
-			time_span.push_back(time);
-		}
-	}
-
-	/*
-	cout << "length of chain lengtj = " << chain_length.size() << endl;
-	cout << "chain length = " << chain_length.at(0) << endl;
-	cout << "Decay type =, beam status, time " << endl;
-	for(int j = 0; j < decay_type.size(); j++) {
-		cout << decay_type.at(j) << " ";
-		cout << beam_status.at(j) << " ";
-		cout << time_span.at(j) << " ";
-	}
-	*/
 
+	//The file is read by a query, which starts without chains, so setting the chains again replaces them
+	ChainQuery query;
+	cout << "The following was read in: " << endl;
+	if(!query.read(filename, cout) || !query.check(cout)) abort();
+
+	experiment_time = query.experiment_time;
+	lower_limit_alphas = query.lower_limit_alphas; upper_limit_alphas = query.upper_limit_alphas;
+	lower_limit_escapes = query.lower_limit_escapes; upper_limit_escapes = query.upper_limit_escapes;
+	lower_limit_implants = query.lower_limit_implants; upper_limit_implants = query.upper_limit_implants;
+	chain_length = query.chain_length;
+	beam_status = query.beam_status;
+	decay_type = query.decay_type;
+	time_span = query.time_span;
 }
 
 
 /** Calculates the number of implants.
-The number of implants in every pixel is calculated with the lower and upper limits set in <em>SetDecayChains</em>.
+The number of implants in every pixel is calculated with the lower and upper limits set in <em>SetDecayChains</em>. The counts are taken from the cumulative index, i.e. one subtraction per pixel, see Dataset::implants().
 
 The following is initialised:
 		- RandomChains::nbr_implants
 */
 void RandomChains::calculate_implants() {
-
-	vector< vector<int> > data;
-
-	if(pure_beam) data = data_beam_on;
-	else data = data_reconstructed_beam_on;
-
-	for(int i = 0; i < nbr_pixels; i++) {
-		int acc_counts = 0;
-		for(int k = lower_limit_implants; k < upper_limit_implants; k++) {
-			acc_counts += data[i][k];
-		}
-		nbr_implants[i] = acc_counts;
-	}
-
+	INSTRUMENT_PHASE(timer, phase_log, "calculate_implants");
+	dataset->implants(lower_limit_implants, upper_limit_implants, nbr_implants.data(), pool.get());
+	INSTRUMENT_COUNT(timer, evaluations, nbr_pixels);
 }
 
-/** This method calculates the rates in every pixel for the specific decay types, one decay at a time.
-The rate in every pixel is calculated with the lower and upper limits set in <em>SetDecayChains</em>.
+/** This method calculates the rates in every pixel for the decays of all chains.
+The rate in every pixel is calculated with the lower and upper limits set in <em>SetDecayChains</em>. Decays with the same decay type, beam status and bin window (see RateKey) share one rate vector, which is calculated the first time the key is met, see ChainQuery::rate_rows() and Dataset::rates(). The memory and the time needed thus scale with the number of distinct rate vectors and not with the number of decays. The rate vectors are stored in one matrix, with one row per distinct key.
 
 The following is initialised:
-	- RandomChains::nbr_implants
+	- RandomChains::rate_keys
+	- RandomChains::rate_row
+	- RandomChains::rate
+	- RandomChains::rate_statistics
 
+	@param verbose false to leave out the messages, e.g. for every point of a sweep
 */
-void RandomChains::calculate_rates() {
-	cout << "Calculating rates " << endl;
+void RandomChains::calculate_rates(bool verbose) {
+	INSTRUMENT_PHASE(timer, phase_log, "rate_calc");
+	if(verbose) cout << "Calculating rates " << endl;
 
-	for(unsigned int i = 0; i < decay_type.size(); i++) {
-		rate_calc(decay_type.at(i), beam_status.at(i));
+	rate_statistics = GetQuery().rate_rows(rate_keys, rate_row);
+
+	rate.resize(rate_keys.size(), nbr_pixels);
+	for(unsigned int k = 0; k < rate_keys.size(); k++) {
+		dataset->rates(rate_keys[k], experiment_time, rate.row(k), pool.get());
 	}
+	rate_statistics.memory_bytes = rate.size()*sizeof(double);
+	INSTRUMENT_COUNT(timer, evaluations, rate.size());
 
+	if(verbose) cout << rate_keys.size() << " distinct rate vectors for " << decay_type.size() << " decays (" << rate_statistics.hits << " hits, " << rate_statistics.misses << " misses)" << endl;
 }
 
-/** This method calculates the rates in every pixel for the specific decay types and beam status for a decay.
-Given the decay type and beam status the rate for every pixel is calculated and stored in the 2D vector <em>rate</em>.
-		@param type decay type, i.e. 'a', 'e' or 'f'.
-		@param beam beam status, i.e. 1 or 0.
-
-The following is intialised:
-		- RandomChains::rate
+/** This method calculates the TOTAL number of expected random chains for the input decay chain/chains.
+On the basis of the rates calculated for every decay the expected number of random chains due to random fluctuations in the background are determined per pixel and decay chain. The values of every pixel are then summed for every decay chain to a final value. All chains are evaluated together in one pass over tiles of pixels, see ChainSet, and the tiles are split over the threads of RandomChains::pool. Unless SetDeterministicReduction() turned it off, the result does not depend on the number of threads.
 
+The following is initialised:
+		- RandomChains::chain_set
+		- RandomChains::nbr_expected_random_chains
 */
-void RandomChains::rate_calc(char type, int beam) {
+void RandomChains::calculate_expected_nbr_random_chains() {
+	INSTRUMENT_PHASE(timer, phase_log, "calculate_expected_nbr_random_chains");
 
-	//Based on the beam status the spectrum is determined
-	vector< vector<int> > data;
-	if(beam) data = data_reconstructed_beam_on;
-	else data = data_reconstructed_beam_off;
+	cout << "Calculating expected number of random chains " << endl;
 
+	chain_set.assign(chain_length, rate_row, time_span);
 
-	vector<double> rate_temp;
-	rate_temp.resize(nbr_pixels);
+	//The results of an earlier run are replaced
+	nbr_expected_random_chains.assign(chain_set.chains(), 0);
+	chain_set.evaluate(rate, nbr_implants, nbr_expected_random_chains.data(), pool.get(), deterministic_reduction);
+	INSTRUMENT_COUNT(timer, evaluations, (uint64_t)chain_set.decays()*nbr_pixels);
+}
 
-	//Based on the decay type, the upper and lower bin limits are set
-	int lower_limit, upper_limit;
-	if(type == 'a') {
-		lower_limit = lower_limit_alphas;
-		upper_limit = upper_limit_alphas;
-	}
-	else if(type == 'e') {
-		lower_limit = lower_limit_escapes;
-		upper_limit = upper_limit_escapes;
-	}
-	else if(type == 'f') {
-		for(int i = 0; i < nbr_pixels; i++) {
-			rate_temp[i] = (double)fissions_pixels[i]/experiment_time;
-		}
-		rate.push_back(rate_temp);
-		return;
-	}
-	else {
-		cout << "Please input correct decay types, i.e. 'a', 'e' or 'f' " << endl;
-		return;
-	}
+/** A Monte Carlo cross-check of the expected number of random chains.
+The implants and the rates are calculated as in Run(), and then <em>nbr_replicas</em> experiments are simulated with them: the implants are spread over the duration of the experiment, the background of every decay is simulated as a Poisson process of events, and the chains are matched on the event times after every implant, see simulate_random_chains(). The mean number of accidental chains per experiment is printed with its statistical error next to the analytic result, and the difference in units of the error.
 
-	//The rate for every pixel is calculated
-	for(int i = 0; i < nbr_pixels; i++) {
-		int acc_counts = 0;
-		for(int k = lower_limit; k < upper_limit; k++) {
-			acc_counts += data[i][k];
+For the real data the expected numbers are so small that hardly any accidental chain is simulated. All rates can therefore be multiplied by <em>rate_scale</em>, which makes accidental chains more likely. The analytic result is calculated with the same scaled rates, so the two are still comparable. The random numbers only depend on <em>seed</em>, not on the number of threads.
+	@param nbr_replicas the number of simulated experiments
+	@param seed the key of the random number generator
+	@param rate_scale the factor applied to all rates
+	@return the simulated mean and error of every chain
+*/
+MonteCarloResult RandomChains::RunMonteCarlo(int nbr_replicas, unsigned long long seed, double rate_scale) {
+	cout << "Monte Carlo simulation of " << nbr_replicas << " experiments, seed " << seed << ", rates scaled by " << rate_scale << endl;
+
+	calculate_implants();
+	calculate_rates(false);
+	for(size_t k = 0; k < rate.size(); k++) rate.data()[k] *= rate_scale;
+	chain_set.assign(chain_length, rate_row, time_span);
+
+	vector<double> analytic(chain_set.chains());
+	chain_set.evaluate(rate, nbr_implants, analytic.data(), pool.get(), deterministic_reduction);
+
+	auto start = chrono::steady_clock::now();
+	MonteCarloResult result = simulate_random_chains(chain_set, rate, nbr_implants, experiment_time, nbr_replicas, seed, pool.get());
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << result.nbr_implants << " implants simulated in " << elapsed << " s (" << result.nbr_implants/elapsed*60 << " per minute)" << endl;
+	for(int j = 0; j < chain_set.chains(); j++) {
+		cout << "For chain " << j+1 << ": analytic " << analytic[j] << ", Monte Carlo ";
+		if(result.nbr_matches[j] == 0) {
+			//No accidental chain, an upper limit at 95 % confidence level
+			cout << "0 (< " << 3.0/max(nbr_replicas, 1) << " at 95 % C.L.)" << endl;
+		}
+		else {
+			cout << result.mean[j] << " +- " << result.error[j] << " (" << (result.mean[j] - analytic[j])/result.error[j] << " sigma)" << endl;
 		}
-		rate_temp[i] = (double) acc_counts/experiment_time;
 	}
+	return result;
+}
 
-	/*
-	for(auto j = 0; j < nbr_pixels; j++) {
-		cout << "Rate at j = " << j << " is " << rate_temp[j] << endl;
-	}
-	*/
+/** The chains, bin limits and duration of the experiment set with SetDecayChains(), as a query which can be evaluated on the dataset of GetDataset().
+	@see Dataset::Evaluate()
+*/
+ChainQuery RandomChains::GetQuery() const {
+	ChainQuery query;
+	query.experiment_time = experiment_time;
+	query.lower_limit_alphas = lower_limit_alphas; query.upper_limit_alphas = upper_limit_alphas;
+	query.lower_limit_escapes = lower_limit_escapes; query.upper_limit_escapes = upper_limit_escapes;
+	query.lower_limit_implants = lower_limit_implants; query.upper_limit_implants = upper_limit_implants;
+	query.chain_length = chain_length;
+	query.beam_status = beam_status;
+	query.decay_type = decay_type;
+	query.time_span = time_span;
+	return query;
+}
 
-	rate.push_back(rate_temp);
+/** A live dataset of the chains set with SetDecayChains() on the data read in so far, to which the data recorded later in the campaign can be appended without reading in everything again.
+	@return the live dataset, NULL if the chains fail ChainQuery::check(), whose problem is written to cout
+	@see LiveDataset::Append()
+*/
+shared_ptr<LiveDataset> RandomChains::GetLiveDataset() const {
+	ChainQuery query = GetQuery();
+	if(!query.check(cout)) return shared_ptr<LiveDataset>();
+	return make_shared<LiveDataset>(*dataset, fission_counts, pure_beam, query, pool.get());
 }
 
-/** This method calculates the TOTAL number of expected random chains for the input decay chain/chains.
-On the basis of the rates calculated for every decay the expected number of random chains due to random fluctuations in the background are determined per pixel and decay chain. The values of every pixel are then summed for every decay chain to a final value.
+/** Writes the measurements of the phases so far as a report.
+Every call of ReadExperimentalData(), read_exp_file(), calculate_implants(), calculate_rates() (as "rate_calc") and calculate_expected_nbr_random_chains() is a phase, also the calls made for the points of Sweep(). For every phase the wall time, the bytes and values read in, the pixels x decays evaluated, the allocations made meanwhile and the peak resident memory are written, see PhaseRecord. The files are read in concurrently, so their phases overlap.
+	@param report_file the report, in CSV if the name ends with ".csv" and otherwise in JSON
+	@return false if the report could not be written, or if the program was compiled with <tt>-DRANDOMCHAINS_NO_INSTRUMENTATION</tt>
+	@see PhaseLog::write()
+*/
+bool RandomChains::WritePhaseReport(string report_file) {
+#ifdef RANDOMCHAINS_NO_INSTRUMENTATION
+	cout << "The phases are not measured, the program was compiled with RANDOMCHAINS_NO_INSTRUMENTATION" << endl;
+	return false;
+#else
+	if(!phase_log.write(report_file, cout)) return false;
+	cout << "The measurements of " << phase_log.phases().size() << " phases are written to " << report_file << endl;
+	return true;
+#endif
+}
 
-The following is initialised:
-		- RandomChains::nbr_expected_random_chains
+/** Chooses how the pixel sums of the expected number of random chains are reduced over the threads.
+By default the reduction is deterministic: the results are bitwise the same for any number of threads and any instruction set, as needed to compare them with validated numbers. The non-deterministic reduction is slightly faster, but the last digits of the results may change with the number of threads and from run to run.
+	@param deterministic true for the deterministic reduction
+	@see ChainSet::evaluate()
 */
-void RandomChains::calculate_expected_nbr_random_chains() {
+void RandomChains::SetDeterministicReduction(bool deterministic) {
+	deterministic_reduction = deterministic;
+}
 
-	cout << "Calculating expected number of random chains " << endl;
-	int offset = 0;
+/** A sweep of the bin limits and time spans over one loaded dataset.
+The chains set with SetDecayChains() are evaluated for every point of the grid given in <em>sweep_file</em>, see ParameterSweep for its format. The grid of the bin limits is walked in the order alpha_low, alpha_up, escape_low, escape_up, implants_low, implants_up (the last one changing fastest), and for every setting of the limits the grid of the time spans of every chain.
 
-	//looping decay chains
-	for(unsigned int j = 0; j < chain_length.size(); j++) {
-		vector<double> randoms_in_pixel(nbr_pixels,0.);
-
-		//looping decays
-		for(int l = offset; l < offset+chain_length.at(j); l++) {
-			/*
-			cout << "l = " << l << endl;
-			cout << "decay type = " << decay_type.at(l) << endl;
-			cout << "beam status = " << beam_status.at(l) << endl;
-			cout << "time span = " << time_span.at(l) << endl;
-			*/
-
-			//looping pixels
-			for(int i = 0; i < nbr_pixels; i++) {
-				if(l == offset) randoms_in_pixel[i] = nbr_implants[i];
-				randoms_in_pixel[i] *= (1-Poisson_pmf(0,rate.at(l)[i]*time_span.at(l)));
-				/*
-				if(rate.at(l)[i] == 0) {
-					cout << "Rate in pixel " << i << " = " << rate.at(l)[i] << endl;
-					cout << "Poisson = " << Poisson_pmf(0,rate.at(l)[i]*time_span.at(l)) << endl;
+Nothing is read in again. For a setting of the limits the implants and rate vectors are taken from the cumulative indices, one subtraction per pixel and window. For the time spans the per-pixel products of the first decays of a chain are kept, so when only the time span of the last decay changes, only the last decay is multiplied in again. Every total is summed in the same order as in Run(), so a point of the grid gives bitwise the same number as Run() with the same parameters.
+
+The results are written to <em>output_file</em> as they are computed, as a table with tab separated columns: the six bin limits, the chain (from 1), the time spans of its decays (comma separated) and the expected number of random chains. The bin limits of SetDecayChains() are restored at the end. The sweep needs the cumulative indices, so it can not be made in the streaming mode.
+	@param sweep_file the file with the grid of the parameters
+	@param output_file the file to which the table is written
+	@return the number of grid points evaluated, 0 if the sweep could not be made
+*/
+long long RandomChains::Sweep(string sweep_file, string output_file) {
+	cout << "Sweep of the parameters in " << sweep_file << endl;
+	if(streaming) {
+		cout << "The sweep needs the complete spectra, it can not be made in the streaming mode" << endl;
+		return 0;
+	}
+
+	ParameterSweep grid;
+	if(!grid.read(sweep_file, chain_length, cout)) return 0;
+
+	ofstream out(output_file, ios::out);
+	if(!out) {
+		cout << "Could not open the output file " << output_file << endl;
+		return 0;
+	}
+	out << "alpha_low	alpha_up	escape_low	escape_up	implants_low	implants_up	chain	time_spans	expected_random_chains" << endl;
+	out.precision(10);
+
+	//The whole sweep is one phase, the implants and rates of every grid point are not recorded
+	INSTRUMENT_PHASE(timer, phase_log, "Sweep " + sweep_file);
+	bool recording = phase_log.set_recording(false);
+
+	int* limits[NBR_SWEEP_LIMITS] = {&lower_limit_alphas, &upper_limit_alphas, &lower_limit_escapes, &upper_limit_escapes, &lower_limit_implants, &upper_limit_implants};
+	int saved_limits[NBR_SWEEP_LIMITS];
+	vector<int> limit_values[NBR_SWEEP_LIMITS];
+	for(int k = 0; k < NBR_SWEEP_LIMITS; k++) {
+		saved_limits[k] = *limits[k];
+		limit_values[k] = grid.limit_values(k, *limits[k]);
+	}
+
+	//The grid of the time spans of every chain, and the offset of its first decay
+	vector< vector< vector<double> > > time_values(chain_length.size());
+	vector<int> first_decay(chain_length.size());
+	int max_length = 0;
+	for(unsigned int j = 0, offset = 0; j < chain_length.size(); offset += chain_length[j], j++) {
+		first_decay[j] = offset;
+		max_length = max(max_length, chain_length[j]);
+		for(int l = 0; l < chain_length[j]; l++) time_values[j].push_back(grid.time_values(j, l, time_span.at(offset + l)));
+	}
+
+	//prefix[l] is the number of implants times the probabilities of the decays 0 to l of a chain
+	PixelMatrix<double> prefix(max_length, nbr_pixels);
+	vector<double> implants(nbr_pixels);
+	vector<int> time_index(max_length);
+
+	long long nbr_points = 0;
+	double start = chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+
+	int limit_index[NBR_SWEEP_LIMITS] = {0, 0, 0, 0, 0, 0};
+	while(true) {
+		for(int k = 0; k < NBR_SWEEP_LIMITS; k++) *limits[k] = limit_values[k][limit_index[k]];
+		calculate_implants();
+		calculate_rates(false);
+		for(int i = 0; i < nbr_pixels; i++) implants[i] = nbr_implants[i];
+
+		for(unsigned int j = 0; j < chain_length.size(); j++) {
+			const int length = chain_length[j];
+			if(length == 0) continue;
+			for(int l = 0; l < length; l++) time_index[l] = 0;
+
+			//The first decay whose time span has changed since the last point
+			int changed = 0;
+			while(true) {
+				for(int l = changed; l < length; l++) {
+					const double* previous = (l == 0) ? implants.data() : prefix.row(l-1).data();
+					double* current = prefix.row(l).data();
+					memcpy(current, previous, nbr_pixels*sizeof(double));
+					multiply_decay_probability(current, rate.row(rate_row[first_decay[j] + l]).data(), time_values[j][l][time_index[l]], nbr_pixels);
+				}
+				INSTRUMENT_COUNT(timer, evaluations, (uint64_t)(length - changed)*nbr_pixels);
+				double expected = ChainSet::deterministic_sum(prefix.row(length-1).data(), nbr_pixels);
+
+				for(int k = 0; k < NBR_SWEEP_LIMITS; k++) out << *limits[k] << '\t';
+				out << j+1 << '\t';
+				for(int l = 0; l < length; l++) out << (l > 0 ? "," : "") << time_values[j][l][time_index[l]];
+				out << '\t' << expected << '\n';
+				nbr_points++;
+
+				//The next time spans, the last decay changes fastest
+				int l = length - 1;
+				while(l >= 0 && ++time_index[l] == (int)time_values[j][l].size()) {
+					time_index[l] = 0;
+					l--;
 				}
-				cout << "rate in pixel " << i << " is  = " << (rate.at(l))[i] << endl;
-				cout << "Poisson = " << Poisson_pmf(0,rate.at(l)[i]*time_span.at(l)) << endl;
-				*/
+				if(l < 0) break;
+				changed = l;
 			}
 		}
 
-		//Sum the number of randoms in all pixels to get the TOTAL number of random chains
-		double random_chains_temp = 0;
-		for(int i = 0; i < nbr_pixels; i++) {
-			random_chains_temp += randoms_in_pixel[i];
+		//The next bin limits, the last limit changes fastest
+		int k = NBR_SWEEP_LIMITS - 1;
+		while(k >= 0 && ++limit_index[k] == (int)limit_values[k].size()) {
+			limit_index[k] = 0;
+			k--;
 		}
-
-		nbr_expected_random_chains.push_back(random_chains_temp);
-		offset += chain_length.at(j);
+		if(k < 0) break;
 	}
+	out.flush();
+
+	for(int k = 0; k < NBR_SWEEP_LIMITS; k++) *limits[k] = saved_limits[k];
+	phase_log.set_recording(recording);
+
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count() - start;
+	cout << nbr_points << " grid points evaluated in " << elapsed << " s, the results are written to " << output_file << endl;
+	return nbr_points;
 }
 
 /** The results of the run are printed.
@@ -6,16 +6,28 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <memory>
+#include "SpectrumMatrix.h"
+#include "SpectrumIndex.h"
+#include "ChainSet.h"
+#include "ThreadPool.h"
+#include "MonteCarlo.h"
+#include "Dataset.h"
+#include "LiveDataset.h"
+#include "Instrumentation.h"
 
 using namespace std;
 
-
 class RandomChains {
 	private:
 		const int nbr_pixels; 
 		const int nbr_bins;
 
 		string folder_data;
+
+		//The number of threads used to read in the data and in Run(), and the pool of these threads
+		int nbr_threads;
+		shared_ptr<ThreadPool> pool;
 		
 		//Indicates the type of run (0,1 or 2)
 		int run_type;
@@ -31,16 +43,29 @@ class RandomChains {
 		int lower_limit_escapes, upper_limit_escapes;
 		int lower_limit_implants, upper_limit_implants;
 
-		//The spectra are stored in these 2D vectors
-		vector< vector<int> > data_beam_on;
-		vector< vector<int> > data_reconstructed_beam_on;
-		vector< vector<int> > data_reconstructed_beam_off;
+		//The spectra are stored in these contiguous pixel-major matrices
+		SpectrumMatrix data_beam_on;
+		SpectrumMatrix data_reconstructed_beam_on;
+		SpectrumMatrix data_reconstructed_beam_off;
+
+		//Indices of the spectra, from which all window sums are taken
+		shared_ptr<const SpectrumIndex> index_beam_on;
+		shared_ptr<const SpectrumIndex> index_reconstructed_beam_on;
+		shared_ptr<const SpectrumIndex> index_reconstructed_beam_off;
+
+		//The indices and the fissions as an immutable dataset, from which the implants and rates are taken
+		shared_ptr<const Dataset> dataset;
+
+		//True if only the window sums needed by the chains are kept while the spectra are read in
+		bool streaming;
 
 		//pixels with fissions
 		vector<double> fissions_pixels;
+		//The fissions of every pixel as counted, before the pixels without fissions get the average
+		vector<long long> fission_counts;
 
 		//Number of implants for every pixel
-		vector<int> nbr_implants;
+		vector<long long> nbr_implants;
 
 		//Chain/chains characteristics
 		vector<int> chain_length;
@@ -48,10 +73,20 @@ class RandomChains {
 		vector<char> decay_type;
 		vector<double> time_span;
 
-		//Background rates and expected number of random chains per pixel
-		vector< vector<double> > rate;
+		//Background rates per pixel, one row per distinct RateKey, and the row of every decay
+		vector<RateKey> rate_keys;
+		vector<int> rate_row;
+		PixelMatrix<double> rate;
+		RateCacheStatistics rate_statistics = {0, 0, 0};
+
+		//The chains in the layout of the batch evaluation, and the expected number of random chains
+		ChainSet chain_set;
+		bool deterministic_reduction = true;
 		vector<double> nbr_expected_random_chains;
 
+		//The measurements of the phases of the read in and of the runs, see Instrumentation.h
+		PhaseLog phase_log;
+
 		//Help variables to generate the test data and for verification
 		int eon;
 		int eoff;
@@ -65,23 +100,36 @@ class RandomChains {
 		char cname[64], ctitle[64];
 
 		//all methods are described in "RandomChains.cc"
-		void read_exp_file(string file_name);
+		bool read_exp_file(string file_name, ostream& log);
+		bool read_event_file(string event_path);
+		void fill_empty_fission_pixels(long long nbr_of_fissions);
 		void generate_test_data();
+		void build_spectrum_indices();
+		vector<int> stream_window_limits(string read_file);
 		void calculate_implants();
-		void calculate_rates();
+		void calculate_rates(bool verbose = true);
 		void calculate_expected_nbr_random_chains();
 		void set_test_chains();
 		void set_article_chains();
 		void set_chains_from_input_file(string input_file);
-		void rate_calc(char type, int beam);
 
 	public:
-		RandomChains(int pixels=1024, int bins=4096, string folder="Lund_data");
+		RandomChains(int pixels=1024, int bins=4096, string folder="Lund_data", int threads=0);
+		RandomChains(int pixels, int bins, string folder, string input_chains, int threads=0);
 		void ReadExperimentalData();
 		void SetDecayChains(string input_chains="");
 		void Run();
 		~RandomChains();
 		void print_result();
+		RateCacheStatistics GetRateCacheStatistics() const { return rate_statistics; }
+		shared_ptr<const Dataset> GetDataset() const { return dataset; }
+		ChainQuery GetQuery() const;
+		shared_ptr<LiveDataset> GetLiveDataset() const;
+		const vector<double>& GetExpectedRandomChains() const { return nbr_expected_random_chains; }
+		void SetDeterministicReduction(bool deterministic);
+		bool WritePhaseReport(string report_file);
+		long long Sweep(string sweep_file, string output_file = "sweep_result.tsv");
+		MonteCarloResult RunMonteCarlo(int nbr_replicas = 10, unsigned long long seed = 1, double rate_scale = 1);
 		void print_test_result();
 		void dump_input_to_file();
 		
@@ -0,0 +1,322 @@
+/** @file Shard.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Implementation of the shards of a detector declared in Shard.h
+*/
+#include "Shard.h"
+#include "MappedFile.h"
+#include "CsvParser.h"
+#include "SpectrumCache.h"
+#include "EventFile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const char* const shard_magic = "RCSHARD";
+
+/** Receiver of the values of "pixels_with_fissions.csv" for parse_csv(), which counts all fissions of the detector and keeps those of the pixels of one shard. */
+class ShardFissionCounter {
+	private:
+		int nbr_pixels;
+		int first_pixel;
+		vector<double>& fissions_pixels;
+
+	public:
+		long long nbr_of_fissions;
+		int bad_pixel;
+
+		ShardFissionCounter(int pixels, int first, vector<double>& fissions) : nbr_pixels(pixels), first_pixel(first), fissions_pixels(fissions), nbr_of_fissions(0), bad_pixel(0) {}
+
+		bool operator()(int pixel) {
+			if(pixel < 0 || pixel >= nbr_pixels) {
+				bad_pixel = pixel;
+				return false;
+			}
+			if(pixel >= first_pixel && pixel < first_pixel + (int)fissions_pixels.size()) fissions_pixels[pixel - first_pixel] += 1;
+			nbr_of_fissions++;
+			return true;
+		}
+};
+
+}
+
+/** Reads in the pixels <em>first_pixel</em> to <em>last_pixel</em>-1 of a spectrum, from its binary cache if there is a valid one and otherwise from the ".csv" file. Only the values of the range are parsed, the values before it are skipped by counting separators, see skip_csv_values().
+	@param found false if there is neither a cache nor a ".csv" file
+	@return false if the file does not hold all values of the range
+*/
+static bool read_spectrum_range(const string& csv_path, int pixels, int bins, int first_pixel, int last_pixel, SpectrumMatrix& spectrum, bool& found, ostream& log) {
+	found = true;
+	if(load_spectrum_cache_range(csv_path, pixels, bins, first_pixel, last_pixel, spectrum)) {
+		log << "Reading pixels " << first_pixel << " to " << last_pixel-1 << " of " << csv_path << " from the cache " << spectrum_cache_path(csv_path) << endl;
+		return true;
+	}
+
+	MappedFile file;
+	if(!file.open(csv_path, MAPPED_SEQUENTIAL, true)) {
+		found = false;
+		return true;
+	}
+	log << "Reading pixels " << first_pixel << " to " << last_pixel-1 << " of " << csv_path << endl;
+
+	spectrum.resize(last_pixel - first_pixel, bins);
+	const char* begin = skip_csv_values(file.begin(), file.end(), (size_t)first_pixel*bins);
+	CsvArrayWriter writer(spectrum.data(), spectrum.size());
+	CsvParseResult result = parse_csv(begin, file.end(), writer);
+
+	//Values after the range end the parsing, they belong to the next shard
+	bool complete = result.nbr_values == spectrum.size() && (result.status == CSV_OK || result.status == CSV_TOO_MANY_VALUES);
+	if(!complete) {
+		size_t value = (size_t)first_pixel*bins + result.nbr_values;
+		log << "Only " << result.nbr_values << " of " << spectrum.size() << " values could be read in, up to pixel " << value/bins << ", bin " << value%bins;
+		if(result.status != CSV_OK && result.status != CSV_TOO_MANY_VALUES) log << ": " << csv_status_message(result.status);
+		log << endl;
+	}
+	return complete;
+}
+
+/** Checks that the pixels <em>first_pixel</em> to <em>last_pixel</em>-1 are a valid shard of a detector of <em>pixels</em> pixels: the range is not empty, starts at a tile of ChainSet and ends at a tile or at the last pixel of the detector.
+	@param log the problems are written here
+	@return false if the range is not a valid shard
+*/
+bool check_shard_range(int pixels, int first_pixel, int last_pixel, ostream& log) {
+	if(first_pixel < 0 || last_pixel > pixels || first_pixel >= last_pixel) {
+		log << "The pixels " << first_pixel << " to " << last_pixel-1 << " are not a range of the " << pixels << " pixels of the detector" << endl;
+		return false;
+	}
+	if(first_pixel%ChainSet::tile_pixels != 0 || (last_pixel%ChainSet::tile_pixels != 0 && last_pixel != pixels)) {
+		log << "A shard must start at a multiple of " << ChainSet::tile_pixels << " pixels and end at one or at the last pixel" << endl;
+		return false;
+	}
+	return true;
+}
+
+/** Evaluates <em>query</em> on the pixels <em>first_pixel</em> to <em>last_pixel</em>-1 of the detector whose data are in <em>folder</em>.
+Only the pixels of the shard are read in from the spectra, from the binary caches if they are valid and otherwise from the ".csv" files, see read_spectrum_range(). As in RandomChains::ReadExperimentalData() the reconstructed beam ON spectrum is used for the implants if there is no pure beam ON spectrum. The range of a cache is not checked against the checksum, which would read in the pages of all pixels. The fissions of all pixels are counted, since a pixel without fissions gets the average over the complete detector, see RandomChains::fill_empty_fission_pixels().
+
+A list-mode event file is not split into pixels, so a folder with "events.rcev" can not be sharded.
+	@param folder the data folder, ending with '/'
+	@param pixels number of pixels of the complete detector
+	@param bins number of bins per spectrum
+	@param first_pixel the first pixel of the shard, see check_shard_range()
+	@param last_pixel one past the last pixel of the shard
+	@param query the chains, bin limits and duration of the experiment
+	@param pool the threads to use, NULL to evaluate in the calling thread
+	@param result the sums of the shard
+	@param log the messages about the data are written here
+	@return false if the range, the query or the data are not valid
+*/
+bool run_shard(const string& folder, int pixels, int bins, int first_pixel, int last_pixel, const ChainQuery& query, ThreadPool* pool, ShardResult& result, ostream& log) {
+	if(!check_shard_range(pixels, first_pixel, last_pixel, log)) return false;
+	if(!query.check(log)) return false;
+	if(access((folder + event_file_name).c_str(), F_OK) == 0) {
+		log << "The data of " << folder << " are in the event file " << event_file_name << ", which can not be sharded" << endl;
+		return false;
+	}
+
+	const int shard_pixels = last_pixel - first_pixel;
+	const string spectrum_files[3] = {"beam_on.csv", "rec_beam_on.csv", "rec_beam_off.csv"};
+	SpectrumMatrix spectra[3];
+	bool found[3];
+	for(int s = 0; s < 3; s++) {
+		if(!read_spectrum_range(folder + spectrum_files[s], pixels, bins, first_pixel, last_pixel, spectra[s], found[s], log)) return false;
+		if(!found[s] && s > 0) {
+			log << "File \"" << folder + spectrum_files[s] << "\" is essential for the analysis. Please add this file! " << endl;
+			return false;
+		}
+	}
+	bool pure_beam = found[0];
+	if(!pure_beam) log << "OBS: The reconstructed data will be used instead of pure beam ON data!" << endl;
+
+	MappedFile fission_file;
+	if(!fission_file.open(folder + "pixels_with_fissions.csv", MAPPED_SEQUENTIAL, true)) {
+		log << "File \"" << folder << "pixels_with_fissions.csv\" is essential for the analysis. Please add this file! " << endl;
+		return false;
+	}
+	vector<double> fissions_pixels(shard_pixels, 0);
+	ShardFissionCounter counter(pixels, first_pixel, fissions_pixels);
+	CsvParseResult parsed = parse_csv(fission_file.begin(), fission_file.end(), counter);
+	if(parsed.status == CSV_TOO_MANY_VALUES) {
+		log << "Pixel number " << counter.bad_pixel << " at byte " << parsed.error_offset << " is out of range, the rest of the file is skipped" << endl;
+	}
+	else if(parsed.status != CSV_OK) {
+		log << "Malformed value at byte " << parsed.error_offset << ": " << csv_status_message(parsed.status) << ". The rest of the file is skipped" << endl;
+	}
+	log << "Total number of fissions are: " << counter.nbr_of_fissions << endl;
+	for(int i = 0; i < shard_pixels; i++) {
+		if(fissions_pixels[i] == 0) fissions_pixels[i] = (double)counter.nbr_of_fissions/pixels;
+	}
+
+	const double sparse_threshold = sparse_density_threshold();
+	const bool compressed = compressed_spectrum_indices();
+	shared_ptr<const SpectrumIndex> indices[3];
+	for(int s = pure_beam ? 0 : 1; s < 3; s++) {
+		indices[s] = make_spectrum_index(spectra[s], sparse_threshold, compressed);
+		spectra[s] = SpectrumMatrix();
+	}
+	Dataset dataset(shard_pixels, bins, pure_beam ? indices[0] : indices[1], indices[1], indices[2], fissions_pixels);
+
+	result.pixels = pixels;
+	result.bins = bins;
+	result.first_pixel = first_pixel;
+	result.last_pixel = last_pixel;
+	result.nbr_fissions = counter.nbr_of_fissions;
+	result.experiment_time = query.experiment_time;
+	result.query_hash = shard_query_hash(query);
+	result.tile_totals = dataset.EvaluateTiles(query, pool);
+	result.nbr_chains = query.chain_length.size();
+	result.partial.assign(result.nbr_chains, 0);
+	ChainSet::reduce_tiles(result.tile_totals.data(), result.tiles(), result.nbr_chains, result.partial.data());
+	return true;
+}
+
+/** A hash of what the sums of a shard depend on in its query, besides the duration of the experiment, which a shard holds itself: the chains, the types, beam statuses and time spans of their decays, and the bin limits. Shards of different queries have different hashes, see merge_shards().
+*/
+uint64_t shard_query_hash(const ChainQuery& query) {
+	//FNV-1a over the bytes of the values, the time spans by their bits
+	uint64_t hash = 14695981039346656037ULL;
+	auto add = [&hash](uint64_t value) {
+		for(int k = 0; k < 8; k++) {
+			hash ^= (value >> 8*k) & 0xff;
+			hash *= 1099511628211ULL;
+		}
+	};
+	const int limits[] = {query.lower_limit_alphas, query.upper_limit_alphas, query.lower_limit_escapes, query.upper_limit_escapes, query.lower_limit_implants, query.upper_limit_implants};
+	for(int limit : limits) add(limit);
+	add(query.chain_length.size());
+	for(int length : query.chain_length) add(length);
+	add(query.decay_type.size());
+	for(char type : query.decay_type) add(type);
+	for(int beam : query.beam_status) add(beam);
+	for(double span : query.time_span) {
+		uint64_t bits;
+		memcpy(&bits, &span, sizeof(bits));
+		add(bits);
+	}
+	return hash;
+}
+
+/** The totals of the complete detector from its shards, bitwise the same as those of RandomChains::Run() on the complete data.
+The shards may be given in any order. They must be of the same detector, query and duration of the experiment, and have counted the same fissions, and together they must hold every pixel exactly once. The tile sums are joined in the order of the pixels and reduced as by the evaluation of all pixels, see ChainSet::reduce_tiles().
+	@param shards the results of run_shard()
+	@param expected the expected random chains of every chain
+	@param log the problems are written here
+	@return false if the shards do not fit together
+*/
+bool merge_shards(const vector<ShardResult>& shards, vector<double>& expected, ostream& log) {
+	if(shards.empty()) {
+		log << "There are no shards to merge" << endl;
+		return false;
+	}
+
+	vector<const ShardResult*> ordered;
+	for(unsigned int k = 0; k < shards.size(); k++) ordered.push_back(&shards[k]);
+	sort(ordered.begin(), ordered.end(), [](const ShardResult* a, const ShardResult* b) { return a->first_pixel < b->first_pixel; });
+
+	const ShardResult& first = *ordered[0];
+	vector<double> tile_totals;
+	int next_pixel = 0;
+	for(unsigned int k = 0; k < ordered.size(); k++) {
+		const ShardResult& shard = *ordered[k];
+		if(shard.pixels != first.pixels || shard.bins != first.bins || shard.nbr_chains != first.nbr_chains || shard.experiment_time != first.experiment_time) {
+			log << "The shard of the pixels " << shard.first_pixel << " to " << shard.last_pixel-1 << " is of another detector, chains or duration of the experiment" << endl;
+			return false;
+		}
+		if(shard.query_hash != first.query_hash) {
+			log << "The shard of the pixels " << shard.first_pixel << " to " << shard.last_pixel-1 << " is of other chains, time spans or bin limits" << endl;
+			return false;
+		}
+		if(shard.nbr_fissions != first.nbr_fissions) {
+			log << "The shard of the pixels " << shard.first_pixel << " to " << shard.last_pixel-1 << " counted " << shard.nbr_fissions << " fissions instead of " << first.nbr_fissions << endl;
+			return false;
+		}
+		if(shard.first_pixel != next_pixel) {
+			if(shard.first_pixel < next_pixel) log << "The pixels " << shard.first_pixel << " to " << next_pixel-1 << " are in more than one shard" << endl;
+			else log << "The pixels " << next_pixel << " to " << shard.first_pixel-1 << " are in no shard" << endl;
+			return false;
+		}
+		if(!check_shard_range(shard.pixels, shard.first_pixel, shard.last_pixel, log)) return false;
+		int nbr_tiles = (shard.last_pixel - shard.first_pixel + ChainSet::tile_pixels - 1)/ChainSet::tile_pixels;
+		if(shard.tile_totals.size() != (size_t)nbr_tiles*shard.nbr_chains) {
+			log << "The shard of the pixels " << shard.first_pixel << " to " << shard.last_pixel-1 << " does not hold the sums of its " << nbr_tiles << " tiles" << endl;
+			return false;
+		}
+		tile_totals.insert(tile_totals.end(), shard.tile_totals.begin(), shard.tile_totals.end());
+		next_pixel = shard.last_pixel;
+	}
+	if(next_pixel != first.pixels) {
+		log << "The pixels " << next_pixel << " to " << first.pixels-1 << " are in no shard" << endl;
+		return false;
+	}
+
+	expected.assign(first.nbr_chains, 0);
+	ChainSet::reduce_tiles(tile_totals.data(), tile_totals.size()/max(first.nbr_chains, 1), first.nbr_chains, expected.data());
+	return true;
+}
+
+/** Writes the shard to <em>path</em> as text: a header line, one line per field and one line per tile with the sums of every chain, all sums in the hexadecimal format of <tt>printf("%a")</tt>.
+	@return false if the file could not be written
+*/
+bool ShardResult::write(const string& path) const {
+	FILE* out = fopen(path.c_str(), "w");
+	if(!out) return false;
+
+	fprintf(out, "%s %d\n", shard_magic, current_version);
+	fprintf(out, "pixels %d\nbins %d\nfirst_pixel %d\nlast_pixel %d\n", pixels, bins, first_pixel, last_pixel);
+	fprintf(out, "fissions %lld\nexperiment_time %a\nquery %016llx\nchains %d\n", nbr_fissions, experiment_time, (unsigned long long)query_hash, nbr_chains);
+	fprintf(out, "partial");
+	for(int j = 0; j < nbr_chains; j++) fprintf(out, " %a", partial[j]);
+	fprintf(out, "\ntiles %d\n", tiles());
+	for(int t = 0; t < tiles(); t++) {
+		for(int j = 0; j < nbr_chains; j++) fprintf(out, j == 0 ? "%a" : " %a", tile_totals[(size_t)t*nbr_chains + j]);
+		fprintf(out, "\n");
+	}
+	return fclose(out) == 0;
+}
+
+/** Reads a shard written by write().
+	@param log the problems are written here
+	@return false if the file could not be read or is not a shard of this version
+*/
+bool ShardResult::read(const string& path, ostream& log) {
+	ifstream input(path.c_str());
+	if(!input) {
+		log << "The shard " << path << " could not be opened" << endl;
+		return false;
+	}
+
+	//The hexadecimal sums are read with strtod, which reads them exactly
+	auto number = [&input](double& value) {
+		string token;
+		if(!(input >> token)) return false;
+		char* end;
+		value = strtod(token.c_str(), &end);
+		return *end == '\0';
+	};
+
+	string magic, field;
+	int version = 0, nbr_tiles = 0;
+	bool ok = (input >> magic >> version) && magic == shard_magic && version == current_version;
+	ok = ok && (input >> field >> pixels) && field == "pixels";
+	ok = ok && (input >> field >> bins) && field == "bins";
+	ok = ok && (input >> field >> first_pixel) && field == "first_pixel";
+	ok = ok && (input >> field >> last_pixel) && field == "last_pixel";
+	ok = ok && (input >> field >> nbr_fissions) && field == "fissions";
+	ok = ok && (input >> field) && field == "experiment_time" && number(experiment_time);
+	ok = ok && (input >> field >> hex >> query_hash >> dec) && field == "query";
+	ok = ok && (input >> field >> nbr_chains) && field == "chains" && nbr_chains >= 0;
+	ok = ok && (input >> field) && field == "partial";
+	if(ok) partial.resize(nbr_chains);
+	for(int j = 0; ok && j < nbr_chains; j++) ok = number(partial[j]);
+	ok = ok && (input >> field >> nbr_tiles) && field == "tiles" && nbr_tiles >= 0;
+	if(ok) tile_totals.resize((size_t)nbr_tiles*nbr_chains);
+	for(size_t k = 0; ok && k < tile_totals.size(); k++) ok = number(tile_totals[k]);
+
+	if(!ok) log << "The file " << path << " is not a shard of this version" << endl;
+	return ok;
+}
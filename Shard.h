@@ -0,0 +1,55 @@
+/** @file Shard.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Evaluation of a range of pixels of a detector on its own, and the merge of these shards into the totals of the complete detector
+*/
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdint>
+#include "Dataset.h"
+#include "ThreadPool.h"
+
+/** The result of one shard: the sums of every chain in every tile of the pixels of the shard, see ChainSet::evaluate_tile().
+The expected random chains are a sum over the pixels, so a detector can be split into shards of pixels, which are evaluated by different processes or machines, each reading in only its own pixels. The shards are aligned to the tiles of ChainSet, and the tile sums are kept instead of one partial sum per chain, so that merge_shards() adds them in exactly the order of RandomChains::Run() and the totals are bitwise the same.
+
+A shard is written as text with write() and read with read(). The sums are written as hexadecimal floating point numbers, so that no bit is lost.
+*/
+struct ShardResult {
+	//The complete detector and the pixels first_pixel to last_pixel-1 of the shard
+	int pixels;
+	int bins;
+	int first_pixel;
+	int last_pixel;
+
+	//The fissions of the complete detector, from which the pixels without fissions get their average
+	long long nbr_fissions;
+	double experiment_time;
+	//shard_query_hash() of the chains, time spans and bin limits of the query
+	uint64_t query_hash;
+
+	int nbr_chains;
+	//The sums of the pixels of the shard, one per chain, only for information
+	std::vector<double> partial;
+	//The sums of every chain in every tile of the shard, tiles x chains
+	std::vector<double> tile_totals;
+
+	static const int current_version = 2;
+
+	int tiles() const { return nbr_chains > 0 ? tile_totals.size()/nbr_chains : 0; }
+
+	bool write(const std::string& path) const;
+	bool read(const std::string& path, std::ostream& log);
+};
+
+uint64_t shard_query_hash(const ChainQuery& query);
+
+bool check_shard_range(int pixels, int first_pixel, int last_pixel, std::ostream& log);
+
+bool run_shard(const std::string& folder, int pixels, int bins, int first_pixel, int last_pixel, const ChainQuery& query, ThreadPool* pool, ShardResult& result, std::ostream& log);
+
+bool merge_shards(const std::vector<ShardResult>& shards, std::vector<double>& expected, std::ostream& log);
+
+#endif
@@ -0,0 +1,234 @@
+/** @file SpectrumCache.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Writing and memory mapping of the spectrum cache files declared in SpectrumCache.h
+*/
+#include "SpectrumCache.h"
+#include "MappedFile.h"
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char cache_magic[8] = {'R','C','S','P','E','C','\0','\0'};
+
+string spectrum_cache_path(const string& csv_path) {
+	return csv_path + ".rcbin";
+}
+
+uint64_t spectrum_checksum(const int* values, size_t nbr_values) {
+	SpectrumChecksum checksum;
+	checksum.add(values, nbr_values);
+	return checksum.value();
+}
+
+/** Adds <em>count</em> counts which follow the counts added so far. */
+void SpectrumChecksum::add(const int* values, size_t count) {
+	const uint32_t* words = reinterpret_cast<const uint32_t*>(values);
+	for(size_t i = 0; i < count; i++) {
+		sum1 += words[i];
+		sum2 += sum1;
+	}
+	nbr_values += count;
+}
+
+/** Joins the checksum of the counts which follow these counts. Every sum2 of <em>next</em> lacks the sum1 of these counts, which is added once per value of <em>next</em>. */
+void SpectrumChecksum::append(const SpectrumChecksum& next) {
+	sum2 += next.sum2 + next.nbr_values*sum1;
+	sum1 += next.sum1;
+	nbr_values += next.nbr_values;
+}
+
+SpectrumCacheWriter::~SpectrumCacheWriter() {
+	if(out) {
+		fclose(out);
+		remove(temporary_path.c_str());
+	}
+}
+
+/** Starts the cache file of the spectrum of <em>csv_path</em>, whose counts are then given with write().
+	@param csv_path the ".csv" file of the spectrum, which need not exist yet
+	@param pixels number of pixels of the spectrum
+	@param bins number of bins per pixel
+	@return false if the file could not be created
+*/
+bool SpectrumCacheWriter::open(const string& csv_path, int pixels, int bins) {
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, cache_magic, sizeof(cache_magic));
+	header.version = SpectrumCacheHeader::current_version;
+	header.byte_order = 0x01020304;
+	header.element_width = sizeof(int);
+	header.nbr_pixels = pixels;
+	header.nbr_bins = bins;
+	checksum = SpectrumChecksum();
+
+	source_path = csv_path;
+	cache_path = spectrum_cache_path(csv_path);
+	temporary_path = cache_path + ".tmp";
+	out = fopen(temporary_path.c_str(), "wb");
+	if(!out) return false;
+
+	//The header is written by close(), when the checksum is known
+	char padding[SpectrumCacheHeader::data_offset];
+	memset(padding, 0, sizeof(padding));
+	ok = fwrite(padding, 1, sizeof(padding), out) == sizeof(padding);
+	return ok;
+}
+
+/** Writes the next counts of the spectrum, pixel-major.
+	@param values the counts
+	@param values_checksum the checksum of the counts, which gives their number
+*/
+bool SpectrumCacheWriter::write(const int* values, const SpectrumChecksum& values_checksum) {
+	ok = ok && fwrite(values, sizeof(int), values_checksum.nbr_values, out) == values_checksum.nbr_values;
+	checksum.append(values_checksum);
+	return ok;
+}
+
+/** Writes the header and moves the cache to its name.
+	@param standalone true if the cache has no ".csv" file, otherwise the size and modification time of the ".csv" file are stored, so it must have been written completely
+	@return false if not all counts were given or a write failed, the cache is then removed
+*/
+bool SpectrumCacheWriter::close(bool standalone) {
+	if(!out) return false;
+	ok = ok && checksum.nbr_values == (uint64_t)header.nbr_pixels*header.nbr_bins;
+
+	if(standalone) header.flags = SpectrumCacheHeader::standalone;
+	else {
+		struct stat source;
+		ok = ok && stat(source_path.c_str(), &source) == 0;
+		header.source_size = source.st_size;
+		header.source_mtime_sec = source.st_mtim.tv_sec;
+		header.source_mtime_nsec = source.st_mtim.tv_nsec;
+	}
+	header.checksum = checksum.value();
+
+	ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+	ok = (fclose(out) == 0) && ok;
+	out = NULL;
+
+	if(!ok || rename(temporary_path.c_str(), cache_path.c_str()) != 0) {
+		remove(temporary_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** Writes the binary cache file of the spectrum read in from <em>csv_path</em>.
+The file is first written under a temporary name and then renamed, so that a run which is interrupted never leaves a truncated cache behind.
+	@param csv_path the ".csv" file the spectrum was read in from
+	@param spectrum the spectrum
+	@return false if the cache could not be written, e.g. if the data folder is read-only
+*/
+bool write_spectrum_cache(const string& csv_path, const SpectrumMatrix& spectrum) {
+	struct stat source;
+	if(stat(csv_path.c_str(), &source) != 0) return false;
+
+	SpectrumCacheWriter writer;
+	SpectrumChecksum checksum;
+	checksum.add(spectrum.data(), spectrum.size());
+	if(!writer.open(csv_path, spectrum.pixels(), spectrum.bins())) return false;
+	writer.write(spectrum.data(), checksum);
+	return writer.close(false);
+}
+
+/** Maps the cache file of <em>csv_path</em> if its header is valid for a spectrum of <em>pixels</em> x <em>bins</em>, see load_spectrum_cache(). The checksum is not checked.
+	@param header the header of the cache
+	@return the mapped file, NULL if there is no valid cache
+*/
+static shared_ptr<MappedFile> map_spectrum_cache(const string& csv_path, int pixels, int bins, SpectrumCacheHeader& header) {
+	struct stat source;
+	bool has_source = stat(csv_path.c_str(), &source) == 0;
+
+	shared_ptr<MappedFile> file = make_shared<MappedFile>();
+	if(!file->open(spectrum_cache_path(csv_path))) return NULL;
+	if(file->size() < SpectrumCacheHeader::data_offset) return NULL;
+
+	memcpy(&header, file->begin(), sizeof(header));
+	if(memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0) return NULL;
+	if(header.version != SpectrumCacheHeader::current_version) return NULL;
+	if(header.byte_order != 0x01020304 || header.element_width != sizeof(int)) return NULL;
+	if(header.nbr_pixels != pixels || header.nbr_bins != bins) return NULL;
+	if(header.flags & SpectrumCacheHeader::standalone) {
+		if(has_source) return NULL;
+	}
+	else {
+		if(!has_source) return NULL;
+		if(header.source_size != (uint64_t)source.st_size) return NULL;
+		if(header.source_mtime_sec != source.st_mtim.tv_sec || header.source_mtime_nsec != source.st_mtim.tv_nsec) return NULL;
+	}
+
+	size_t nbr_values = (size_t)pixels*bins;
+	if(file->size() != SpectrumCacheHeader::data_offset + nbr_values*sizeof(int)) return NULL;
+	return file;
+}
+
+/** Checks the counts of a cache against its checksum, once after the cache was written: the flag SpectrumCacheHeader::verified is then set in the header of the file, and later loads only check the header. If the flag can not be set, e.g. in a read-only data folder, the counts are checked again by the next load.
+	@param csv_path the ".csv" file of the spectrum
+	@param file the mapped cache, see map_spectrum_cache()
+	@param header the header of the cache
+	@return false if the checksum is wrong
+*/
+static bool verify_spectrum_cache(const string& csv_path, const MappedFile& file, const SpectrumCacheHeader& header) {
+	if(header.flags & SpectrumCacheHeader::verified) return true;
+
+	size_t nbr_values = (size_t)header.nbr_pixels*header.nbr_bins;
+	const int* counts = reinterpret_cast<const int*>(file.begin() + SpectrumCacheHeader::data_offset);
+	if(spectrum_checksum(counts, nbr_values) != header.checksum) return false;
+
+	//The flag is only set if the file is still the cache which was checked, and not one written since
+	int fd = open(spectrum_cache_path(csv_path).c_str(), O_RDWR);
+	if(fd < 0) return true;
+	SpectrumCacheHeader current;
+	if(pread(fd, &current, sizeof(current), 0) == sizeof(current) && memcmp(&current, &header, sizeof(header)) == 0) {
+		current.flags |= SpectrumCacheHeader::verified;
+		if(pwrite(fd, &current.flags, sizeof(current.flags), offsetof(SpectrumCacheHeader, flags)) != sizeof(current.flags)) {
+			//The counts are checked again by the next load
+		}
+	}
+	close(fd);
+	return true;
+}
+
+/** Memory maps the binary cache file of the ".csv" file <em>csv_path</em> as <em>spectrum</em>.
+The cache is only used if it was made by this version of the program for a spectrum of the same size, from a ".csv" file with the same size and modification time as <em>csv_path</em> has now (or, for a standalone cache, if there is no ".csv" file), and if the checksum of the counts is correct. The checksum is only computed by the first load after the cache was written, see verify_spectrum_cache(), which reads in all pages. The spectrum reads its counts directly from the mapping, so for the later loads the pages are read in by the kernel when they are first touched.
+	@param csv_path the ".csv" file of the spectrum
+	@param pixels number of pixels expected
+	@param bins number of bins per pixel expected
+	@param spectrum the spectrum, only modified if the cache is used
+	@return false if there is no valid cache and the ".csv" file has to be parsed
+*/
+bool load_spectrum_cache(const string& csv_path, int pixels, int bins, SpectrumMatrix& spectrum) {
+	SpectrumCacheHeader header;
+	shared_ptr<MappedFile> file = map_spectrum_cache(csv_path, pixels, bins, header);
+	if(!file) return false;
+
+	if(!verify_spectrum_cache(csv_path, *file, header)) return false;
+	const int* counts = reinterpret_cast<const int*>(file->begin() + SpectrumCacheHeader::data_offset);
+
+	spectrum.adopt(counts, pixels, bins, file);
+	return true;
+}
+
+/** Memory maps the pixels <em>first_pixel</em> to <em>last_pixel</em>-1 of the binary cache file of <em>csv_path</em> as <em>spectrum</em>, e.g. for one shard of a detector, see run_shard().
+The cache is checked as by load_spectrum_cache(). Only the first load after the cache was written reads in the pages of all pixels for the checksum, the later loads only read in the pages of the range.
+	@param csv_path the ".csv" file of the spectrum
+	@param pixels number of pixels of the complete spectrum
+	@param bins number of bins per pixel
+	@param first_pixel the first pixel of the range
+	@param last_pixel one past the last pixel of the range
+	@param spectrum the <em>last_pixel - first_pixel</em> pixels of the range, only modified if the cache is used
+	@return false if there is no valid cache and the ".csv" file has to be parsed
+*/
+bool load_spectrum_cache_range(const string& csv_path, int pixels, int bins, int first_pixel, int last_pixel, SpectrumMatrix& spectrum) {
+	SpectrumCacheHeader header;
+	shared_ptr<MappedFile> file = map_spectrum_cache(csv_path, pixels, bins, header);
+	if(!file || !verify_spectrum_cache(csv_path, *file, header)) return false;
+
+	const int* counts = reinterpret_cast<const int*>(file->begin() + SpectrumCacheHeader::data_offset);
+	spectrum.adopt(counts + (size_t)first_pixel*bins, last_pixel - first_pixel, bins, file);
+	return true;
+}
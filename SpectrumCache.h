@@ -0,0 +1,92 @@
+/** @file SpectrumCache.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Binary cache files of the spectra, which are memory mapped instead of parsed
+*/
+#ifndef SPECTRUMCACHE_H
+#define SPECTRUMCACHE_H
+
+#include <string>
+#include <stdint.h>
+#include <cstdio>
+#include "SpectrumMatrix.h"
+
+/** Header of a spectrum cache file.
+The header is followed by padding up to SpectrumCacheHeader::data_offset and then by the raw counts, pixel-major as in a SpectrumMatrix. The size and modification time of the ".csv" file the cache was made from are stored, so that the cache is not used if the ".csv" file has changed.
+
+A standalone cache (see SpectrumCacheHeader::standalone) was not made from a ".csv" file, e.g. synthetic data written directly in the binary format. It is only used if there is no ".csv" file.
+*/
+struct SpectrumCacheHeader {
+	char magic[8];			//"RCSPEC" followed by two zero bytes
+	uint32_t version;		//SpectrumCacheHeader::current_version
+	uint32_t byte_order;		//0x01020304 written in the byte order of the machine
+	uint32_t element_width;		//Width in bytes of one count
+	int32_t nbr_pixels;
+	int32_t nbr_bins;
+	uint32_t flags;			//SpectrumCacheHeader::standalone and SpectrumCacheHeader::verified
+	uint64_t source_size;		//Size in bytes of the ".csv" file
+	int64_t source_mtime_sec;	//Modification time of the ".csv" file
+	int64_t source_mtime_nsec;
+	uint64_t checksum;		//spectrum_checksum() of the counts
+
+	static const uint32_t current_version = 1;
+	//The cache has no ".csv" file, the source fields are 0
+	static const uint32_t standalone = 1;
+	//The counts have been checked against the checksum once, see load_spectrum_cache()
+	static const uint32_t verified = 2;
+	//The counts start on a page boundary
+	static const size_t data_offset = 4096;
+};
+
+/** The name of the cache file which belongs to the ".csv" file <em>csv_path</em>. */
+std::string spectrum_cache_path(const std::string& csv_path);
+
+/** Checksum of <em>nbr_values</em> counts, a 64-bit Fletcher sum over the 32-bit words. */
+uint64_t spectrum_checksum(const int* values, size_t nbr_values);
+
+/** The sums of spectrum_checksum() over a part of the counts.
+The checksums of consecutive parts can be computed independently, e.g. in different threads, and joined with append() in the order of the parts.
+*/
+struct SpectrumChecksum {
+	uint64_t sum1;
+	uint64_t sum2;
+	uint64_t nbr_values;
+
+	SpectrumChecksum() : sum1(0), sum2(0), nbr_values(0) {}
+
+	void add(const int* values, size_t nbr_values);
+	void append(const SpectrumChecksum& next);
+	uint64_t value() const { return (sum2 << 32) ^ sum1 ^ (sum2 >> 32); }
+};
+
+/** Writes a spectrum cache file piece by piece, so that a spectrum larger than the memory can be written.
+The counts are written under a temporary name, and close() writes the header and renames the file. A cache which is not closed is removed by the destructor.
+*/
+class SpectrumCacheWriter {
+	private:
+		FILE* out;
+		std::string source_path;
+		std::string cache_path;
+		std::string temporary_path;
+		SpectrumCacheHeader header;
+		SpectrumChecksum checksum;
+		bool ok;
+
+		SpectrumCacheWriter(const SpectrumCacheWriter&);
+		SpectrumCacheWriter& operator=(const SpectrumCacheWriter&);
+
+	public:
+		SpectrumCacheWriter() : out(NULL), ok(false) {}
+		~SpectrumCacheWriter();
+
+		bool open(const std::string& csv_path, int pixels, int bins);
+		bool write(const int* values, const SpectrumChecksum& values_checksum);
+		bool close(bool standalone);
+};
+
+bool write_spectrum_cache(const std::string& csv_path, const SpectrumMatrix& spectrum);
+
+bool load_spectrum_cache(const std::string& csv_path, int pixels, int bins, SpectrumMatrix& spectrum);
+
+bool load_spectrum_cache_range(const std::string& csv_path, int pixels, int bins, int first_pixel, int last_pixel, SpectrumMatrix& spectrum);
+
+#endif
@@ -0,0 +1,348 @@
+/** @file SpectrumIndex.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Implementation of the spectrum indices declared in SpectrumIndex.h
+*/
+#include "SpectrumIndex.h"
+#include "ChainKernels.h"
+#include <algorithm>
+#include <iostream>
+#include <cstdlib>
+#include <immintrin.h>
+
+using namespace std;
+
+/** Builds the cumulative index of <em>spectrum</em>, one pass over all bins of all pixels.
+	@param spectrum the spectrum to index, it is not needed by the index afterwards
+*/
+void CumulativeSpectrum::build(const SpectrumMatrix& spectrum) {
+	cumulative.resize(spectrum.pixels(), spectrum.bins() + 1);
+
+	for(int i = 0; i < spectrum.pixels(); i++) {
+		PixelRow<const int> counts = spectrum.row(i);
+		PixelRow<long long> row = cumulative.row(i);
+		long long acc_counts = 0;
+		row[0] = 0;
+		for(int k = 0; k < counts.size(); k++) {
+			acc_counts += counts[k];
+			row[k+1] = acc_counts;
+		}
+	}
+}
+
+/** Builds the sparse index of <em>spectrum</em>: one pass to count the non-empty bins of every pixel, and one to store them.
+	@param spectrum the spectrum to index, it is not needed by the index afterwards
+*/
+void SparseSpectrum::build(const SpectrumMatrix& spectrum) {
+	nbr_bins = spectrum.bins();
+	row_start.assign(spectrum.pixels() + 1, 0);
+	for(int i = 0; i < spectrum.pixels(); i++) {
+		PixelRow<const int> counts = spectrum.row(i);
+		size_t nonzeros = 0;
+		for(int k = 0; k < counts.size(); k++) nonzeros += (counts[k] != 0);
+		row_start[i+1] = row_start[i] + nonzeros;
+	}
+
+	nonzero_bins.resize(row_start.back());
+	cumulative.resize(row_start.back());
+	for(int i = 0; i < spectrum.pixels(); i++) {
+		PixelRow<const int> counts = spectrum.row(i);
+		size_t j = row_start[i];
+		long long acc_counts = 0;
+		for(int k = 0; k < counts.size(); k++) {
+			if(counts[k] == 0) continue;
+			acc_counts += counts[k];
+			nonzero_bins[j] = k;
+			cumulative[j] = acc_counts;
+			j++;
+		}
+	}
+}
+
+/** The sum of the counts of <em>pixel</em> in the bins below <em>bin</em>: the cumulative count of the last non-empty bin below it. */
+long long SparseSpectrum::counts_below(int pixel, int bin) const {
+	const int* first = nonzero_bins.data() + row_start[pixel];
+	const int* last = nonzero_bins.data() + row_start[pixel+1];
+	const int* above = lower_bound(first, last, bin);
+	return above == first ? 0 : cumulative[above - nonzero_bins.data() - 1];
+}
+
+/** The counts in a window, see SpectrumIndex::window_sum(). */
+long long SparseSpectrum::window_sum(int pixel, int lower, int upper) const {
+	if(lower < 0) lower = 0;
+	if(upper > nbr_bins) upper = nbr_bins;
+	if(upper <= lower) return 0;
+	return counts_below(pixel, upper) - counts_below(pixel, lower);
+}
+
+namespace {
+
+/** The sum of the first <em>n</em> bytes of a block of CompressedSpectrum. */
+long long sum_bytes_scalar(const uint8_t* bytes, int n) {
+	long long sum = 0;
+	for(int k = 0; k < n; k++) sum += bytes[k];
+	return sum;
+}
+
+const uint8_t byte_numbers[CompressedSpectrum::block_bins] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+	32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63};
+
+/** The same sum as sum_bytes_scalar(), from the whole block of 64 bytes: the bytes from <em>n</em> on are masked out, and the rest are summed in groups of eight with <tt>vpsadbw</tt>. */
+__attribute__((target("avx2")))
+long long sum_bytes_avx2(const uint8_t* bytes, int n) {
+	const __m256i limit = _mm256_set1_epi8((char)n);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i low = _mm256_loadu_si256((const __m256i*)bytes);
+	__m256i high = _mm256_loadu_si256((const __m256i*)(bytes + 32));
+	low = _mm256_and_si256(low, _mm256_cmpgt_epi8(limit, _mm256_loadu_si256((const __m256i*)byte_numbers)));
+	high = _mm256_and_si256(high, _mm256_cmpgt_epi8(limit, _mm256_loadu_si256((const __m256i*)(byte_numbers + 32))));
+	__m256i sums = _mm256_add_epi64(_mm256_sad_epu8(low, zero), _mm256_sad_epu8(high, zero));
+	__m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+	return _mm_cvtsi128_si64(half) + _mm_extract_epi64(half, 1);
+}
+
+}
+
+CompressedSpectrum::CompressedSpectrum() : nbr_pixels(0), nbr_bins(0), blocks_per_pixel(0), sum_bytes(sum_bytes_scalar) {}
+
+CompressedSpectrum::CompressedSpectrum(const SpectrumMatrix& spectrum) {
+	build(spectrum);
+}
+
+/** Builds the compressed index of <em>spectrum</em>: one pass to choose the width of every block, and one to store the counts.
+	@param spectrum the spectrum to index, it is not needed by the index afterwards
+*/
+void CompressedSpectrum::build(const SpectrumMatrix& spectrum) {
+	nbr_pixels = spectrum.pixels();
+	nbr_bins = spectrum.bins();
+	blocks_per_pixel = (nbr_bins + block_bins - 1)/block_bins;
+	sum_bytes = simd_level() >= SIMD_AVX2 ? sum_bytes_avx2 : sum_bytes_scalar;
+	blocks.resize((size_t)nbr_pixels*(blocks_per_pixel + 1));
+
+	size_t payload_bytes = 0, nbr_escapes = 0;
+	for(int i = 0; i < nbr_pixels; i++) {
+		PixelRow<const int> counts = spectrum.row(i);
+		Block* block = &blocks[(size_t)i*(blocks_per_pixel + 1)];
+		long long below = 0;
+		for(int b = 0; b < blocks_per_pixel; b++) {
+			int first = b*block_bins, last = min(first + block_bins, nbr_bins);
+			int smallest = 0, largest = 0, large = 0;
+			for(int k = first; k < last; k++) {
+				smallest = min(smallest, counts[k]);
+				largest = max(largest, counts[k]);
+				large += (counts[k] > 255);
+				below += counts[k];
+			}
+			if(smallest < 0) block[b].width = 4;
+			else if(largest == 0) block[b].width = 0;
+			else if(large <= max_escapes) block[b].width = 1;
+			else if(largest <= 65535) block[b].width = 2;
+			else block[b].width = 4;
+
+			block[b].offset = payload_bytes;
+			block[b].first_escape = nbr_escapes;
+			payload_bytes += (size_t)block[b].width*block_bins;
+			if(block[b].width == 1) nbr_escapes += large;
+			block[b + 1].below = below;
+		}
+		block[0].below = 0;
+		block[blocks_per_pixel].offset = payload_bytes;
+		block[blocks_per_pixel].first_escape = nbr_escapes;
+		block[blocks_per_pixel].width = 0;
+	}
+
+	payload.assign(payload_bytes, 0);
+	escapes.resize(nbr_escapes);
+	for(int i = 0; i < nbr_pixels; i++) {
+		PixelRow<const int> counts = spectrum.row(i);
+		const Block* block = &blocks[(size_t)i*(blocks_per_pixel + 1)];
+		for(int b = 0; b < blocks_per_pixel; b++) {
+			int first = b*block_bins, last = min(first + block_bins, nbr_bins);
+			uint8_t* bytes = payload.data() + block[b].offset;
+			size_t escape = block[b].first_escape;
+			for(int k = first; k < last; k++) {
+				switch(block[b].width) {
+					case 1 :
+						bytes[k - first] = min(counts[k], 255);
+						if(counts[k] > 255) {
+							escapes[escape].bin = k - first;
+							escapes[escape].excess = counts[k] - 255;
+							escape++;
+						}
+						break;
+					case 2 :
+						((uint16_t*)bytes)[k - first] = counts[k];
+						break;
+					case 4 :
+						((int32_t*)bytes)[k - first] = counts[k];
+						break;
+				}
+			}
+		}
+	}
+}
+
+/** The sum of the counts of <em>pixel</em> in the bins below <em>bin</em>: the counts below its block and those of the bins of the block before it. */
+long long CompressedSpectrum::counts_below(int pixel, int bin) const {
+	const Block& block = blocks[(size_t)pixel*(blocks_per_pixel + 1) + bin/block_bins];
+	int n = bin%block_bins;
+	if(n == 0 || block.width == 0) return block.below;
+
+	const uint8_t* bytes = payload.data() + block.offset;
+	long long sum = block.below;
+	switch(block.width) {
+		case 1 :
+			sum += sum_bytes(bytes, n);
+			for(uint32_t e = block.first_escape; e < (&block + 1)->first_escape && escapes[e].bin < n; e++) sum += escapes[e].excess;
+			break;
+		case 2 :
+			for(int k = 0; k < n; k++) sum += ((const uint16_t*)bytes)[k];
+			break;
+		default :
+			for(int k = 0; k < n; k++) sum += ((const int32_t*)bytes)[k];
+	}
+	return sum;
+}
+
+/** The counts in a window, see SpectrumIndex::window_sum(). */
+long long CompressedSpectrum::window_sum(int pixel, int lower, int upper) const {
+	if(lower < 0) lower = 0;
+	if(upper > nbr_bins) upper = nbr_bins;
+	if(upper <= lower) return 0;
+	return counts_below(pixel, upper) - counts_below(pixel, lower);
+}
+
+/** The count of <em>pixel</em> in <em>bin</em>, decoded with the width of its block. A byte of 255 in an 8-bit block may be the first part of a larger count, whose rest is then found among the escapes of the block.
+	@return the count, 0 for a bin outside the spectrum
+*/
+int CompressedSpectrum::count(int pixel, int bin) const {
+	if(bin < 0 || bin >= nbr_bins) return 0;
+	const Block& block = blocks[(size_t)pixel*(blocks_per_pixel + 1) + bin/block_bins];
+	int k = bin%block_bins;
+	const uint8_t* bytes = payload.data() + block.offset;
+	switch(block.width) {
+		case 0 :
+			return 0;
+		case 1 :
+			if(bytes[k] == 255) {
+				for(uint32_t e = block.first_escape; e < (&block + 1)->first_escape; e++) {
+					if(escapes[e].bin == k) return 255 + escapes[e].excess;
+				}
+			}
+			return bytes[k];
+		case 2 :
+			return ((const uint16_t*)bytes)[k];
+		default :
+			return ((const int32_t*)bytes)[k];
+	}
+}
+
+vector<size_t> CompressedSpectrum::blocks_of_width() const {
+	vector<size_t> nbr_blocks(5, 0);
+	for(int i = 0; i < nbr_pixels; i++) {
+		const Block* block = &blocks[(size_t)i*(blocks_per_pixel + 1)];
+		for(int b = 0; b < blocks_per_pixel; b++) nbr_blocks[block[b].width]++;
+	}
+	return nbr_blocks;
+}
+
+/** The fraction of the bins of <em>spectrum</em> which have counts. */
+double spectrum_density(const SpectrumMatrix& spectrum) {
+	if(spectrum.size() == 0) return 0;
+	size_t nonzeros = 0;
+	for(size_t i = 0; i < spectrum.size(); i++) nonzeros += (spectrum.data()[i] != 0);
+	return (double)nonzeros/spectrum.size();
+}
+
+/** The density below which make_spectrum_index() chooses the sparse index: the value of the environment variable RANDOMCHAINS_SPARSE_DENSITY if it is set, otherwise 0.25. At this density the sparse index needs less than half the memory of the cumulative index, while a window sum still takes only a few hundred nanoseconds. 0 always gives the cumulative index and a value above 1 always the sparse one. */
+double sparse_density_threshold() {
+	const char* variable = getenv("RANDOMCHAINS_SPARSE_DENSITY");
+	return variable ? atof(variable) : 0.25;
+}
+
+/** True if the environment variable RANDOMCHAINS_COMPRESSED_INDEX is set to a value other than 0, then make_spectrum_index() chooses the CompressedSpectrum instead of the CumulativeSpectrum for the spectra which are not sparse. */
+bool compressed_spectrum_indices() {
+	const char* variable = getenv("RANDOMCHAINS_COMPRESSED_INDEX");
+	return variable && atoi(variable) != 0;
+}
+
+/** The index of <em>spectrum</em> which fits its density: a SparseSpectrum if less than <em>sparse_threshold</em> of the bins have counts, otherwise a CompressedSpectrum if <em>compressed</em> and a CumulativeSpectrum if not. All give the same window sums.
+	@param spectrum the spectrum to index
+	@param sparse_threshold the largest density of the sparse index, see sparse_density_threshold()
+	@param compressed trade some speed of the window sums for memory, see compressed_spectrum_indices()
+*/
+shared_ptr<const SpectrumIndex> make_spectrum_index(const SpectrumMatrix& spectrum, double sparse_threshold, bool compressed) {
+	if(spectrum_density(spectrum) < sparse_threshold) return make_shared<SparseSpectrum>(spectrum);
+	if(compressed) return make_shared<CompressedSpectrum>(spectrum);
+	return make_shared<CumulativeSpectrum>(spectrum);
+}
+
+/** Sets up the index for the windows with the limits <em>window_limits</em>, all sums are zero.
+	@param pixels number of pixels
+	@param bins number of bins per pixel
+	@param window_limits the lower and upper limits of all windows which will be queried, in any order and with repetitions
+*/
+WindowSumSpectrum::WindowSumSpectrum(int pixels, int bins, const vector<int>& window_limits) : nbr_bins(bins) {
+	for(unsigned int i = 0; i < window_limits.size(); i++) {
+		boundaries.push_back(min(max(window_limits[i], 0), bins));
+	}
+	sort(boundaries.begin(), boundaries.end());
+	boundaries.erase(unique(boundaries.begin(), boundaries.end()), boundaries.end());
+
+	segment_of_bin.resize(bins);
+	for(int k = 0; k < bins; k++) {
+		segment_of_bin[k] = upper_bound(boundaries.begin(), boundaries.end(), k) - boundaries.begin();
+	}
+	column_of_bin.assign(bins + 1, -1);
+	for(unsigned int j = 0; j < boundaries.size(); j++) column_of_bin[boundaries[j]] = j;
+
+	sums.resize(pixels, boundaries.size() + 1);
+}
+
+/** A receiver for the <em>nbr_values</em> values of a spectrum file starting with value number <em>first_value</em>. Receivers of disjoint pixel ranges can be used from different threads. */
+WindowSumSpectrum::Accumulator WindowSumSpectrum::accumulator(size_t first_value, size_t nbr_values) {
+	size_t pixel = first_value/nbr_bins;
+	int bin = first_value%nbr_bins;
+	size_t available = size() - first_value;
+	return Accumulator(sums.data() + pixel*sums.bins(), segment_of_bin.data(), sums.bins(), nbr_bins, bin, min(nbr_values, available));
+}
+
+/** Adds all counts of <em>spectrum</em>, e.g. a spectrum mapped from its cache file. */
+void WindowSumSpectrum::accumulate(const SpectrumMatrix& spectrum) {
+	Accumulator add = accumulator(0, spectrum.size());
+	for(size_t i = 0; i < spectrum.size(); i++) add(spectrum.data()[i]);
+}
+
+/** Turns the segment sums into cumulative counts at the boundaries. Must be called once, after all counts have been added. */
+void WindowSumSpectrum::finish() {
+	for(int i = 0; i < sums.pixels(); i++) {
+		PixelRow<long long> row = sums.row(i);
+		for(int j = 1; j < row.size(); j++) row[j] += row[j-1];
+	}
+}
+
+/** Sets all sums to zero, e.g. before a spectrum file is read in again. */
+void WindowSumSpectrum::clear() {
+	sums.fill(0);
+}
+
+bool WindowSumSpectrum::has_limit(int bin) const {
+	return column_of_bin[min(max(bin, 0), nbr_bins)] >= 0;
+}
+
+/** The counts in a window, see SpectrumIndex::window_sum(). Both limits must have been given to the constructor, otherwise the program is aborted. */
+long long WindowSumSpectrum::window_sum(int pixel, int lower, int upper) const {
+	lower = max(lower, 0);
+	upper = min(upper, nbr_bins);
+	if(upper <= lower) return 0;
+
+	int lower_column = column_of_bin[lower], upper_column = column_of_bin[upper];
+	if(lower_column < 0 || upper_column < 0) {
+		cout << "The window [" << lower << ", " << upper << ") was not known when the spectrum was read in!" << endl;
+		abort();
+	}
+
+	//The cumulative count at boundary j is the sum of the segments 0 to j
+	PixelRow<const long long> row = sums.row(pixel);
+	return row[upper_column] - row[lower_column];
+}
@@ -0,0 +1,196 @@
+/** @file SpectrumIndex.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Indices over the spectra for fast energy window sums
+*/
+#ifndef SPECTRUMINDEX_H
+#define SPECTRUMINDEX_H
+
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include "SpectrumMatrix.h"
+
+/** Interface of the indices over a spectrum.
+The compute path only needs the counts of a pixel in a few bin windows. An index answers these queries without the spectrum itself, and the different indices trade memory for the windows they can answer.
+*/
+class SpectrumIndex {
+	public:
+		virtual ~SpectrumIndex() {}
+
+		/** The sum of the counts of <em>pixel</em> in the bins <tt>lower</tt> <= <tt>E</tt> < <tt>upper</tt>.
+		The window is clipped to the spectrum, an empty or inverted window gives 0.
+		*/
+		virtual long long window_sum(int pixel, int lower, int upper) const = 0;
+
+		virtual int pixels() const = 0;
+		virtual int bins() const = 0;
+		virtual size_t memory_bytes() const = 0;
+};
+
+/** Per-pixel cumulative (prefix-sum) index of a spectrum.
+For every pixel the index stores <em>C[b]</em> = the sum of the counts in the bins <em>0</em> to <em>b-1</em>, i.e. <em>bins+1</em> values per pixel. The counts in the bin window <tt>[lower, upper)</tt> of a pixel are then given by one subtraction, <em>C[upper] - C[lower]</em>, independent of the width of the window. The sums are accumulated in 64 bits so that long campaigns can not overflow them.
+*/
+class CumulativeSpectrum final : public SpectrumIndex {
+	private:
+		PixelMatrix<long long> cumulative;
+
+	public:
+		CumulativeSpectrum() {}
+		explicit CumulativeSpectrum(const SpectrumMatrix& spectrum) { build(spectrum); }
+
+		void build(const SpectrumMatrix& spectrum);
+
+		long long window_sum(int pixel, int lower, int upper) const override {
+			if(lower < 0) lower = 0;
+			if(upper > bins()) upper = bins();
+			if(upper <= lower) return 0;
+			PixelRow<const long long> row = cumulative.row(pixel);
+			return row[upper] - row[lower];
+		}
+
+		int pixels() const override { return cumulative.pixels(); }
+		int bins() const override { return cumulative.bins() - 1; }
+		size_t memory_bytes() const override { return cumulative.size()*sizeof(long long); }
+};
+
+/** Sparse (CSR) cumulative index of a spectrum, for spectra in which most bins are empty.
+Only the bins with counts are stored: for every pixel the sorted numbers of its non-empty bins and, for each of them, the sum of the counts up to and including that bin. The counts below a bin limit are found by a binary search among the non-empty bins of the pixel, so a window sum costs two searches instead of one subtraction. A non-empty bin takes 12 bytes instead of the 8 bytes per bin of CumulativeSpectrum, so the index is smaller if less than about two thirds of the bins have counts, see make_spectrum_index().
+*/
+class SparseSpectrum final : public SpectrumIndex {
+	private:
+		int nbr_bins;
+		//The non-empty bins of pixel p are row_start[p] to row_start[p+1]-1
+		std::vector<size_t> row_start;
+		std::vector<int> nonzero_bins;
+		std::vector<long long> cumulative;
+
+		long long counts_below(int pixel, int bin) const;
+
+	public:
+		SparseSpectrum() : nbr_bins(0), row_start(1, 0) {}
+		explicit SparseSpectrum(const SpectrumMatrix& spectrum) { build(spectrum); }
+
+		void build(const SpectrumMatrix& spectrum);
+
+		long long window_sum(int pixel, int lower, int upper) const override;
+		int pixels() const override { return (int)row_start.size() - 1; }
+		int bins() const override { return nbr_bins; }
+		size_t memory_bytes() const override { return row_start.size()*sizeof(size_t) + nonzero_bins.size()*(sizeof(int) + sizeof(long long)); }
+		size_t nonzeros() const { return nonzero_bins.size(); }
+};
+
+/** Cumulative index over a spectrum stored with adaptive-width counts.
+The bins of every pixel are split into blocks of 64 bins. For every block the cumulative count below it is kept, and its counts are stored with the smallest width which holds them: a block without counts takes no space at all, and the others take 8, 16 or 32 bits per bin. Runs of empty bins are thus only left out when they fill a whole block, there is no run-length or delta coding within a block, so that the counts of a block can be summed directly from its bytes. A block of small counts with a few counts of 255 or more, as at the top of a peak, stays at 8 bits: the byte of such a bin holds 255 and the rest of its count is kept in a table of escapes of the block.
+
+The counts below a bin limit are the cumulative count of its block plus the counts of the bins in the block before it. For 8-bit blocks these are summed 32 bytes at a time with AVX2 if the processor has it, see simd_level(). A window sum thus costs two partial block sums instead of one subtraction, while the index takes little more than a byte per bin instead of the 8 bytes of CumulativeSpectrum.
+*/
+class CompressedSpectrum final : public SpectrumIndex {
+	public:
+		static const int block_bins = 64;
+		//At most this many escapes per block, otherwise the block is stored with 16 bits
+		static const int max_escapes = 4;
+
+	private:
+		struct Block {
+			long long below;		//The counts of the pixel below the block
+			size_t offset;			//The first byte of the counts in CompressedSpectrum::payload
+			uint32_t first_escape;	//The escapes of the block are first_escape up to the first_escape of the next block
+			uint8_t width;			//Bytes per count: 0, 1, 2 or 4
+		};
+
+		struct Escape {
+			int bin;		//Within the block
+			int excess;		//The count minus 255
+		};
+
+		int nbr_pixels;
+		int nbr_bins;
+		int blocks_per_pixel;
+		//blocks_per_pixel + 1 blocks per pixel, the last one holds the total counts of the pixel
+		std::vector<Block> blocks;
+		std::vector<Escape> escapes;
+		std::vector<uint8_t> payload;
+		long long (*sum_bytes)(const uint8_t* bytes, int n);
+
+		long long counts_below(int pixel, int bin) const;
+
+	public:
+		CompressedSpectrum();
+		explicit CompressedSpectrum(const SpectrumMatrix& spectrum);
+
+		void build(const SpectrumMatrix& spectrum);
+
+		long long window_sum(int pixel, int lower, int upper) const override;
+		int count(int pixel, int bin) const;
+		int pixels() const override { return nbr_pixels; }
+		int bins() const override { return nbr_bins; }
+		size_t memory_bytes() const override { return blocks.size()*sizeof(Block) + escapes.size()*sizeof(Escape) + payload.size(); }
+		//The number of blocks stored with each width, indexed by the width in bytes
+		std::vector<size_t> blocks_of_width() const;
+};
+
+double spectrum_density(const SpectrumMatrix& spectrum);
+
+double sparse_density_threshold();
+
+bool compressed_spectrum_indices();
+
+std::shared_ptr<const SpectrumIndex> make_spectrum_index(const SpectrumMatrix& spectrum, double sparse_threshold, bool compressed = false);
+
+/** Index which only holds the sums of a few bin windows known in advance.
+The limits of all windows are sorted into <em>n</em> boundaries, which split the bins into <em>n+1</em> segments. While a spectrum is read in, every count is added to the sum of its segment, and finish() turns the segment sums into the cumulative counts at the boundaries. Only window limits which are boundaries can be queried, but the memory needed is <em>pixels x (n+1)</em> instead of <em>pixels x bins</em>, and the spectrum itself never has to be stored.
+*/
+class WindowSumSpectrum final : public SpectrumIndex {
+	private:
+		int nbr_bins;
+		std::vector<int> boundaries;
+		//The segment of every bin, and the boundary index of every bin which is a boundary (otherwise -1)
+		std::vector<int> segment_of_bin;
+		std::vector<int> column_of_bin;
+		PixelMatrix<long long> sums;
+
+	public:
+		WindowSumSpectrum(int pixels, int bins, const std::vector<int>& window_limits);
+
+		/** Receiver for parse_csv() of a consecutive range of values of a spectrum file, starting at a pixel boundary. */
+		class Accumulator {
+			private:
+				long long* row;
+				const int* segment_of_bin;
+				int nbr_segments;
+				int nbr_bins;
+				int bin;
+				size_t remaining;
+
+			public:
+				Accumulator(long long* first_row, const int* segments, int segments_per_pixel, int bins, int first_bin, size_t nbr_values) :
+					row(first_row), segment_of_bin(segments), nbr_segments(segments_per_pixel), nbr_bins(bins), bin(first_bin), remaining(nbr_values) {}
+
+				bool operator()(int value) {
+					if(remaining == 0) return false;
+					remaining--;
+					row[segment_of_bin[bin]] += value;
+					if(++bin == nbr_bins) {
+						bin = 0;
+						row += nbr_segments;
+					}
+					return true;
+				}
+		};
+
+		Accumulator accumulator(size_t first_value, size_t nbr_values);
+		void accumulate(const SpectrumMatrix& spectrum);
+		void finish();
+		void clear();
+
+		/** True if <em>bin</em> is a window limit of the index, after clipping to the spectrum. */
+		bool has_limit(int bin) const;
+
+		long long window_sum(int pixel, int lower, int upper) const override;
+		int pixels() const override { return sums.pixels(); }
+		int bins() const override { return nbr_bins; }
+		size_t memory_bytes() const override { return sums.size()*sizeof(long long); }
+		size_t size() const { return (size_t)sums.pixels()*nbr_bins; }
+};
+
+#endif
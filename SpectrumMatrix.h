@@ -0,0 +1,160 @@
+/** @file SpectrumMatrix.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Contiguous pixel-major storage for the spectra of the implantation detector
+*/
+#ifndef SPECTRUMMATRIX_H
+#define SPECTRUMMATRIX_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <memory>
+
+/** A typed view of one pixel row in a PixelMatrix.
+The view does not own any memory, it is only valid as long as the matrix it was taken from is alive and not resized.
+*/
+template <typename T>
+class PixelRow {
+	private:
+		T* first;
+		int nbr_bins;
+
+	public:
+		PixelRow(T* row_data, int bins) : first(row_data), nbr_bins(bins) {}
+
+		//A mutable row view converts to a read-only one
+		template <typename U>
+		PixelRow(const PixelRow<U>& other) : first(other.data()), nbr_bins(other.size()) {}
+
+		T& operator[](int bin) const { return first[bin]; }
+		int size() const { return nbr_bins; }
+		T* data() const { return first; }
+		T* begin() const { return first; }
+		T* end() const { return first + nbr_bins; }
+};
+
+/** A pixel-major matrix stored in one contiguous, cache line aligned block.
+Bin <em>b</em> of pixel <em>p</em> is found at <tt>data()[p*bins() + b]</tt>. Compared to a <tt>vector< vector<T> ></tt> every pixel row is directly adjacent to the next one, which gives a single allocation and lets the hardware prefetcher stream through the per-pixel window loops.
+
+The values can also live in memory owned by another object, e.g. a memory mapped cache file, see adopt(). Such a matrix is read-only until it is resized.
+*/
+template <typename T>
+class PixelMatrix {
+	private:
+		T* values;
+		int nbr_pixels;
+		int nbr_bins;
+
+		//Keeps memory which is not owned by the matrix alive, empty if the matrix owns its values
+		std::shared_ptr<const void> owner;
+
+		void release() {
+			if(!owner) free(values);
+			owner.reset();
+			values = NULL;
+		}
+
+		static T* allocate(size_t count) {
+			if(count == 0) return NULL;
+			void* mem = NULL;
+			if(posix_memalign(&mem, alignment, count*sizeof(T)) != 0) throw std::bad_alloc();
+			return static_cast<T*>(mem);
+		}
+
+	public:
+		//Alignment in bytes of the first element (one cache line)
+		static const size_t alignment = 64;
+
+		PixelMatrix() : values(NULL), nbr_pixels(0), nbr_bins(0) {}
+
+		PixelMatrix(int pixels, int bins) : values(NULL), nbr_pixels(0), nbr_bins(0) {
+			resize(pixels, bins);
+		}
+
+		PixelMatrix(const PixelMatrix& other) : values(NULL), nbr_pixels(0), nbr_bins(0) {
+			*this = other;
+		}
+
+		PixelMatrix(PixelMatrix&& other) : values(other.values), nbr_pixels(other.nbr_pixels), nbr_bins(other.nbr_bins), owner(std::move(other.owner)) {
+			other.owner.reset();
+			other.values = NULL;
+			other.nbr_pixels = 0;
+			other.nbr_bins = 0;
+		}
+
+		PixelMatrix& operator=(const PixelMatrix& other) {
+			if(this == &other) return *this;
+			T* copy = allocate(other.size());
+			if(other.size() > 0) memcpy(copy, other.values, other.size()*sizeof(T));
+			release();
+			values = copy;
+			nbr_pixels = other.nbr_pixels;
+			nbr_bins = other.nbr_bins;
+			return *this;
+		}
+
+		PixelMatrix& operator=(PixelMatrix&& other) {
+			if(this == &other) return *this;
+			release();
+			values = other.values;
+			nbr_pixels = other.nbr_pixels;
+			nbr_bins = other.nbr_bins;
+			owner = std::move(other.owner);
+			other.owner.reset();
+			other.values = NULL;
+			other.nbr_pixels = 0;
+			other.nbr_bins = 0;
+			return *this;
+		}
+
+		~PixelMatrix() { release(); }
+
+		/** Reallocates the matrix to <em>pixels</em> x <em>bins</em>, all values are set to zero. */
+		void resize(int pixels, int bins) {
+			size_t count = (size_t)pixels*bins;
+			if(count != size() || owner) {
+				release();
+				values = allocate(count);
+			}
+			nbr_pixels = pixels;
+			nbr_bins = bins;
+			fill(T());
+		}
+
+		/** Lets the matrix read its values from memory it does not own.
+			@param external the first value, pixel-major as in an owned matrix
+			@param pixels number of pixels
+			@param bins number of bins per pixel
+			@param keep_alive the object which owns <em>external</em>, it is kept alive as long as the matrix uses it
+		*/
+		void adopt(const T* external, int pixels, int bins, std::shared_ptr<const void> keep_alive) {
+			release();
+			values = const_cast<T*>(external);
+			nbr_pixels = pixels;
+			nbr_bins = bins;
+			owner = keep_alive;
+		}
+
+		void fill(const T& value) {
+			for(size_t i = 0; i < size(); i++) values[i] = value;
+		}
+
+		PixelRow<T> row(int pixel) { return PixelRow<T>(values + (size_t)pixel*nbr_bins, nbr_bins); }
+		PixelRow<const T> row(int pixel) const { return PixelRow<const T>(values + (size_t)pixel*nbr_bins, nbr_bins); }
+
+		PixelRow<T> operator[](int pixel) { return row(pixel); }
+		PixelRow<const T> operator[](int pixel) const { return row(pixel); }
+
+		T* data() { return values; }
+		const T* data() const { return values; }
+
+		int pixels() const { return nbr_pixels; }
+		int bins() const { return nbr_bins; }
+		size_t size() const { return (size_t)nbr_pixels*nbr_bins; }
+};
+
+//The spectra are histograms of counts per pixel and bin
+typedef PixelMatrix<int> SpectrumMatrix;
+
+#endif
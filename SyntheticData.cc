@@ -0,0 +1,250 @@
+/** @file SyntheticData.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Implementation of the synthetic data folders declared in SyntheticData.h
+*/
+#include "SyntheticData.h"
+#include "SpectrumCache.h"
+#include "MonteCarlo.h"
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace {
+
+const int nbr_spectra = 3;
+const char* spectrum_files[nbr_spectra] = {"beam_on.csv", "rec_beam_on.csv", "rec_beam_off.csv"};
+
+//The counter of the random words of the fissions and of the hot pixels, in the place of the spectrum
+const uint32_t fission_counter = nbr_spectra;
+const uint32_t hot_counter = nbr_spectra + 1;
+
+//About 4 MB of counts per chunk of pixels
+const size_t values_per_chunk = 1 << 20;
+
+/** A Poisson distributed count from two random words: by inversion of the distribution for small means, otherwise from the normal approximation. */
+int poisson_count(double mean, double exp_minus_mean, uint32_t word1, uint32_t word2) {
+	if(mean <= 0) return 0;
+	if(mean < 30) {
+		double u = (word1 + 0.5)*(1.0/4294967296.0);
+		int count = 0;
+		double probability = exp_minus_mean, cumulative = probability;
+		while(u > cumulative && probability > 0) {
+			count++;
+			probability *= mean/count;
+			cumulative += probability;
+		}
+		return count;
+	}
+	double u1 = (word1 + 1.0)*(1.0/4294967296.0);
+	double u2 = word2*(1.0/4294967296.0);
+	double normal = sqrt(-2*log(u1))*cos(2*M_PI*u2);
+	return max(0L, lround(mean + sqrt(mean)*normal));
+}
+
+char* write_count(char* p, int value) {
+	char digits[12];
+	int nbr_digits = 0;
+	do {
+		digits[nbr_digits++] = '0' + value%10;
+		value /= 10;
+	} while(value > 0);
+	while(nbr_digits > 0) *p++ = digits[--nbr_digits];
+	return p;
+}
+
+//The counts of a chunk of pixels, their checksum and their text in the ".csv" file
+struct Chunk {
+	vector<int> counts;
+	SpectrumChecksum checksum;
+	string text;
+};
+
+double seconds_since(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+}
+
+/** A detector with the size of the Lund data, 1024 pixels x 4096 bins, about 1 count per bin and 1 % hot pixels. */
+SyntheticDetector::SyntheticDetector() : pixels(1024), bins(4096), seed(1), background_mean(0.5), escape_mean(2), alpha_mean(5), implant_mean(1), beam_off_factor(0.5), hot_fraction(0.01), hot_factor(10), fissions_per_pixel(2) {
+}
+
+/** The mean count of a bin of a spectrum.
+	@param spectrum 0 for beam_on.csv, 1 for rec_beam_on.csv, 2 for rec_beam_off.csv
+	@param bin the bin
+	@param hot true for a hot pixel
+*/
+double SyntheticDetector::mean_count(int spectrum, int bin, bool hot) const {
+	//The bin in the binning of the Lund data
+	double x = bin*4096.0/bins;
+	double decays = background_mean + alpha_mean*exp(-0.5*(x - 1000)*(x - 1000)/(50.0*50.0));
+	if(x < 400) decays += escape_mean;
+	if(spectrum == 2) decays *= beam_off_factor;
+	double implants = (spectrum < 2 && x >= 1100 && x < 1800) ? implant_mean : 0;
+	return (decays + implants)*(hot ? hot_factor : 1);
+}
+
+/** True if <em>pixel</em> is a hot spot, which is decided by the seed. */
+bool SyntheticDetector::hot_pixel(int pixel) const {
+	Philox4x32 generator(seed);
+	uint32_t counter[4] = {(uint32_t)pixel, 0, hot_counter, 0};
+	uint32_t words[4];
+	generator(counter, words);
+	return Philox4x32::uniform(words[0], words[1]) <= hot_fraction;
+}
+
+/** Writes the spectra and the fissions of a synthetic detector to a data folder, which can be read in by RandomChains.
+The counts are drawn from a counter-based generator, see Philox4x32: the counts of a bin only depend on the seed, the spectrum, the pixel and the bin. The pixels are generated in chunks of about 10^6 counts by the threads of <em>pool</em>, and written in order, so the files are the same for any number of threads and only a few chunks per thread are kept in memory.
+
+In the ".csv" files every pixel is written on a line of its own. With SYNTHETIC_BINARY alone the binary cache files are written without ".csv" files, as standalone caches (see SpectrumCacheHeader), which is much faster and smaller for fixtures of many GB. "pixels_with_fissions.csv" is always written.
+	@param folder the data folder, which is created if it does not exist
+	@param detector the size, seed and means of the detector
+	@param format the files to write, see SyntheticFormat
+	@param pool the threads which generate the counts
+	@param log the progress and the errors are written here
+	@return false if a file could not be written
+*/
+bool write_synthetic_data_folder(const string& folder, const SyntheticDetector& detector, int format, ThreadPool& pool, ostream& log) {
+	const int pixels = detector.pixels;
+	const int bins = detector.bins;
+	const Philox4x32 generator(detector.seed);
+	mkdir(folder.c_str(), 0755);
+
+	vector<char> hot(pixels);
+	for(int i = 0; i < pixels; i++) hot[i] = detector.hot_pixel(i);
+
+	const int chunk_pixels = max((size_t)1, values_per_chunk/bins);
+	const int batch_chunks = 2*pool.size();
+
+	for(int s = 0; s < nbr_spectra; s++) {
+		auto start = chrono::steady_clock::now();
+		string csv_path = folder + "/" + spectrum_files[s];
+
+		//The means and the probabilities of no count of every bin, in a normal and in a hot pixel
+		vector<double> mean[2], exp_minus_mean[2];
+		for(int h = 0; h < 2; h++) {
+			mean[h].resize(bins);
+			exp_minus_mean[h].resize(bins);
+			for(int k = 0; k < bins; k++) {
+				mean[h][k] = detector.mean_count(s, k, h == 1);
+				exp_minus_mean[h][k] = exp(-mean[h][k]);
+			}
+		}
+
+		FILE* csv = NULL;
+		if(format & SYNTHETIC_CSV) {
+			csv = fopen(csv_path.c_str(), "wb");
+			if(!csv) {
+				log << "Could not write " << csv_path << endl;
+				return false;
+			}
+		}
+		SpectrumCacheWriter cache;
+		if((format & SYNTHETIC_BINARY) && !cache.open(csv_path, pixels, bins)) {
+			log << "Could not write " << spectrum_cache_path(csv_path) << endl;
+			if(csv) fclose(csv);
+			return false;
+		}
+
+		bool ok = true;
+		vector<Chunk> chunks(batch_chunks);
+		for(int batch_first = 0; batch_first < pixels; batch_first += batch_chunks*chunk_pixels) {
+			pool.parallel_for(0, batch_chunks, 1, [&](int first_chunk, int last_chunk, int) {
+				for(int c = first_chunk; c < last_chunk; c++) {
+					Chunk& chunk = chunks[c];
+					int first_pixel = min(pixels, batch_first + c*chunk_pixels);
+					int last_pixel = min(pixels, first_pixel + chunk_pixels);
+					size_t nbr_values = (size_t)(last_pixel - first_pixel)*bins;
+					chunk.counts.resize(nbr_values);
+					chunk.text.resize(format & SYNTHETIC_CSV ? nbr_values*12 : 0);
+					char* text = &chunk.text[0];
+
+					for(int i = first_pixel; i < last_pixel; i++) {
+						int* counts = &chunk.counts[(size_t)(i - first_pixel)*bins];
+						const double* pixel_mean = mean[(int)hot[i]].data();
+						const double* pixel_exp = exp_minus_mean[(int)hot[i]].data();
+						uint32_t words[4];
+						for(int k = 0; k < bins; k++) {
+							//Two words per bin, four per call of the generator
+							if(k%2 == 0) {
+								uint32_t counter[4] = {(uint32_t)k/2, (uint32_t)i, (uint32_t)s, 0};
+								generator(counter, words);
+							}
+							counts[k] = poisson_count(pixel_mean[k], pixel_exp[k], words[2*(k%2)], words[2*(k%2) + 1]);
+						}
+
+						if(format & SYNTHETIC_CSV) {
+							for(int k = 0; k < bins; k++) {
+								text = write_count(text, counts[k]);
+								*text++ = ',';
+							}
+							//No separator after the last value of the file
+							if(i == pixels - 1) text--;
+							*text++ = '\n';
+						}
+					}
+					if(format & SYNTHETIC_CSV) chunk.text.resize(text - &chunk.text[0]);
+					chunk.checksum = SpectrumChecksum();
+					chunk.checksum.add(chunk.counts.data(), nbr_values);
+				}
+			});
+
+			for(int c = 0; c < batch_chunks; c++) {
+				if(chunks[c].counts.empty()) continue;
+				if(csv) ok = ok && fwrite(chunks[c].text.data(), 1, chunks[c].text.size(), csv) == chunks[c].text.size();
+				if(format & SYNTHETIC_BINARY) ok = cache.write(chunks[c].counts.data(), chunks[c].checksum) && ok;
+				chunks[c].counts.clear();
+			}
+		}
+
+		//The cache of a ".csv" file stores its size and modification time, so the ".csv" file is closed first
+		if(csv) ok = (fclose(csv) == 0) && ok;
+		if(format & SYNTHETIC_BINARY) ok = cache.close(!(format & SYNTHETIC_CSV)) && ok;
+		if(!ok) {
+			log << "Could not write " << csv_path << " completely" << endl;
+			return false;
+		}
+
+		struct stat csv_stat;
+		if(!(format & SYNTHETIC_CSV) && stat(csv_path.c_str(), &csv_stat) == 0) {
+			log << "OBS: " << csv_path << " already exists and is read in instead of the standalone cache" << endl;
+		}
+		double elapsed = seconds_since(start);
+		double gigabytes = (double)pixels*bins*sizeof(int)/1e9;
+		string written = (format & SYNTHETIC_CSV) ? spectrum_files[s] : spectrum_cache_path(spectrum_files[s]);
+		if(format == SYNTHETIC_BOTH) written += " and its cache";
+		log << "Wrote " << written << " in " << elapsed << " s (" << (double)pixels*bins/elapsed/1e6 << " million counts/s, " << gigabytes << " GB of counts)" << endl;
+	}
+
+	//Every fission is written as the number of its pixel
+	string fission_path = folder + "/pixels_with_fissions.csv";
+	FILE* fissions = fopen(fission_path.c_str(), "wb");
+	if(!fissions) {
+		log << "Could not write " << fission_path << endl;
+		return false;
+	}
+	long long nbr_fissions = 0;
+	for(int i = 0; i < pixels; i++) {
+		double mean = detector.fissions_per_pixel*(hot[i] ? detector.hot_factor : 1);
+		uint32_t counter[4] = {(uint32_t)i, 0, fission_counter, 0};
+		uint32_t words[4];
+		generator(counter, words);
+		int count = poisson_count(mean, exp(-mean), words[0], words[1]);
+		for(int f = 0; f < count; f++) {
+			fprintf(fissions, nbr_fissions > 0 ? ",%d" : "%d", i);
+			nbr_fissions++;
+		}
+	}
+	fprintf(fissions, "\n");
+	if(fclose(fissions) != 0) {
+		log << "Could not write " << fission_path << " completely" << endl;
+		return false;
+	}
+	log << "Wrote " << nbr_fissions << " fissions to " << fission_path << endl;
+	return true;
+}
@@ -0,0 +1,50 @@
+/** @file SyntheticData.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Writer of synthetic data folders of any size, for load and scaling tests
+*/
+#ifndef SYNTHETICDATA_H
+#define SYNTHETICDATA_H
+
+#include <string>
+#include <iostream>
+#include <stdint.h>
+#include "ThreadPool.h"
+
+//The files written by write_synthetic_data_folder(), which can be combined
+enum SyntheticFormat {
+	SYNTHETIC_CSV = 1,	//The ".csv" files, as the experimental data
+	SYNTHETIC_BINARY = 2,	//The binary cache files of the spectra, see SpectrumCache.h
+	SYNTHETIC_BOTH = 3
+};
+
+/** The parameters of a synthetic detector.
+Every bin of every spectrum has a Poisson distributed number of counts. The mean is the sum of a flat background and of the regions of the Lund data, at the same fraction of the bins: escapes in the first 400 of 4096 bins, an alpha peak of width 50 at bin 1000, and implants from bin 1100 to 1800. The implants are only in the beam ON spectra, and the decays of the beam OFF spectrum are scaled by <em>beam_off_factor</em>. A fraction of the pixels are hot spots, in which all means are multiplied by <em>hot_factor</em>.
+*/
+struct SyntheticDetector {
+	int pixels;
+	int bins;
+	uint64_t seed;
+
+	//Mean counts per bin
+	double background_mean;
+	double escape_mean;
+	double alpha_mean;		//At the top of the peak
+	double implant_mean;
+	double beam_off_factor;
+
+	//The fraction of hot pixels, chosen at random, and the factor of their means
+	double hot_fraction;
+	double hot_factor;
+
+	//Mean number of fissions per pixel
+	double fissions_per_pixel;
+
+	SyntheticDetector();
+
+	double mean_count(int spectrum, int bin, bool hot) const;
+	bool hot_pixel(int pixel) const;
+};
+
+bool write_synthetic_data_folder(const std::string& folder, const SyntheticDetector& detector, int format, ThreadPool& pool, std::ostream& log);
+
+#endif
@@ -0,0 +1,132 @@
+/** @file ThreadPool.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Implementation of the thread pool declared in ThreadPool.h
+*/
+#include "ThreadPool.h"
+#include <cstdlib>
+
+using namespace std;
+
+namespace {
+
+//The pool and the slot of the calling thread, if it is a thread of a pool
+thread_local const ThreadPool* current_pool = NULL;
+thread_local int current_slot = 0;
+
+int resolve_threads(int nbr_threads) {
+	if(nbr_threads <= 0) nbr_threads = ThreadPool::default_threads();
+	return nbr_threads;
+}
+
+}
+
+/** Starts the threads of the pool.
+	@param nbr_threads the number of slots, i.e. the threads of the pool and the waiting thread. 0 means default_threads().
+*/
+ThreadPool::ThreadPool(int nbr_threads) : queues(resolve_threads(nbr_threads)), nbr_queued(0), stop(false) {
+	for(int k = 1; k < size(); k++) {
+		threads.push_back(thread(&ThreadPool::work, this, k));
+	}
+}
+
+/** Stops the threads, the tasks still queued are not executed. */
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> lock(sleep_mutex);
+		stop = true;
+	}
+	wake.notify_all();
+	for(unsigned int k = 0; k < threads.size(); k++) threads[k].join();
+}
+
+/** The number of threads if none is given: the value of the environment variable RANDOMCHAINS_THREADS if it is set, otherwise one per hardware thread. */
+int ThreadPool::default_threads() {
+	const char* variable = getenv("RANDOMCHAINS_THREADS");
+	int nbr_threads = variable ? atoi(variable) : 0;
+	if(nbr_threads <= 0) nbr_threads = thread::hardware_concurrency();
+	if(nbr_threads <= 0) nbr_threads = 1;
+	return nbr_threads;
+}
+
+/** The slot of the calling thread, 0 if it is not a thread of this pool. */
+int ThreadPool::slot() const {
+	return current_pool == this ? current_slot : 0;
+}
+
+/** Queues <em>function</em> as a task of <em>group</em>, in the queue of the calling thread. */
+void ThreadPool::run(TaskGroup& group, function<void()> function) {
+	group.pending++;
+	Queue& queue = queues[slot()];
+	{
+		lock_guard<mutex> lock(queue.mutex);
+		Task task = {function, &group};
+		queue.tasks.push_back(task);
+	}
+	{
+		lock_guard<mutex> lock(sleep_mutex);
+		nbr_queued++;
+	}
+	wake.notify_one();
+}
+
+/** Takes the newest task of the queue of <em>slot</em>, or else the oldest task of another queue.
+	@return false if all queues are empty
+*/
+bool ThreadPool::find_task(int slot, Task& task) {
+	if(nbr_queued == 0) return false;
+	for(int k = 0; k < size(); k++) {
+		Queue& queue = queues[(slot + k)%size()];
+		lock_guard<mutex> lock(queue.mutex);
+		if(queue.tasks.empty()) continue;
+		if(k == 0) {
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+		}
+		else {
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+		}
+		nbr_queued--;
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::execute(Task& task) {
+	task.function();
+	if(--task.group->pending == 0) {
+		//The waiting thread checks pending under the lock, so it can not miss this notification
+		lock_guard<mutex> lock(sleep_mutex);
+		wake.notify_all();
+	}
+}
+
+/** Executes tasks of the pool until all tasks of <em>group</em> have finished. */
+void ThreadPool::wait(TaskGroup& group) {
+	int own_slot = slot();
+	while(group.pending > 0) {
+		Task task;
+		if(find_task(own_slot, task)) {
+			execute(task);
+			continue;
+		}
+		unique_lock<mutex> lock(sleep_mutex);
+		wake.wait(lock, [this, &group]() { return group.pending == 0 || nbr_queued > 0; });
+	}
+}
+
+/** The loop of a thread of the pool: execute tasks, and sleep while there are none. */
+void ThreadPool::work(int slot) {
+	current_pool = this;
+	current_slot = slot;
+	while(true) {
+		Task task;
+		if(find_task(slot, task)) {
+			execute(task);
+			continue;
+		}
+		unique_lock<mutex> lock(sleep_mutex);
+		wake.wait(lock, [this]() { return stop || nbr_queued > 0; });
+		if(stop) return;
+	}
+}
@@ -0,0 +1,91 @@
+/** @file ThreadPool.h
+@author Anton Roth (anton.roth@nuclear.lu.se)
+@brief Persistent work-stealing pool of threads
+*/
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** A pool of threads which are started once and reused for all parallel loops.
+Every thread of the pool has its own queue of tasks. A thread takes the newest task of its own queue and, when its queue is empty, steals the oldest task of another queue. The thread which waits for a group of tasks executes tasks of the pool in the meantime, so tasks may themselves start and wait for tasks without blocking the pool.
+
+The pool has size() slots: slot 0 is the thread outside the pool which waits for the tasks, e.g. the main thread, and the slots 1 to size()-1 are the threads of the pool. A pool of size 1 has no threads, all tasks are executed by the waiting thread. Only one thread outside the pool may use it at a time.
+*/
+class ThreadPool {
+	public:
+		/** Counts the tasks of a group which have not finished yet, see run() and wait(). */
+		class TaskGroup {
+			private:
+				std::atomic<int> pending;
+				friend class ThreadPool;
+
+			public:
+				TaskGroup() : pending(0) {}
+		};
+
+	private:
+		struct Task {
+			std::function<void()> function;
+			TaskGroup* group;
+		};
+
+		struct Queue {
+			std::mutex mutex;
+			std::deque<Task> tasks;
+		};
+
+		std::vector<std::thread> threads;
+		std::vector<Queue> queues;
+
+		//Number of tasks in all queues, the threads sleep while it is zero
+		std::atomic<int> nbr_queued;
+		bool stop;
+		std::mutex sleep_mutex;
+		std::condition_variable wake;
+
+		ThreadPool(const ThreadPool&);
+		ThreadPool& operator=(const ThreadPool&);
+
+		void work(int slot);
+		bool find_task(int slot, Task& task);
+		void execute(Task& task);
+
+	public:
+		explicit ThreadPool(int nbr_threads = 0);
+		~ThreadPool();
+
+		static int default_threads();
+
+		int size() const { return (int)queues.size(); }
+		int slot() const;
+
+		void run(TaskGroup& group, std::function<void()> function);
+		void wait(TaskGroup& group);
+
+		/** Calls <tt>body(first, last, slot)</tt> for the ranges <tt>[first, last)</tt> of at most <em>grain</em> indices which together cover <tt>[begin, end)</tt>, and waits for all of them.
+		The ranges are executed concurrently by the threads of the pool. <em>slot</em> is the slot of the executing thread, so <em>body</em> can keep partial results per slot without locks.
+		*/
+		template <typename Body>
+		void parallel_for(int begin, int end, int grain, const Body& body) {
+			if(grain < 1) grain = 1;
+			if(size() == 1 || end - begin <= grain) {
+				if(begin < end) body(begin, end, slot());
+				return;
+			}
+			TaskGroup group;
+			for(int first = begin; first < end; first += grain) {
+				int last = (end - first > grain) ? first + grain : end;
+				run(group, [this, &body, first, last]() { body(first, last, slot()); });
+			}
+			wait(group);
+		}
+};
+
+#endif
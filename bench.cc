@@ -0,0 +1,1453 @@
+/*!
+@file bench.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+
+@brief Benchmarks of the hot paths of RandomChains.
+
+Build and run with <tt>make bench</tt>. The spectra are synthetic, no experimental data is needed.
+*/
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <ftw.h>
+#include <sys/socket.h>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <sstream>
+#include "RandomChains.h"
+#include "MappedFile.h"
+#include "CsvParser.h"
+#include "ChainSet.h"
+#include "ChainKernels.h"
+#include "ThreadPool.h"
+#include "MonteCarlo.h"
+#include "Dataset.h"
+#include "LiveDataset.h"
+#include "QueryServer.h"
+#include "Instrumentation.h"
+#include "EventFile.h"
+#include "Shard.h"
+
+using namespace std;
+
+/** Returns the time in seconds since an arbitrary, fixed point. */
+static double now() {
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Calls <em>body</em> <em>repeats</em> times and returns the shortest time. */
+template <typename Body>
+static double best_time(int repeats, const Body& body) {
+	double best = 1e30;
+	for(int r = 0; r < repeats; r++) {
+		double start = now();
+		body();
+		best = min(best, now() - start);
+	}
+	return best;
+}
+
+/** Fills a spectrum with deterministic pseudo random counts. */
+static int synthetic_count(int pixel, int bin) {
+	unsigned int x = (unsigned int)pixel*2654435761u ^ (unsigned int)bin*40503u;
+	x ^= x >> 13;
+	//Mostly small counts, with a larger count now and then as in the peaks
+	if((bin & 63) == 0) return (int)(x % 1000);
+	return (int)(x % 5);
+}
+
+/** Fills a spectrum with pseudo random counts of mean <em>density</em> per bin.
+The count of a bin is <em>floor(2 density u + v)</em> with <em>u</em> and <em>v</em> uniform in [0, 1), so for densities below 1 most bins are empty, as in the spectra of a large segmented detector.
+*/
+static int density_count(int pixel, int bin, double density) {
+	unsigned int x = (unsigned int)pixel*2654435761u ^ (unsigned int)bin*40503u;
+	x ^= x >> 13;
+	x *= 0x5BD1E995u;
+	x ^= x >> 15;
+	double u = (x & 0xFFFF)/65536.0;
+	double v = (x >> 16)/65536.0;
+	return (int)(2*density*u + v);
+}
+
+/** Compares the old <tt>vector< vector<int> ></tt> spectrum layout with SpectrumMatrix.
+For both layouts the same energy window is summed for every pixel, as in RandomChains::rate_calc(), and the best of a few repetitions is reported.
+	@param pixels number of pixels of the synthetic detector
+	@param bins number of bins per pixel
+*/
+static void bench_spectrum_layout(int pixels, int bins) {
+	cout << "Spectrum layout, " << pixels << " pixels x " << bins << " bins" << endl;
+
+	vector< vector<int> > nested(pixels);
+	for(int i = 0; i < pixels; i++) {
+		nested[i].resize(bins);
+		for(int k = 0; k < bins; k++) nested[i][k] = synthetic_count(i, k);
+	}
+
+	SpectrumMatrix matrix(pixels, bins);
+	for(int i = 0; i < pixels; i++) {
+		PixelRow<int> spectrum = matrix.row(i);
+		for(int k = 0; k < bins; k++) spectrum[k] = synthetic_count(i, k);
+	}
+
+	//Every window of a quarter of the spectrum, i.e. comparable to the implant window
+	int lower = bins/4, upper = bins/2;
+	const int repetitions = 5;
+	double best_nested = 1e30, best_matrix = 1e30;
+	long long check_nested = 0, check_matrix = 0;
+
+	for(int r = 0; r < repetitions; r++) {
+		double start = now();
+		long long total = 0;
+		for(int i = 0; i < pixels; i++) {
+			int acc_counts = 0;
+			for(int k = lower; k < upper; k++) acc_counts += nested[i][k];
+			total += acc_counts;
+		}
+		double elapsed = now() - start;
+		if(elapsed < best_nested) best_nested = elapsed;
+		check_nested = total;
+
+		start = now();
+		total = 0;
+		for(int i = 0; i < pixels; i++) {
+			PixelRow<const int> spectrum = static_cast<const SpectrumMatrix&>(matrix).row(i);
+			int acc_counts = 0;
+			for(int k = lower; k < upper; k++) acc_counts += spectrum[k];
+			total += acc_counts;
+		}
+		elapsed = now() - start;
+		if(elapsed < best_matrix) best_matrix = elapsed;
+		check_matrix = total;
+	}
+
+	if(check_nested != check_matrix) {
+		cout << "The two layouts do not give the same window sums!" << endl;
+		abort();
+	}
+
+	double bytes = (double)pixels*(upper - lower)*sizeof(int);
+	cout << "	vector< vector<int> >: " << best_nested*1e3 << " ms (" << bytes/best_nested/1e9 << " GB/s)" << endl;
+	cout << "	SpectrumMatrix:        " << best_matrix*1e3 << " ms (" << bytes/best_matrix/1e9 << " GB/s)" << endl;
+}
+
+/** Compares energy window sums summed bin by bin with the cumulative index.
+For <em>nbr_windows</em> different bin windows the counts of every pixel are computed, as if the rates of that many chains with different limits were calculated.
+*/
+static void bench_window_index(int pixels, int bins, int nbr_windows) {
+	cout << "Window sums for " << nbr_windows << " windows, " << pixels << " pixels x " << bins << " bins" << endl;
+
+	SpectrumMatrix matrix(pixels, bins);
+	for(int i = 0; i < pixels; i++) {
+		PixelRow<int> spectrum = matrix.row(i);
+		for(int k = 0; k < bins; k++) spectrum[k] = synthetic_count(i, k);
+	}
+	const SpectrumMatrix& spectra = matrix;
+
+	double start = now();
+	CumulativeSpectrum index(spectra);
+	double build_time = now() - start;
+
+	start = now();
+	long long check_direct = 0;
+	for(int w = 0; w < nbr_windows; w++) {
+		int lower = (w*37) % (bins/2), upper = lower + 1 + (w*101) % (bins/2);
+		for(int i = 0; i < pixels; i++) {
+			PixelRow<const int> spectrum = spectra.row(i);
+			long long acc_counts = 0;
+			for(int k = lower; k < upper; k++) acc_counts += spectrum[k];
+			check_direct += acc_counts;
+		}
+	}
+	double direct_time = now() - start;
+
+	start = now();
+	long long check_index = 0;
+	for(int w = 0; w < nbr_windows; w++) {
+		int lower = (w*37) % (bins/2), upper = lower + 1 + (w*101) % (bins/2);
+		for(int i = 0; i < pixels; i++) check_index += index.window_sum(i, lower, upper);
+	}
+	double index_time = now() - start;
+
+	if(check_direct != check_index) {
+		cout << "The cumulative index does not give the same window sums!" << endl;
+		abort();
+	}
+	cout << "	Building the index:    " << build_time*1e3 << " ms (" << index.memory_bytes()/1e6 << " MB)" << endl;
+	cout << "	Summed bin by bin:     " << direct_time*1e3 << " ms" << endl;
+	cout << "	Cumulative index:      " << index_time*1e3 << " ms" << endl;
+}
+
+/** Compares the memory of the cumulative index with the window sums kept in the streaming mode.
+The windows are those of the article chains: the implants, the alphas and the escapes.
+*/
+static void bench_streaming_index(int pixels, int bins) {
+	cout << "Streaming window sums, " << pixels << " pixels x " << bins << " bins" << endl;
+
+	SpectrumMatrix matrix(pixels, bins);
+	for(int i = 0; i < pixels; i++) {
+		PixelRow<int> spectrum = matrix.row(i);
+		for(int k = 0; k < bins; k++) spectrum[k] = synthetic_count(i, k);
+	}
+
+	const int limits[] = {1100, 1800, 900, 1100, 0, 400};
+	vector<int> window_limits(limits, limits + 6);
+
+	CumulativeSpectrum full(matrix);
+	WindowSumSpectrum windows(pixels, bins, window_limits);
+	double start = now();
+	windows.accumulate(matrix);
+	windows.finish();
+	double accumulate_time = now() - start;
+
+	for(int i = 0; i < pixels; i++) {
+		for(int w = 0; w < 6; w += 2) {
+			if(full.window_sum(i, limits[w], limits[w+1]) != windows.window_sum(i, limits[w], limits[w+1])) {
+				cout << "The window sums do not give the same counts as the cumulative index!" << endl;
+				abort();
+			}
+		}
+	}
+
+	cout << "	Cumulative index:      " << full.memory_bytes()/1e6 << " MB" << endl;
+	cout << "	Window sums:           " << windows.memory_bytes()/1e6 << " MB (" << accumulate_time*1e3 << " ms)" << endl;
+}
+
+/** Compares the memory and the window sums of the sparse index with the cumulative index, for spectra of different densities.
+The counts are those of density_count(), the windows are spread over the whole spectrum as in bench_window_index().
+	@param densities the mean counts per bin of the spectra
+*/
+static void bench_sparse_index(int pixels, int bins, int nbr_windows, const vector<double>& densities) {
+	cout << "Sparse index for " << nbr_windows << " windows, " << pixels << " pixels x " << bins << " bins" << endl;
+
+	for(size_t d = 0; d < densities.size(); d++) {
+		SpectrumMatrix matrix(pixels, bins);
+		for(int i = 0; i < pixels; i++) {
+			PixelRow<int> spectrum = matrix.row(i);
+			for(int k = 0; k < bins; k++) spectrum[k] = density_count(i, k, densities[d]);
+		}
+
+		CumulativeSpectrum dense(matrix);
+		double start = now();
+		SparseSpectrum sparse(matrix);
+		double build_time = now() - start;
+
+		start = now();
+		long long check_dense = 0;
+		for(int w = 0; w < nbr_windows; w++) {
+			int lower = (w*37) % (bins/2), upper = lower + 1 + (w*101) % (bins/2);
+			for(int i = 0; i < pixels; i++) check_dense += dense.window_sum(i, lower, upper);
+		}
+		double dense_time = now() - start;
+
+		start = now();
+		long long check_sparse = 0;
+		for(int w = 0; w < nbr_windows; w++) {
+			int lower = (w*37) % (bins/2), upper = lower + 1 + (w*101) % (bins/2);
+			for(int i = 0; i < pixels; i++) check_sparse += sparse.window_sum(i, lower, upper);
+		}
+		double sparse_time = now() - start;
+
+		if(check_dense != check_sparse) {
+			cout << "The sparse index does not give the same window sums as the cumulative index!" << endl;
+			abort();
+		}
+		bool chosen = dynamic_cast<const SparseSpectrum*>(make_spectrum_index(matrix, sparse_density_threshold()).get()) != NULL;
+		cout << "	Density " << densities[d] << " counts/bin, " << 100.0*spectrum_density(matrix) << " % of the bins non-empty" << (chosen ? " (sparse chosen)" : " (cumulative chosen)") << endl;
+		cout << "		Cumulative index:  " << dense.memory_bytes()/1e6 << " MB, " << dense_time*1e3 << " ms" << endl;
+		cout << "		Sparse index:      " << sparse.memory_bytes()/1e6 << " MB, " << sparse_time*1e3 << " ms (built in " << build_time*1e3 << " ms)" << endl;
+	}
+}
+
+/** Compares the memory and the window sums of the compressed index with the spectrum itself and the cumulative index.
+The counts are those of synthetic_count(), small counts with a peak count in every 64th bin, or of density_count() if <em>density</em> is not 0.
+*/
+static void bench_compressed_index(int pixels, int bins, int nbr_windows, double density = 0) {
+	cout << "Compressed index for " << nbr_windows << " windows, " << pixels << " pixels x " << bins << " bins";
+	if(density > 0) cout << ", " << density << " counts/bin";
+	cout << endl;
+
+	SpectrumMatrix matrix(pixels, bins);
+	for(int i = 0; i < pixels; i++) {
+		PixelRow<int> spectrum = matrix.row(i);
+		for(int k = 0; k < bins; k++) spectrum[k] = density > 0 ? density_count(i, k, density) : synthetic_count(i, k);
+	}
+
+	CumulativeSpectrum dense(matrix);
+	double start = now();
+	CompressedSpectrum compressed(matrix);
+	double build_time = now() - start;
+
+	start = now();
+	long long check_dense = 0;
+	for(int w = 0; w < nbr_windows; w++) {
+		int lower = (w*37) % (bins/2), upper = lower + 1 + (w*101) % (bins/2);
+		for(int i = 0; i < pixels; i++) check_dense += dense.window_sum(i, lower, upper);
+	}
+	double dense_time = now() - start;
+
+	start = now();
+	long long check_compressed = 0;
+	for(int w = 0; w < nbr_windows; w++) {
+		int lower = (w*37) % (bins/2), upper = lower + 1 + (w*101) % (bins/2);
+		for(int i = 0; i < pixels; i++) check_compressed += compressed.window_sum(i, lower, upper);
+	}
+	double compressed_time = now() - start;
+
+	if(check_dense != check_compressed) {
+		cout << "The compressed index does not give the same window sums as the cumulative index!" << endl;
+		abort();
+	}
+	for(int i = 0; i < pixels; i += 7) {
+		for(int k = 0; k < bins; k++) {
+			if(compressed.count(i, k) != matrix[i][k]) {
+				cout << "The compressed index gives " << compressed.count(i, k) << " counts in bin " << k << " of pixel " << i << " instead of " << matrix[i][k] << endl;
+				abort();
+			}
+		}
+	}
+	vector<size_t> widths = compressed.blocks_of_width();
+	cout << "	Spectrum (32 bit):     " << matrix.size()*sizeof(int)/1e6 << " MB" << endl;
+	cout << "	Cumulative index:      " << dense.memory_bytes()/1e6 << " MB, " << dense_time*1e3 << " ms" << endl;
+	cout << "	Compressed index:      " << compressed.memory_bytes()/1e6 << " MB, " << compressed_time*1e3 << " ms (built in " << build_time*1e3 << " ms, " << simd_level_name(simd_level()) << ")" << endl;
+	cout << "	Blocks of 0/8/16/32 bit: " << widths[0] << "/" << widths[1] << "/" << widths[2] << "/" << widths[4] << endl;
+}
+
+/** Writes the three spectrum files and the fission file of a synthetic detector to <em>folder</em>.
+	@param density the mean counts per bin, see density_count(), or 0 for the fixed pattern of synthetic_count()
+*/
+static void write_synthetic_data(string folder, int pixels, int bins, double density = 0) {
+	const char* spectra[] = {"beam_on.csv", "rec_beam_on.csv", "rec_beam_off.csv"};
+	for(int s = 0; s < 3; s++) {
+		ofstream out(folder + "/" + spectra[s]);
+		for(int i = 0; i < pixels; i++) {
+			for(int k = 0; k < bins; k++) {
+				if(i > 0 || k > 0) out << ',';
+				out << (density > 0 ? density_count(i + s*pixels, k, density) : synthetic_count(i + s, k));
+			}
+		}
+		out << endl;
+	}
+	ofstream fissions(folder + "/pixels_with_fissions.csv");
+	for(int i = 0; i < pixels; i += 7) {
+		if(i > 0) fissions << ',';
+		fissions << i;
+	}
+	fissions << endl;
+}
+
+/** Writes an input chain file with the article chains repeated <em>repeats</em> times, i.e. with 19*<em>repeats</em> decays. */
+static void write_article_chain_file(string file_name, int repeats) {
+	ofstream out(file_name);
+	out << "Synthetic chains for the benchmarks" << endl;
+	out << "Experiment_time(s): 1.433e+06" << endl;
+	out << "alpha_low alpha_up escape_low escapes_up implants_low implants_up" << endl;
+	out << "900 1100 0 400 1100 1800" << endl;
+	out << "Type (alpha=a, escape=e and fission=f) 	Beam ON (=1) or OFF (=0)	Time span (s)" << endl;
+	for(int r = 0; r < repeats; r++) {
+		out << "#2\na 0 2\nf 0 10\n";
+		out << "#2\ne 0 2\nf 0 10\n";
+		out << "#3\na 1 2\na 0 10\nf 0 50\n";
+		out << "#3\na 1 2\na 0 10\nf 0 50\n";
+		out << "#3\na 0 2\na 0 10\nf 0 50\n";
+		out << "#3\na 0 2\na 0 10\nf 0 50\n";
+		out << "#3\ne 0 2\ne 1 10\nf 0 50\n";
+	}
+}
+
+/** Compares the parsing of a spectrum file with <tt>getline</tt> and <tt>stoi</tt>, as it was done before, with the memory mapped parse_csv(). */
+static void bench_csv_parse(int pixels, int bins) {
+	cout << "Parsing a spectrum file, " << pixels << " pixels x " << bins << " bins" << endl;
+	mkdir("csv", 0755);
+	write_synthetic_data("csv", pixels, bins);
+	string file_name = "csv/rec_beam_on.csv";
+
+	SpectrumMatrix old_data(pixels, bins), new_data(pixels, bins);
+
+	double start = now();
+	{
+		ifstream ifile_stream(file_name, ios::in);
+		string val;
+		int bin = 0, pixel = 0;
+		while(getline(ifile_stream, val, ',')) {
+			if(bin%bins == 0 && bin > 0) {
+				bin = 0;
+				pixel++;
+			}
+			old_data[pixel][bin] = stoi(val);
+			bin++;
+		}
+	}
+	double old_time = now() - start;
+
+	//The file is in the page cache after the first read, so both parsers read it from memory
+	start = now();
+	MappedFile file;
+	file.open(file_name, MAPPED_SEQUENTIAL, true);
+	CsvArrayWriter writer(new_data.data(), new_data.size());
+	CsvParseResult result = parse_csv(file.begin(), file.end(), writer);
+	double new_time = now() - start;
+
+	if(result.status != CSV_OK || result.nbr_values != new_data.size() || memcmp(old_data.data(), new_data.data(), new_data.size()*sizeof(int)) != 0) {
+		cout << "The two parsers do not give the same spectrum!" << endl;
+		abort();
+	}
+
+	double megabytes = file.size()/1e6;
+	cout << "	getline and stoi:      " << old_time*1e3 << " ms (" << megabytes/old_time << " MB/s)" << endl;
+	cout << "	parse_csv:             " << new_time*1e3 << " ms (" << megabytes/new_time << " MB/s)" << endl;
+}
+
+/** Counts the heap allocations and the rate vectors made by RandomChains::Run().
+Neither should depend on the number of decays, i.e. the compute path must only read the spectra, reuse its buffers and share the rate vectors of equal decays. The allocations are counted by the operator new of AllocationCounter.cc, and reported as not measured without instrumentation.
+*/
+static void bench_run_allocations() {
+	cout << "Heap allocations in RandomChains::Run()" << endl;
+	write_synthetic_data("data", 64, 2048);
+
+	//The program output is not of interest here
+	ofstream null_stream;
+	streambuf* cout_buffer = cout.rdbuf(null_stream.rdbuf());
+
+	const int repeats[] = {1, 10, 100};
+	unsigned long allocations[3];
+	RateCacheStatistics statistics[3];
+	for(int r = 0; r < 3; r++) {
+		write_article_chain_file("chains.txt", repeats[r]);
+		RandomChains RC(64, 2048, "data");
+		RC.SetDecayChains("chains.txt");
+		unsigned long before = allocation_count();
+		RC.Run();
+		allocations[r] = allocation_count() - before;
+		statistics[r] = RC.GetRateCacheStatistics();
+	}
+
+	cout.rdbuf(cout_buffer);
+	//Without instrumentation the allocations are not counted, and the check would compare zeros
+	bool counted = allocations_counted();
+	for(int r = 0; r < 3; r++) {
+		cout << "	" << 19*repeats[r] << " decays: ";
+		if(counted) cout << allocations[r] << " allocations, ";
+		else cout << "allocations not measured, ";
+		cout << statistics[r].misses << " rate vectors (" << statistics[r].memory_bytes/1e3 << " kB), " << statistics[r].hits << " rate cache hits" << endl;
+	}
+	if(counted && allocations[2] != allocations[0]) {
+		cout << "The number of allocations in Run() grows with the number of decays!" << endl;
+		abort();
+	}
+	if(statistics[2].misses != statistics[0].misses) {
+		cout << "The number of rate vectors grows with the number of decays!" << endl;
+		abort();
+	}
+}
+
+/** Evaluates the chains one chain at a time, as RandomChains::calculate_expected_nbr_random_chains() did before ChainSet.
+This is the reference for the batch evaluation and the vectorised kernels: the probabilities are <em>1 - Poisson_pmf(0, lambda)</em> and the pixels are summed one after another.
+*/
+static vector<double> evaluate_one_chain_at_a_time(const PixelMatrix<double>& rate, const vector<long long>& implants, const vector<int>& chain_length, const vector<int>& rate_row, const vector<double>& time_span) {
+	int pixels = implants.size();
+	vector<double> totals;
+	int offset = 0;
+	for(unsigned int j = 0; j < chain_length.size(); j++) {
+		vector<double> randoms_in_pixel(pixels, 0.);
+		for(int l = offset; l < offset + chain_length.at(j); l++) {
+			for(int i = 0; i < pixels; i++) {
+				if(l == offset) randoms_in_pixel[i] = implants[i];
+				randoms_in_pixel[i] *= (1-Poisson_pmf(0, rate[rate_row.at(l)][i]*time_span.at(l)));
+			}
+		}
+		double random_chains_temp = 0;
+		for(int i = 0; i < pixels; i++) random_chains_temp += randoms_in_pixel[i];
+		totals.push_back(random_chains_temp);
+		offset += chain_length.at(j);
+	}
+	return totals;
+}
+
+/** The largest relative difference between the values of <em>a</em> and <em>b</em>. */
+static double max_relative_difference(const vector<double>& a, const vector<double>& b) {
+	double max_difference = 0;
+	for(unsigned int j = 0; j < a.size(); j++) {
+		double difference = fabs(a[j] - b[j])/fabs(b[j]);
+		if(difference > max_difference) max_difference = difference;
+	}
+	return max_difference;
+}
+
+//Largest relative difference accepted between the kernels and the reference. For the small expected values lambda of the background the reference, 1 - exp(-lambda), has a relative error of about 1e-16/lambda, e.g. 1e-11 for lambda = 1e-5.
+static const double chain_tolerance = 1e-9;
+
+/** Compares the evaluation of a library of chains one chain at a time, as before, with the batch evaluation of ChainSet.
+The chains have 2 to 6 decays, each with one of <em>nbr_rates</em> rate vectors and a time span of 1 to 100 s. The throughput is given in chain-pixel evaluations per second, i.e. the number of chains times the number of pixels per second.
+*/
+static void bench_chain_batch(int pixels, int nbr_chains, int nbr_rates) {
+	cout << "Evaluating " << nbr_chains << " chains, " << pixels << " pixels, " << nbr_rates << " rate vectors" << endl;
+
+	PixelMatrix<double> rate(nbr_rates, pixels);
+	for(int r = 0; r < nbr_rates; r++) {
+		for(int i = 0; i < pixels; i++) rate[r][i] = synthetic_count(i, r)*1e-4;
+	}
+	vector<long long> implants(pixels);
+	for(int i = 0; i < pixels; i++) implants[i] = 1000 + synthetic_count(i, 64);
+
+	vector<int> chain_length(nbr_chains), rate_row;
+	vector<double> time_span;
+	ChainSet chain_set;
+	for(int j = 0; j < nbr_chains; j++) {
+		chain_length[j] = 2 + j%5;
+		for(int l = 0; l < chain_length[j]; l++) {
+			rate_row.push_back((j*7 + l*3)%nbr_rates);
+			time_span.push_back(1 + (j*13 + l)%100);
+		}
+		chain_set.add_chain(&rate_row[rate_row.size() - chain_length[j]], &time_span[time_span.size() - chain_length[j]], chain_length[j]);
+	}
+
+	double start = now();
+	vector<double> old_totals = evaluate_one_chain_at_a_time(rate, implants, chain_length, rate_row, time_span);
+	double old_time = now() - start;
+
+	double evaluations = (double)nbr_chains*pixels;
+	cout << "	One chain at a time:   " << old_time*1e3 << " ms (" << evaluations/old_time/1e6 << " M chain-pixels/s)" << endl;
+
+	//Every supported instruction set, they must give the same totals
+	SimdLevel best = simd_level();
+	vector<double> first_totals;
+	for(int level = SIMD_SCALAR; level <= simd_supported_level(); level++) {
+		set_simd_level((SimdLevel)level);
+		start = now();
+		vector<double> new_totals(nbr_chains);
+		chain_set.evaluate(rate, implants, new_totals.data());
+		double new_time = now() - start;
+
+		if(first_totals.empty()) first_totals = new_totals;
+		if(memcmp(first_totals.data(), new_totals.data(), nbr_chains*sizeof(double)) != 0) {
+			cout << "The " << simd_level_name((SimdLevel)level) << " kernels do not give the same number of random chains as the scalar kernels!" << endl;
+			abort();
+		}
+		double difference = max_relative_difference(new_totals, old_totals);
+		if(difference > chain_tolerance) {
+			cout << "The batch evaluation differs from the reference by " << difference << endl;
+			abort();
+		}
+
+		cout << "	ChainSet, " << simd_level_name((SimdLevel)level) << ":" << string(13 - strlen(simd_level_name((SimdLevel)level)), ' ') << new_time*1e3 << " ms (" << evaluations/new_time/1e6 << " M chain-pixels/s, max relative difference " << difference << ")" << endl;
+	}
+	set_simd_level(best);
+}
+
+/** Compares the chain kernels of every length, see chain_sum_kernel(), with the evaluation decay by decay.
+For every length from 1 to max_unrolled_chain_length + 2, <em>nbr_chains</em> chains of that length are evaluated with every supported instruction set, with and without the chain kernels. All totals of a length must be bitwise the same, and a chain kernel which is slower than the evaluation decay by decay with the best instruction set is reported. The number of pixels is not a multiple of the tiles nor of the vectors, so the remainders of the kernels are checked too.
+*/
+static void bench_chain_kernels(int pixels, int nbr_chains, int nbr_rates) {
+	cout << "Chain kernels, " << nbr_chains << " chains of every length, " << pixels << " pixels" << endl;
+
+	PixelMatrix<double> rate(nbr_rates, pixels);
+	for(int r = 0; r < nbr_rates; r++) {
+		for(int i = 0; i < pixels; i++) rate[r][i] = synthetic_count(i, r)*1e-4;
+	}
+	vector<long long> implants(pixels);
+	for(int i = 0; i < pixels; i++) implants[i] = 1000 + synthetic_count(i, 64);
+
+	SimdLevel best = simd_level();
+	int nbr_slower = 0;
+	for(int length = 1; length <= max_unrolled_chain_length + 2; length++) {
+		ChainSet chain_set;
+		for(int j = 0; j < nbr_chains; j++) {
+			vector<int> rows(length);
+			vector<double> spans(length);
+			for(int l = 0; l < length; l++) {
+				rows[l] = (j*7 + l*3)%nbr_rates;
+				spans[l] = 1 + (j*13 + l)%100;
+			}
+			chain_set.add_chain(rows.data(), spans.data(), length);
+		}
+
+		vector<double> first_totals;
+		double times[2] = {1e30, 1e30};
+		for(int level = SIMD_SCALAR; level <= simd_supported_level(); level++) {
+			set_simd_level((SimdLevel)level);
+			//The two evaluations take turns, so that both see the same load of the machine
+			for(int repeat = 0; repeat < (level == best ? 9 : 1); repeat++) for(int unrolled = 0; unrolled < 2; unrolled++) {
+				set_unrolled_chain_kernels(unrolled);
+				vector<double> totals(nbr_chains);
+				double start = now();
+				chain_set.evaluate(rate, implants, totals.data());
+				if(level == best) times[unrolled] = min(times[unrolled], now() - start);
+
+				if(first_totals.empty()) first_totals = totals;
+				if(memcmp(first_totals.data(), totals.data(), nbr_chains*sizeof(double)) != 0) {
+					cout << "The " << (unrolled ? "chain kernel" : "evaluation decay by decay") << " of length " << length << " with " << simd_level_name((SimdLevel)level) << " does not give the same number of random chains!" << endl;
+					abort();
+				}
+			}
+		}
+		set_simd_level(best);
+		set_unrolled_chain_kernels(true);
+
+		double evaluations = (double)nbr_chains*pixels;
+		cout << "	Length " << length << ", " << simd_level_name(best) << ": decay by decay " << evaluations/times[0]/1e6 << ", ";
+		if(length <= max_unrolled_chain_length) {
+			cout << "chain kernel " << evaluations/times[1]/1e6 << " M chain-pixels/s";
+			//A chain kernel is only dispatched because it is faster, a kernel which is not is reported
+			if(times[1] > 1.05*times[0]) {
+				cout << " SLOWER than decay by decay";
+				nbr_slower++;
+			}
+			cout << endl;
+		}
+		else cout << "no chain kernel" << endl;
+	}
+	if(nbr_slower > 0) cout << "	" << nbr_slower << " chain kernels are slower than the evaluation decay by decay, see max_unrolled_chain_length" << endl;
+}
+
+/** Validates the vectorised kernels against the reference, see evaluate_one_chain_at_a_time().
+First the probability of a decay is compared with <tt>expm1l</tt> for expected values from 1e-300 to 1000, where it must agree to 1 unit in the last place. Then the chains of the article and of the test run are evaluated on the data of the two runs: synthetic spectra of the Lund geometry with the bin limits of the article, and the trivial test data of RandomChains::generate_test_data(). All totals must agree with the reference within chain_tolerance.
+*/
+static void bench_kernel_accuracy() {
+	cout << "Accuracy of the " << simd_level_name(simd_level()) << " kernels" << endl;
+
+	double max_ulps = 0;
+	for(double exponent = -300; exponent < 3; exponent += 0.001) {
+		double expected_value = pow(10, exponent);
+		long double exact = -expm1l(-(long double)expected_value);
+		double ulp = nextafter((double)exact, INFINITY) - (double)exact;
+		double ulps = fabs(decay_probability(expected_value) - (double)exact)/ulp;
+		if(ulps > max_ulps) max_ulps = ulps;
+	}
+	cout << "	-expm1(-lambda):       " << max_ulps << " ulp" << endl;
+	if(max_ulps > 1) {
+		cout << "The probability of a decay is not accurate to 1 ulp!" << endl;
+		abort();
+	}
+
+	const int pixels = 1024, bins = 4096;
+
+	//Article: rate rows alphas OFF, alphas ON, escapes OFF, escapes ON and fissions
+	{
+		SpectrumMatrix spectra[3];
+		for(int s = 0; s < 3; s++) {
+			spectra[s].resize(pixels, bins);
+			for(int i = 0; i < pixels; i++) {
+				for(int k = 0; k < bins; k++) spectra[s][i][k] = synthetic_count(i + s, k);
+			}
+		}
+		CumulativeSpectrum beam_on(spectra[0]), rec_beam_on(spectra[1]), rec_beam_off(spectra[2]);
+		const double experiment_time = 1433000;
+
+		PixelMatrix<double> rate(5, pixels);
+		vector<long long> implants(pixels);
+		for(int i = 0; i < pixels; i++) {
+			rate[0][i] = rec_beam_off.window_sum(i, 900, 1100)/experiment_time;
+			rate[1][i] = rec_beam_on.window_sum(i, 900, 1100)/experiment_time;
+			rate[2][i] = rec_beam_off.window_sum(i, 0, 400)/experiment_time;
+			rate[3][i] = rec_beam_on.window_sum(i, 0, 400)/experiment_time;
+			rate[4][i] = (i%7 == 0 ? 1 : 0)/experiment_time;
+			implants[i] = beam_on.window_sum(i, 1100, 1800);
+		}
+
+		const int lengths[] = {2, 2, 3, 3, 3, 3, 3};
+		const int rows[] = {0,4,  2,4,  1,0,4,  1,0,4,  0,0,4,  0,0,4,  2,3,4};
+		const double spans[] = {2,10,  2,10,  2,10,50,  2,10,50,  2,10,50,  2,10,50, 2,10,50};
+		vector<int> chain_length(lengths, lengths + 7), rate_row(rows, rows + 19);
+		vector<double> time_span(spans, spans + 19);
+
+		ChainSet chain_set;
+		for(int j = 0, offset = 0; j < 7; offset += lengths[j], j++) chain_set.add_chain(rows + offset, spans + offset, lengths[j]);
+		vector<double> totals(7);
+		chain_set.evaluate(rate, implants, totals.data());
+
+		double difference = max_relative_difference(totals, evaluate_one_chain_at_a_time(rate, implants, chain_length, rate_row, time_span));
+		cout << "	Article chains:        max relative difference " << difference << endl;
+		if(difference > chain_tolerance) {
+			cout << "The article chains differ from the reference!" << endl;
+			abort();
+		}
+	}
+
+	//Test run: the rates are the same in every pixel, rows alphas ON, escapes OFF, alphas OFF, escapes ON and fissions
+	{
+		const double experiment_time = 1000000;
+		const double rates[] = {200*2/experiment_time, 400*3/experiment_time, 200*1/experiment_time, 400*4/experiment_time, 2/experiment_time};
+		PixelMatrix<double> rate(5, pixels);
+		for(int r = 0; r < 5; r++) {
+			for(int i = 0; i < pixels; i++) rate[r][i] = rates[r];
+		}
+		vector<long long> implants(pixels, 100);
+
+		const int rows[] = {0, 1, 2, 3, 4};
+		const double spans[] = {1, 2, 3, 4, 5};
+		ChainSet chain_set;
+		chain_set.add_chain(rows, spans, 5);
+		vector<double> totals(1);
+		chain_set.evaluate(rate, implants, totals.data());
+
+		//The formula of RandomChains::print_test_result()
+		double test_randoms = 100.0*pixels;
+		for(int l = 0; l < 5; l++) test_randoms *= (1-Poisson_pmf(0, rates[l]*spans[l]));
+
+		double difference = max_relative_difference(totals, vector<double>(1, test_randoms));
+		cout << "	Test chain:            max relative difference " << difference << endl;
+		if(difference > chain_tolerance) {
+			cout << "The test chain differs from the reference!" << endl;
+			abort();
+		}
+	}
+}
+
+/** Times a sweep of about 10^5 grid points with RandomChains::Sweep() on the synthetic data of the Lund geometry, see bench_csv_parse().
+The grid is 11 x 11 alpha windows, and for chain 3 of the article 8 x 100 time spans of its second and third decay.
+*/
+static void bench_sweep() {
+	cout << "Parameter sweep on 1024 pixels x 4096 bins" << endl;
+	write_article_chain_file("sweep_chains.txt", 1);
+	ofstream sweep_file("sweep.txt");
+	sweep_file << "Sweep for the benchmarks" << endl;
+	sweep_file << "alpha_low 850 950 10" << endl;
+	sweep_file << "alpha_up 1050 1150 10" << endl;
+	sweep_file << "time 3 2 1 8 1" << endl;
+	sweep_file << "time 3 3 1 100 1" << endl;
+	sweep_file.close();
+
+	ofstream null_stream;
+	streambuf* cout_buffer = cout.rdbuf(null_stream.rdbuf());
+	RandomChains RC(1024, 4096, "csv");
+	RC.SetDecayChains("sweep_chains.txt");
+	double start = now();
+	long long nbr_points = RC.Sweep("sweep.txt", "sweep.tsv");
+	double elapsed = now() - start;
+
+	//A decay which the chain does not have is rejected
+	ofstream bad_sweep_file("sweep_bad.txt");
+	bad_sweep_file << "Sweep of a decay which does not exist" << endl;
+	bad_sweep_file << "time 3 4 1 8 1" << endl;
+	bad_sweep_file.close();
+	long long bad_points = RC.Sweep("sweep_bad.txt", "sweep_bad.tsv");
+	cout.rdbuf(cout_buffer);
+	if(bad_points != 0) {
+		cout << "The sweep of the time span of a decay which does not exist was not rejected" << endl;
+		abort();
+	}
+
+	cout << "	" << nbr_points << " grid points: " << elapsed*1e3 << " ms (" << nbr_points/elapsed << " points/s)" << endl;
+}
+
+/** Evaluates many queries on one dataset, one after another and from several threads at once, see Dataset.
+The query of the chains file must give bitwise the same result as RandomChains::Run(), also when Run() is called twice, and every query must give the same result from any thread.
+*/
+static void bench_dataset_queries(int nbr_queries) {
+	cout << "Queries on one dataset of 1024 pixels x 4096 bins" << endl;
+
+	ofstream null_stream;
+	streambuf* cout_buffer = cout.rdbuf(null_stream.rdbuf());
+	RandomChains RC(1024, 4096, "csv");
+	RC.SetDecayChains("sweep_chains.txt");
+	RC.Run();
+	RC.Run();
+	vector<double> reference = RC.GetExpectedRandomChains();
+	cout.rdbuf(cout_buffer);
+
+	shared_ptr<const Dataset> dataset = RC.GetDataset();
+	ChainQuery article = RC.GetQuery();
+	vector<double> result = dataset->Evaluate(article);
+	if(reference.size() != 7 || result != reference) {
+		cout << "The query of the article chains differs from RandomChains::Run()!" << endl;
+		abort();
+	}
+
+	//Every query has its own alpha window
+	vector<ChainQuery> queries(nbr_queries, article);
+	for(int q = 0; q < nbr_queries; q++) {
+		queries[q].lower_limit_alphas = 850 + q%100;
+		queries[q].upper_limit_alphas = 1050 + q/100;
+	}
+
+	vector< vector<double> > serial(nbr_queries);
+	double start = now();
+	for(int q = 0; q < nbr_queries; q++) serial[q] = dataset->Evaluate(queries[q]);
+	double serial_time = now() - start;
+
+	int nbr_threads = max(2, (int)thread::hardware_concurrency());
+	vector< vector<double> > concurrent(nbr_queries);
+	start = now();
+	vector<thread> threads;
+	for(int t = 0; t < nbr_threads; t++) {
+		threads.push_back(thread([&, t]() {
+			for(int q = t; q < nbr_queries; q += nbr_threads) concurrent[q] = dataset->Evaluate(queries[q]);
+		}));
+	}
+	for(int t = 0; t < nbr_threads; t++) threads[t].join();
+	double concurrent_time = now() - start;
+
+	if(concurrent != serial) {
+		cout << "The concurrent queries differ from the serial ones!" << endl;
+		abort();
+	}
+	cout << "	" << nbr_queries << " queries: " << serial_time*1e3 << " ms in one thread, " << concurrent_time*1e3 << " ms in " << nbr_threads << " threads (" << nbr_queries/concurrent_time << " queries/s)" << endl;
+}
+
+/** Reads from <em>fd</em> until <em>nbr_lines</em> complete lines have been received, and returns them. */
+static string read_lines(int fd, int nbr_lines) {
+	string received;
+	char buffer[65536];
+	while(count(received.begin(), received.end(), '\n') < nbr_lines) {
+		ssize_t size = recv(fd, buffer, sizeof(buffer), 0);
+		if(size <= 0) break;
+		received.append(buffer, size);
+	}
+	return received;
+}
+
+/** Measures the latency of the query protocol of QueryServer on the synthetic data of the Lund geometry, see bench_csv_parse().
+The requests are sent over a socket pair to a connection served in a thread: one at a time, waiting for every answer, and then all back to back. The requests are the chains of the article with 2 and 3 decays, one chain per request.
+*/
+static void bench_query_server(int nbr_requests) {
+	cout << "Query protocol on 1024 pixels x 4096 bins" << endl;
+
+	ofstream null_stream;
+	streambuf* cout_buffer = cout.rdbuf(null_stream.rdbuf());
+	RandomChains RC(1024, 4096, "csv");
+	cout.rdbuf(cout_buffer);
+	QueryServer server(RC.GetDataset());
+
+	//Every request has one chain of the article
+	const char* chains[2] = {"#2\na 0 2\nf 0 10\n", "#3\na 1 2\na 0 10\nf 0 50\n"};
+	string header = "Chains of the article\nExperiment_time(s): 1.433e+06\nalpha_low alpha_up escape_low escapes_up implants_low implants_up\n900 1100 0 400 1100 1800\nType Beam Time\n";
+	string requests[2], answers[2];
+	for(int k = 0; k < 2; k++) {
+		requests[k] = header + chains[k] + "END\n";
+		answers[k] = server.answer(header + chains[k]);
+	}
+
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		cout << "Could not create a socket pair" << endl;
+		abort();
+	}
+	thread connection(&QueryServer::serve_connection, &server, fds[1]);
+
+	double max_latency = 0;
+	double start = now();
+	for(int q = 0; q < nbr_requests; q++) {
+		double sent = now();
+		if(send(fds[0], requests[q%2].data(), requests[q%2].size(), 0) != (ssize_t)requests[q%2].size()) abort();
+		string answer = read_lines(fds[0], 1);
+		max_latency = max(max_latency, now() - sent);
+		if(answer != answers[q%2]) {
+			cout << "Wrong answer to request " << q << ": " << answer << endl;
+			abort();
+		}
+	}
+	double sequential_time = now() - start;
+
+	string all_requests, all_answers;
+	for(int q = 0; q < nbr_requests; q++) {
+		all_requests += requests[q%2];
+		all_answers += answers[q%2];
+	}
+	start = now();
+	//The answers are read in a thread of their own, so that neither side blocks on a full socket buffer
+	string received;
+	thread reader([&]() { received = read_lines(fds[0], nbr_requests); });
+	if(send(fds[0], all_requests.data(), all_requests.size(), 0) != (ssize_t)all_requests.size()) abort();
+	reader.join();
+	double pipelined_time = now() - start;
+	if(received != all_answers) {
+		cout << "Wrong answers to the pipelined requests" << endl;
+		abort();
+	}
+
+	//A malformed request is answered with an error, and the connection goes on with the next request
+	const char* malformed[3] = {"#x\na 0 2\n", "#2\na 0\nf 0 10\n", "#2\na zero 2\nf 0 10\n"};
+	for(int k = 0; k < 3; k++) {
+		string request = header + malformed[k] + "END\n" + requests[k%2];
+		if(send(fds[0], request.data(), request.size(), 0) != (ssize_t)request.size()) abort();
+		string answer = read_lines(fds[0], 2);
+		if(answer.compare(0, 6, "ERROR ") != 0 || answer.substr(answer.find('\n') + 1) != answers[k%2]) {
+			cout << "Wrong answer to malformed request " << k << ": " << answer << endl;
+			abort();
+		}
+	}
+
+	if(send(fds[0], "QUIT\n", 5, 0) != 5) abort();
+	connection.join();
+	close(fds[0]);
+
+	cout << "	one at a time: " << sequential_time/nbr_requests*1e6 << " us per query (at most " << max_latency*1e6 << " us)" << endl;
+	cout << "	back to back:  " << pipelined_time/nbr_requests*1e6 << " us per query" << endl;
+}
+
+/** Compares the deterministic and the fast reduction of ChainSet::evaluate() for several numbers of threads.
+The deterministic totals must be bitwise the same for every number of threads and every instruction set.
+*/
+static void bench_deterministic_reduction(int pixels, int nbr_chains, int nbr_rates) {
+	cout << "Reduction of " << nbr_chains << " chains over " << pixels << " pixels" << endl;
+
+	PixelMatrix<double> rate(nbr_rates, pixels);
+	for(int r = 0; r < nbr_rates; r++) {
+		for(int i = 0; i < pixels; i++) rate[r][i] = synthetic_count(i, r)*1e-4;
+	}
+	vector<long long> implants(pixels);
+	for(int i = 0; i < pixels; i++) implants[i] = 1000 + synthetic_count(i, 64);
+
+	ChainSet chain_set;
+	for(int j = 0; j < nbr_chains; j++) {
+		int rows[6];
+		double spans[6];
+		for(int l = 0; l < 6; l++) {
+			rows[l] = (j*7 + l*3)%nbr_rates;
+			spans[l] = 1 + (j*13 + l)%100;
+		}
+		chain_set.add_chain(rows, spans, 2 + j%5);
+	}
+
+	const int thread_counts[] = {1, 2, 3, 4, 8};
+	vector<double> reference;
+	SimdLevel best = simd_level();
+	for(int k = 0; k < 5; k++) {
+		ThreadPool pool(thread_counts[k]);
+		double time[2];
+		vector<double> totals[2];
+		//The best of three repetitions, alternating between the two modes
+		time[0] = time[1] = 1e30;
+		for(int r = 0; r < 3; r++) {
+			for(int deterministic = 0; deterministic < 2; deterministic++) {
+				totals[deterministic].resize(nbr_chains);
+				double start = now();
+				chain_set.evaluate(rate, implants, totals[deterministic].data(), &pool, deterministic);
+				time[deterministic] = min(time[deterministic], now() - start);
+			}
+		}
+
+		//The deterministic totals with every instruction set
+		for(int level = SIMD_SCALAR; level <= simd_supported_level(); level++) {
+			set_simd_level((SimdLevel)level);
+			vector<double> level_totals(nbr_chains);
+			chain_set.evaluate(rate, implants, level_totals.data(), &pool, true);
+			if(reference.empty()) reference = level_totals;
+			if(memcmp(reference.data(), level_totals.data(), nbr_chains*sizeof(double)) != 0) {
+				cout << "The deterministic totals with " << thread_counts[k] << " threads and the " << simd_level_name((SimdLevel)level) << " kernels differ!" << endl;
+				abort();
+			}
+		}
+		set_simd_level(best);
+
+		bool fast_same = memcmp(reference.data(), totals[0].data(), nbr_chains*sizeof(double)) == 0;
+		cout << "	" << thread_counts[k] << " threads: deterministic " << time[1]*1e3 << " ms, fast " << time[0]*1e3 << " ms (cost " << (time[1]/time[0] - 1)*100 << " %, fast totals " << (fast_same ? "the same" : "different") << ")" << endl;
+	}
+}
+
+/** Appends small deltas to a live dataset, as while a campaign is running, and compares the cost with evaluating the complete data again.
+Every update adds a few counts to random pixels of the three spectra and now and then a fission. At the end the elapsed time is changed, which updates all pixels. The expected random chains must be bitwise the same as those of Dataset::Evaluate() on the spectra with all deltas added.
+*/
+static void bench_live_dataset(int pixels, int bins, int nbr_updates) {
+	cout << "Live dataset, " << nbr_updates << " updates of " << pixels << " pixels x " << bins << " bins" << endl;
+
+	SpectrumMatrix spectra[3];
+	for(int s = 0; s < 3; s++) {
+		spectra[s].resize(pixels, bins);
+		for(int i = 0; i < pixels; i++) {
+			for(int k = 0; k < bins; k++) spectra[s][i][k] = density_count(i + s*pixels, k, 0.5);
+		}
+	}
+	vector<long long> fission_counts(pixels, 0);
+	for(int i = 0; i < pixels; i += 7) fission_counts[i] = 1;
+
+	write_article_chain_file("live_chains.txt", 1);
+	ChainQuery query;
+	ostringstream log;
+	if(!query.read("live_chains.txt", log)) {
+		cout << log.str();
+		abort();
+	}
+
+	auto make_dataset = [&]() {
+		long long nbr_fissions = 0;
+		for(int i = 0; i < pixels; i++) nbr_fissions += fission_counts[i];
+		vector<double> fissions(pixels);
+		for(int i = 0; i < pixels; i++) fissions[i] = fission_counts[i] != 0 ? (double)fission_counts[i] : (double)nbr_fissions/pixels;
+		return make_shared<const Dataset>(pixels, bins, make_shared<CumulativeSpectrum>(spectra[0]), make_shared<CumulativeSpectrum>(spectra[1]), make_shared<CumulativeSpectrum>(spectra[2]), fissions);
+	};
+
+	double start = now();
+	LiveDataset live(*make_dataset(), fission_counts, true, query);
+	double start_time = now() - start;
+
+	unsigned int x = 12345;
+	double update_time = 0;
+	long long nbr_pixels_updated = 0;
+	for(int u = 0; u < nbr_updates; u++) {
+		CampaignDelta delta;
+		vector<SpectrumCount>* counts[3] = {&delta.beam_on, &delta.reconstructed_beam_on, &delta.reconstructed_beam_off};
+		for(int c = 0; c < 10; c++) {
+			x = x*1664525u + 1013904223u;
+			SpectrumCount added = {(int)((x >> 8) % pixels), (int)((x >> 4) % 2048), 1};
+			counts[c % 3]->push_back(added);
+			spectra[c % 3][added.pixel][added.bin] += added.count;
+		}
+		if(u % 10 == 9) {
+			delta.fission_pixels.push_back(x % pixels);
+			fission_counts[x % pixels]++;
+		}
+		start = now();
+		nbr_pixels_updated += live.Append(delta).pixels;
+		update_time += now() - start;
+	}
+
+	CampaignDelta later;
+	later.experiment_time = 2*query.experiment_time;
+	start = now();
+	live.Append(later);
+	double time_update = now() - start;
+
+	query.experiment_time = later.experiment_time;
+	shared_ptr<const Dataset> complete = make_dataset();
+	start = now();
+	vector<double> full = complete->Evaluate(query);
+	double full_time = now() - start;
+	if(full != live.GetExpectedRandomChains()) {
+		cout << "The live dataset differs from the evaluation of the complete data!" << endl;
+		abort();
+	}
+
+	cout << "	Made in:               " << start_time*1e3 << " ms" << endl;
+	cout << "	Append of a delta:     " << update_time/nbr_updates*1e6 << " us (" << (double)nbr_pixels_updated/nbr_updates << " pixels)" << endl;
+	cout << "	New elapsed time:      " << time_update*1e3 << " ms (all pixels)" << endl;
+	cout << "	Complete evaluation:   " << full_time*1e3 << " ms" << endl;
+}
+
+/** Histograms a list-mode event file with different numbers of threads.
+The events are those of the synthetic spectra of write_synthetic_data(), one event per count, with a fission event in every 7th pixel and some events of beam OFF which were not reconstructed. The spectra must be the same for all numbers of threads, and RandomChains must give the same expected numbers of random chains from the event file as from the ".csv" files.
+*/
+static void bench_event_file(int pixels, int bins, double density) {
+	mkdir("events_csv", 0755);
+	mkdir("events_list", 0755);
+	write_synthetic_data("events_csv", pixels, bins, density);
+	write_article_chain_file("events_chains.txt", 1);
+
+	const uint8_t flags[3] = {EVENT_BEAM_ON, EVENT_BEAM_ON | EVENT_RECONSTRUCTED, EVENT_RECONSTRUCTED};
+	EventFileWriter writer;
+	writer.open(string("events_list/") + event_file_name);
+	vector<ListModeEvent> buffer;
+	uint64_t timestamp = 0;
+	for(int i = 0; i < pixels; i++) {
+		for(int s = 0; s < 3; s++) {
+			for(int k = 0; k < bins; k++) {
+				ListModeEvent event = {timestamp++, (uint32_t)i, (uint16_t)k, flags[s], 0};
+				for(int c = density_count(i + s*pixels, k, density); c > 0; c--) buffer.push_back(event);
+				if(k % 64 == 0) {
+					event.flags = 0;
+					buffer.push_back(event);
+				}
+			}
+		}
+		if(i % 7 == 0) {
+			ListModeEvent fission = {timestamp++, (uint32_t)i, 0, EVENT_FISSION, 0};
+			buffer.push_back(fission);
+		}
+		if(buffer.size() > (1 << 16)) {
+			writer.write(buffer.data(), buffer.size());
+			buffer.clear();
+		}
+	}
+	writer.write(buffer.data(), buffer.size());
+	writer.close();
+
+	int max_threads = thread::hardware_concurrency();
+	if(max_threads < 1) max_threads = 1;
+	vector<int> thread_counts;
+	for(int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+	thread_counts.push_back(max_threads);
+
+	EventHistograms single;
+	for(unsigned int k = 0; k < thread_counts.size(); k++) {
+		ThreadPool pool(thread_counts[k]);
+		EventHistograms histograms;
+		ostringstream log;
+		double start = now();
+		histogram_event_file(string("events_list/") + event_file_name, pixels, bins, pool, histograms, log);
+		double elapsed = now() - start;
+
+		if(k == 0) {
+			single = move(histograms);
+			cout << "List-mode event file, " << single.nbr_events << " events, " << pixels << " pixels x " << bins << " bins" << endl;
+		}
+		else if(memcmp(single.reconstructed_beam_on.data(), histograms.reconstructed_beam_on.data(), single.reconstructed_beam_on.size()*sizeof(int)) != 0 || single.fissions != histograms.fissions) {
+			cout << "The histograms depend on the number of threads!" << endl;
+			abort();
+		}
+		cout << "	" << thread_counts[k] << " threads: " << elapsed*1e3 << " ms (" << single.nbr_events/elapsed/1e6 << " million events/s)" << endl;
+	}
+
+	ofstream null_stream;
+	streambuf* cout_buffer = cout.rdbuf(null_stream.rdbuf());
+	RandomChains from_csv(pixels, bins, "events_csv");
+	from_csv.SetDecayChains("events_chains.txt");
+	from_csv.Run();
+	RandomChains from_events(pixels, bins, "events_list");
+	from_events.SetDecayChains("events_chains.txt");
+	from_events.Run();
+	cout.rdbuf(cout_buffer);
+	if(from_csv.GetExpectedRandomChains() != from_events.GetExpectedRandomChains()) {
+		cout << "The event file does not give the same expected random chains as the \".csv\" files!" << endl;
+		abort();
+	}
+	cout << "	Same expected random chains as from the \".csv\" files" << endl;
+}
+
+/** Evaluates a synthetic detector in <em>nbr_shards</em> shards of pixels, see run_shard(), first from the ".csv" files and then from the binary caches written by RandomChains. The merged shards must give bitwise the same expected random chains as RandomChains::Run() on the complete detector. The last shard ends inside a tile, as a detector whose pixels are not a multiple of the tiles does. A shard evaluated for another time span must then be rejected by merge_shards().
+*/
+static void bench_shards(int pixels, int bins, int nbr_shards) {
+	cout << "Shards, " << nbr_shards << " shards of " << pixels << " pixels x " << bins << " bins" << endl;
+	mkdir("shards", 0755);
+	write_synthetic_data("shards", pixels, bins, 0.5);
+	write_article_chain_file("shard_chains.txt", 1);
+	ChainQuery query;
+	ostringstream log;
+	if(!query.read("shard_chains.txt", log)) {
+		cout << log.str();
+		abort();
+	}
+
+	//Shards of whole tiles, the last one takes the rest
+	vector<int> first_pixels;
+	int tiles = (pixels + ChainSet::tile_pixels - 1)/ChainSet::tile_pixels;
+	for(int k = 0; k < nbr_shards; k++) first_pixels.push_back((tiles*k/nbr_shards)*ChainSet::tile_pixels);
+	first_pixels.push_back(pixels);
+
+	vector<ShardResult> shards(nbr_shards);
+	auto run_shards = [&](vector<double>& expected) {
+		double slowest = 0;
+		for(int k = 0; k < nbr_shards; k++) {
+			ThreadPool pool;
+			double start = now();
+			if(!run_shard("shards/", pixels, bins, first_pixels[k], first_pixels[k+1], query, &pool, shards[k], log)) {
+				cout << log.str();
+				abort();
+			}
+			slowest = max(slowest, now() - start);
+		}
+		merge_shards(shards, expected, log);
+		return slowest;
+	};
+
+	vector<double> from_csv, from_cache;
+	double csv_time = run_shards(from_csv);
+
+	ofstream null_stream;
+	streambuf* cout_buffer = cout.rdbuf(null_stream.rdbuf());
+	double start = now();
+	RandomChains complete(pixels, bins, "shards");
+	complete.SetDecayChains("shard_chains.txt");
+	complete.Run();
+	double complete_time = now() - start;
+	cout.rdbuf(cout_buffer);
+
+	double cache_time = run_shards(from_cache);
+	if(from_csv != complete.GetExpectedRandomChains() || from_cache != complete.GetExpectedRandomChains()) {
+		cout << "The merged shards differ from the complete detector!" << endl;
+		abort();
+	}
+	cout << "	Complete detector:     " << complete_time*1e3 << " ms" << endl;
+	cout << "	Slowest shard, .csv:   " << csv_time*1e3 << " ms" << endl;
+	cout << "	Slowest shard, cache:  " << cache_time*1e3 << " ms" << endl;
+	cout << "	Same expected random chains as the complete detector" << endl;
+
+	//A shard of another time span must not be merged with the others
+	ChainQuery other_query = query;
+	other_query.time_span[0] *= 2;
+	ThreadPool pool;
+	vector<double> mixed;
+	ostringstream mixed_log;
+	if(!run_shard("shards/", pixels, bins, first_pixels[nbr_shards-1], pixels, other_query, &pool, shards[nbr_shards-1], log) || merge_shards(shards, mixed, mixed_log)) {
+		cout << "A shard of another time span was merged!" << endl;
+		abort();
+	}
+	cout << "	" << mixed_log.str();
+}
+
+/** Measures how RandomChains::Run() scales with the number of threads on a large synthetic detector.
+The thread counts are the powers of two up to the number of hardware threads, and the number of hardware threads itself.
+*/
+static void bench_thread_scaling(int pixels, int bins) {
+	int max_threads = thread::hardware_concurrency();
+	if(max_threads < 1) max_threads = 1;
+	cout << "Scaling of RandomChains::Run(), " << pixels << " pixels x " << bins << " bins, 700 chains, up to " << max_threads << " threads" << endl;
+	mkdir("large", 0755);
+	write_synthetic_data("large", pixels, bins);
+	write_article_chain_file("large_chains.txt", 100);
+
+	vector<int> thread_counts;
+	for(int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+	thread_counts.push_back(max_threads);
+
+	double single_time = 0;
+	for(unsigned int k = 0; k < thread_counts.size(); k++) {
+		ofstream null_stream;
+		streambuf* cout_buffer = cout.rdbuf(null_stream.rdbuf());
+		RandomChains RC(pixels, bins, "large", thread_counts[k]);
+		RC.SetDecayChains("large_chains.txt");
+		double start = now();
+		RC.Run();
+		double elapsed = now() - start;
+		cout.rdbuf(cout_buffer);
+
+		if(k == 0) single_time = elapsed;
+		cout << "	" << thread_counts[k] << " threads: " << elapsed*1e3 << " ms (speedup " << single_time/elapsed << ")" << endl;
+	}
+}
+
+/** Compares the Monte Carlo simulation of simulate_random_chains() with the analytic expected number of random chains, and measures how many implants are simulated per minute.
+The implants are spread over an experiment of 10^5 s, and the rates are high enough that many accidental chains are simulated. The matches must be the same with any number of threads, and the mean must agree with the analytic result within five standard errors.
+*/
+static void bench_monte_carlo(int pixels, int nbr_chains, int nbr_replicas) {
+	cout << "Monte Carlo simulation of " << nbr_chains << " chains over " << pixels << " pixels, " << nbr_replicas << " replicas" << endl;
+
+	const int nbr_rates = 8;
+	PixelMatrix<double> rate(nbr_rates, pixels);
+	for(int r = 0; r < nbr_rates; r++) {
+		for(int i = 0; i < pixels; i++) rate[r][i] = (1 + synthetic_count(i, r))*2e-3;
+	}
+	vector<long long> implants(pixels);
+	for(int i = 0; i < pixels; i++) implants[i] = 500 + synthetic_count(i, 64);
+	const double experiment_time = 1e5;
+
+	ChainSet chain_set;
+	for(int j = 0; j < nbr_chains; j++) {
+		int rows[4];
+		double spans[4];
+		for(int l = 0; l < 4; l++) {
+			rows[l] = (j*3 + l)%nbr_rates;
+			spans[l] = 2 + (j*5 + l)%20;
+		}
+		chain_set.add_chain(rows, spans, 1 + j%4);
+	}
+	vector<double> analytic(nbr_chains);
+	chain_set.evaluate(rate, implants, analytic.data());
+
+	int max_threads = thread::hardware_concurrency();
+	if(max_threads < 1) max_threads = 1;
+	MonteCarloResult reference;
+	for(int threads = 1; ; threads = min(2*threads, max_threads)) {
+		ThreadPool pool(threads);
+		double start = now();
+		MonteCarloResult result = simulate_random_chains(chain_set, rate, implants, experiment_time, nbr_replicas, 12345, &pool);
+		double elapsed = now() - start;
+		cout << "	" << threads << " threads: " << result.nbr_implants << " implants in " << elapsed*1e3 << " ms, " << result.nbr_implants/elapsed*60 << " implants per minute" << endl;
+
+		if(reference.nbr_matches.empty()) reference = result;
+		if(result.nbr_matches != reference.nbr_matches) {
+			cout << "The matches with " << threads << " threads differ!" << endl;
+			abort();
+		}
+		if(threads == max_threads) break;
+	}
+
+	double max_pull = 0;
+	for(int j = 0; j < nbr_chains; j++) {
+		double pull = fabs(reference.mean[j] - analytic[j])/reference.error[j];
+		max_pull = max(max_pull, pull);
+		if(!(pull < 5)) {
+			cout << "The Monte Carlo result of chain " << j+1 << ", " << reference.mean[j] << " +- " << reference.error[j] << ", disagrees with the analytic " << analytic[j] << endl;
+			abort();
+		}
+	}
+	cout << "	largest difference to the analytic result: " << max_pull << " standard errors" << endl;
+}
+
+/** The time of one phase of bench_phases(): the best of its repetitions, and the work done per second. */
+struct PhaseTiming {
+	string name;
+	double seconds;
+	double rate;
+	string unit;
+};
+
+/** Times every phase of a calculation separately on a synthetic detector, and writes the times as JSON.
+The phases are the parsing of the spectrum files with parse_csv(), the read in of a data folder by the constructor of RandomChains without and with the spectrum caches, the implant sums, the calculation of one rate vector, and the evaluation of 1, 10, 10^3 and 10^5 chains with ChainSet::evaluate(). The chains are the article chains, repeated. Every phase except the read in is the best of a few repetitions, on a pool with the default number of threads.
+	@param pixels number of pixels of the synthetic detector
+	@param bins number of bins per pixel
+	@param density mean counts per bin, see density_count()
+	@param json_file the file the times are written to, nothing is written if it is empty
+*/
+static void bench_phases(int pixels, int bins, double density, string json_file) {
+	cout << "Phases on " << pixels << " pixels x " << bins << " bins, " << density << " counts per bin" << endl;
+	mkdir("phases", 0755);
+	write_synthetic_data("phases", pixels, bins, density);
+	ThreadPool pool;
+	vector<PhaseTiming> phases;
+
+	//The three spectra are parsed one after another, as by RandomChains with one thread
+	const char* spectra[] = {"beam_on.csv", "rec_beam_on.csv", "rec_beam_off.csv"};
+	SpectrumMatrix spectrum(pixels, bins);
+	double megabytes = 0;
+	double parse_time = best_time(3, [&]() {
+		megabytes = 0;
+		for(int s = 0; s < 3; s++) {
+			MappedFile file;
+			file.open(string("phases/") + spectra[s], MAPPED_SEQUENTIAL, true);
+			CsvArrayWriter writer(spectrum.data(), spectrum.size());
+			parse_csv(file.begin(), file.end(), writer);
+			megabytes += file.size()/1e6;
+		}
+	});
+	phases.push_back({"csv_parse", parse_time, megabytes/parse_time, "MB/s"});
+
+	double index_time = best_time(3, [&]() { CumulativeSpectrum index(spectrum); });
+	phases.push_back({"index_build", index_time, pixels/index_time, "pixels/s"});
+
+	ofstream null_stream;
+	streambuf* cout_buffer = cout.rdbuf(null_stream.rdbuf());
+	double start = now();
+	{
+		RandomChains RC(pixels, bins, "phases");
+	}
+	double load_time = now() - start;
+	start = now();
+	RandomChains RC(pixels, bins, "phases");
+	double cached_load_time = now() - start;
+	cout.rdbuf(cout_buffer);
+	phases.push_back({"load_csv", load_time, megabytes/load_time, "MB/s"});
+	phases.push_back({"load_cache", cached_load_time, megabytes/cached_load_time, "MB/s"});
+
+	shared_ptr<const Dataset> dataset = RC.GetDataset();
+	vector<long long> implants(pixels);
+	double implant_time = best_time(5, [&]() { dataset->implants(1100, 1800, implants.data(), &pool); });
+	phases.push_back({"implant_sums", implant_time, pixels/implant_time, "pixels/s"});
+
+	//The rate vectors of the article chains: alphas with beam ON and OFF, escapes with beam ON and OFF, fissions
+	const RateKey keys[5] = {{'a', 1, 900, 1100}, {'a', 0, 900, 1100}, {'e', 1, 0, 400}, {'e', 0, 0, 400}, {'f', 0, 0, 0}};
+	PixelMatrix<double> rate(5, pixels);
+	double rate_time = best_time(5, [&]() { dataset->rates(keys[0], 1.433e6, rate.row(0), &pool); });
+	phases.push_back({"rate_calc", rate_time, pixels/rate_time, "pixels/s"});
+	for(int k = 1; k < 5; k++) dataset->rates(keys[k], 1.433e6, rate.row(k), &pool);
+
+	//The article chains by the rows of their decays
+	const int article_length[7] = {2, 2, 3, 3, 3, 3, 3};
+	const int article_rows[7][3] = {{1, 4}, {3, 4}, {0, 1, 4}, {0, 1, 4}, {1, 1, 4}, {1, 1, 4}, {3, 2, 4}};
+	const double article_spans[3] = {2, 10, 50};
+	const int chain_counts[4] = {1, 10, 1000, 100000};
+	for(int n = 0; n < 4; n++) {
+		ChainSet chain_set;
+		for(int j = 0; j < chain_counts[n]; j++) {
+			chain_set.add_chain(article_rows[j%7], article_spans, article_length[j%7]);
+		}
+		vector<double> totals(chain_set.chains());
+		double evaluate_time = best_time(chain_counts[n] < 100000 ? 5 : 2, [&]() { chain_set.evaluate(rate, implants, totals.data(), &pool); });
+		ostringstream name;
+		name << "chain_evaluation_" << chain_counts[n];
+		phases.push_back({name.str(), evaluate_time, (double)chain_set.decays()*pixels/evaluate_time, "decays x pixels/s"});
+	}
+
+	for(unsigned int k = 0; k < phases.size(); k++) {
+		cout << "	" << phases[k].name << ": " << phases[k].seconds*1e3 << " ms (" << phases[k].rate << " " << phases[k].unit << ")" << endl;
+	}
+	if(json_file.empty()) return;
+
+	ofstream json(json_file);
+	json.precision(6);
+	json << "{" << endl;
+	json << "	\"pixels\": " << pixels << "," << endl;
+	json << "	\"bins\": " << bins << "," << endl;
+	json << "	\"density\": " << density << "," << endl;
+	json << "	\"threads\": " << pool.size() << "," << endl;
+	json << "	\"simd\": \"" << simd_level_name(simd_level()) << "\"," << endl;
+	json << "	\"phases\": [" << endl;
+	for(unsigned int k = 0; k < phases.size(); k++) {
+		json << "		{\"name\": \"" << phases[k].name << "\", \"seconds\": " << phases[k].seconds << ", \"rate\": " << phases[k].rate << ", \"unit\": \"" << phases[k].unit << "\"}" << (k + 1 < phases.size() ? "," : "") << endl;
+	}
+	json << "	]" << endl;
+	json << "}" << endl;
+	cout << "The times are written to " << json_file << endl;
+}
+
+/** Callback for nftw() which removes every file and directory. */
+static int remove_entry(const char* path, const struct stat*, int, struct FTW*) {
+	return remove(path);
+}
+
+/** Runs all benchmarks, or with <tt>--phases</tt> only bench_phases():
+
+	<tt>bench_file --phases [--pixels N] [--bins N] [--density D] [--json file]</tt>
+
+The synthetic data files are written to a temporary working directory, which is removed at the end.
+*/
+int main(int argc, char** argv) {
+	bool phases_only = false;
+	int pixels = 1024, bins = 4096;
+	double density = 1;
+	string json_file;
+	for(int k = 1; k < argc; k++) {
+		string option = argv[k];
+		bool has_value = k + 1 < argc;
+		if(option == "--phases") phases_only = true;
+		else if(option == "--pixels" && has_value) pixels = atoi(argv[++k]);
+		else if(option == "--bins" && has_value) bins = atoi(argv[++k]);
+		else if(option == "--density" && has_value) density = atof(argv[++k]);
+		else if(option == "--json" && has_value) json_file = argv[++k];
+		else {
+			cout << "Usage: " << argv[0] << " [--phases [--pixels N] [--bins N] [--density D] [--json file]]" << endl;
+			return 1;
+		}
+	}
+	//The JSON file is relative to the directory the benchmark is started in
+	char start_dir[4096];
+	if(!json_file.empty() && json_file[0] != '/' && getcwd(start_dir, sizeof(start_dir))) json_file = string(start_dir) + "/" + json_file;
+
+	char work_dir[] = "/tmp/randomchains_bench_XXXXXX";
+	if(!mkdtemp(work_dir) || chdir(work_dir) != 0) {
+		cout << "Could not create a temporary working directory" << endl;
+		return 1;
+	}
+	mkdir("data", 0755);
+
+	if(phases_only) {
+		bench_phases(pixels, bins, density, json_file);
+		if(chdir("/") == 0) nftw(work_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+		return 0;
+	}
+
+	//The Lund geometry
+	bench_spectrum_layout(1024, 4096);
+	//A large segmented detector
+	bench_spectrum_layout(16384, 8192);
+
+	bench_window_index(1024, 4096, 1000);
+	bench_streaming_index(1024, 4096);
+	bench_sparse_index(1024, 4096, 1000, vector<double>{0.01, 0.05, 0.2, 1});
+	//The Lund geometry, and a 16k pixel detector
+	bench_compressed_index(1024, 4096, 1000);
+	bench_compressed_index(1024, 4096, 1000, 0.5);
+	bench_compressed_index(16384, 4096, 100);
+
+	bench_csv_parse(1024, 4096);
+
+	bench_run_allocations();
+
+	bench_sweep();
+	bench_dataset_queries(1000);
+	bench_live_dataset(16384, 4096, 1000);
+	bench_query_server(2000);
+
+	bench_kernel_accuracy();
+	bench_chain_batch(1024, 4000, 32);
+	bench_chain_kernels(1021, 500, 32);
+
+	bench_deterministic_reduction(262144, 200, 32);
+	bench_thread_scaling(65536, 256);
+	bench_event_file(1024, 4096, 0.5);
+	bench_shards(2100, 4096, 3);
+
+	bench_monte_carlo(2048, 16, 10);
+
+	bench_phases(pixels, bins, density, json_file);
+
+	if(chdir("/") == 0) nftw(work_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	return 0;
+}
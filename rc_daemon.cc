@@ -0,0 +1,34 @@
+/*!
+@file rc_daemon.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+
+@brief Resident query daemon: reads in the experimental data once and answers queries of decay chains, see QueryServer.
+
+Usage: <tt>rc_daemon folder pixels bins [socket_path]</tt>
+
+Without a socket path the requests are read from stdin and answered on stdout. The messages of the read in are written to stderr, so stdout only carries the answers.
+*/
+#include <cstdlib>
+#include "RandomChains.h"
+#include "QueryServer.h"
+
+int main(int argc, char** argv) {
+	if(argc < 4) {
+		cerr << "Usage: " << argv[0] << " folder pixels bins [socket_path]" << endl;
+		return 1;
+	}
+
+	//The messages of RandomChains are printed on cout, which carries the answers in the stdin mode
+	streambuf* cout_buffer = cout.rdbuf(cerr.rdbuf());
+	RandomChains RC(atoi(argv[2]), atoi(argv[3]), argv[1]);
+	cout.rdbuf(cout_buffer);
+
+	QueryServer server(RC.GetDataset());
+	if(argc < 5) {
+		server.serve_stream(cin, cout);
+		return 0;
+	}
+
+	cerr << "Answering queries on " << argv[4] << endl;
+	return server.serve_socket(argv[4], cerr) ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+/*!
+@file rc_generate.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+
+@brief Writes a synthetic data folder for load and scaling tests, see write_synthetic_data_folder().
+
+Usage: <tt>rc_generate folder pixels bins [options]</tt>, with the options
+	- <tt>--seed N</tt>: the seed of the counts (1)
+	- <tt>--format csv|binary|both</tt>: the ".csv" files, the binary caches only, or both (both)
+	- <tt>--scale F</tt>: factor of all mean counts per bin (1)
+	- <tt>--hot-fraction F</tt>: fraction of hot pixels (0.01)
+	- <tt>--hot-factor F</tt>: factor of the mean counts in the hot pixels (10)
+	- <tt>--fissions F</tt>: mean number of fissions per pixel (2)
+	- <tt>--threads N</tt>: number of threads, see ThreadPool::default_threads()
+*/
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include "SyntheticData.h"
+
+using namespace std;
+
+int main(int argc, char** argv) {
+	if(argc < 4) {
+		cerr << "Usage: " << argv[0] << " folder pixels bins [--seed N] [--format csv|binary|both] [--scale F] [--hot-fraction F] [--hot-factor F] [--fissions F] [--threads N]" << endl;
+		return 1;
+	}
+
+	SyntheticDetector detector;
+	detector.pixels = atoi(argv[2]);
+	detector.bins = atoi(argv[3]);
+	int format = SYNTHETIC_BOTH;
+	int threads = 0;
+	double scale = 1;
+	for(int k = 4; k + 1 < argc; k += 2) {
+		string option = argv[k], value = argv[k+1];
+		if(option == "--seed") detector.seed = strtoull(value.c_str(), NULL, 10);
+		else if(option == "--format") {
+			if(value == "csv") format = SYNTHETIC_CSV;
+			else if(value == "binary") format = SYNTHETIC_BINARY;
+			else if(value == "both") format = SYNTHETIC_BOTH;
+			else {
+				cerr << "Unknown format " << value << endl;
+				return 1;
+			}
+		}
+		else if(option == "--scale") scale = atof(value.c_str());
+		else if(option == "--hot-fraction") detector.hot_fraction = atof(value.c_str());
+		else if(option == "--hot-factor") detector.hot_factor = atof(value.c_str());
+		else if(option == "--fissions") detector.fissions_per_pixel = atof(value.c_str());
+		else if(option == "--threads") threads = atoi(value.c_str());
+		else {
+			cerr << "Unknown option " << option << endl;
+			return 1;
+		}
+	}
+	if(detector.pixels <= 0 || detector.bins <= 0 || (argc - 4)%2 != 0) {
+		cerr << "The number of pixels and bins must be positive, and every option needs a value" << endl;
+		return 1;
+	}
+	detector.background_mean *= scale;
+	detector.escape_mean *= scale;
+	detector.alpha_mean *= scale;
+	detector.implant_mean *= scale;
+
+	ThreadPool pool(threads);
+	cout << "Writing " << detector.pixels << " pixels x " << detector.bins << " bins to " << argv[1] << " with " << pool.size() << " threads, seed " << detector.seed << endl;
+	return write_synthetic_data_folder(argv[1], detector, format, pool, cout) ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+/*!
+@file rc_shard.cc
+@author Anton Roth (anton.roth@nuclear.lu.se)
+
+@brief Evaluates one shard of the pixels of a detector, or merges the shards into the totals of the complete detector, see run_shard() and merge_shards().
+
+Usage:
+	- <tt>rc_shard run folder pixels bins first_pixel last_pixel chains_file output [threads]</tt>: evaluates the chains of <tt>chains_file</tt> (see ChainQuery::read()) on the pixels <tt>first_pixel</tt> to <tt>last_pixel</tt>-1 and writes the shard to <tt>output</tt>
+	- <tt>rc_shard merge shard_files...</tt>: merges the shards of the complete detector and prints the expected random chains as RandomChains::print_result() does
+
+The shards start at multiples of 256 pixels, see check_shard_range(), and can be run as separate processes, also on different machines which share the data folder.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include "Shard.h"
+
+using namespace std;
+
+static int usage(const char* program) {
+	cerr << "Usage: " << program << " run folder pixels bins first_pixel last_pixel chains_file output [threads]" << endl;
+	cerr << "       " << program << " merge shard_files..." << endl;
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	if(argc < 2) return usage(argv[0]);
+	string command = argv[1];
+
+	if(command == "run") {
+		if(argc < 9) return usage(argv[0]);
+		ChainQuery query;
+		if(!query.read(argv[7], cerr)) return 1;
+
+		ThreadPool pool(argc > 9 ? atoi(argv[9]) : 0);
+		ShardResult shard;
+		if(!run_shard(string(argv[2]) + "/", atoi(argv[3]), atoi(argv[4]), atoi(argv[5]), atoi(argv[6]), query, &pool, shard, cerr)) return 1;
+		if(!shard.write(argv[8])) {
+			cerr << "The shard " << argv[8] << " could not be written" << endl;
+			return 1;
+		}
+		cerr << "The shard of the pixels " << shard.first_pixel << " to " << shard.last_pixel-1 << " was written to " << argv[8] << endl;
+		return 0;
+	}
+
+	if(command == "merge") {
+		if(argc < 3) return usage(argv[0]);
+		vector<ShardResult> shards(argc - 2);
+		for(int k = 2; k < argc; k++) {
+			if(!shards[k-2].read(argv[k], cerr)) return 1;
+		}
+		vector<double> expected;
+		if(!merge_shards(shards, expected, cerr)) return 1;
+
+		cout << "**************************************************" << endl;
+		cout << "These are the result of the run: " << endl;
+		cout << "The total number of expected random chains of the same type as the given chain due to random fluctuations in the background are: " << endl;
+		for(unsigned int j = 0; j < expected.size(); j++) {
+			cout << "For chain " << j+1 << ": " << expected[j] << endl;
+		}
+		return 0;
+	}
+
+	return usage(argv[0]);
+}
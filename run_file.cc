@@ -32,6 +32,25 @@ int main() {
 	//Giving an input to the RandomChains::Run method relieves the user from giving any inputs during a run
 	RC_mod->SetDecayChains(chains_input_file);
 	RC_mod->Run();
+
+	//The time, memory and work of every phase of the read in and the run, as JSON (or CSV for a ".csv" file)
+	RC_mod->WritePhaseReport("phases.json");
+
+	//A grid of bin limits and time spans is evaluated for the same chains, without reading in the data again
+	RC_mod->Sweep("sweep_article.txt", "sweep_result.tsv");
+
+	//A Monte Carlo simulation of 10 experiments as a cross-check, with rates high enough that accidental chains occur
+	RC_mod->RunMonteCarlo(10, 1, 3e4);
+
+	//Many queries can be evaluated on the data read in once, without changing it
+	shared_ptr<const Dataset> dataset = RC_mod->GetDataset();
+	ChainQuery query;
+	query.read("dump_input.txt", cout);
+	vector<double> expected = dataset->Evaluate(query);
+
+	//For very large detectors only the energy windows of the chains can be kept in memory, the chains are then given to the constructor
+	RandomChains* RC_stream = new RandomChains(nbr_of_pixels, nbr_of_bins, folder_with_data, chains_input_file);
+	RC_stream->Run();
 	*/
 	
 	return 0;